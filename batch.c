@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "interpreter.h"
+#include "misc.h"
+#include "output.h"
+#include "search.h"
+#include "statistics.h"
+
+/* Queries are given one per line.  Blank lines are skipped. */
+size_t
+read_queries(FILE *stream, char ***queries)
+{
+    size_t n_queries = 0;
+    *queries = NULL;
+    int c = fgetc(stream);
+    while (c != EOF)
+    {
+        size_t len = 0;
+        char *data = NULL;
+        bool blank = true;
+        while ((c != '\n') && (c != EOF))
+        {
+            if (c != '\r')
+            {
+                len++;
+                data = (char *) reallocmem(data, len);
+                data[len-1] = (char) c;
+                if (isspace(c) == false)
+                {
+                    blank = false;
+                }
+            }
+            c = fgetc(stream);
+        }
+        if (blank == false)
+        {
+            len++;
+            data = (char *) reallocmem(data, len);
+            data[len-1] = '\0';
+            n_queries++;
+            *queries = (char **) reallocmem(*queries, n_queries * sizeof(char *));
+            (*queries)[n_queries-1] = data;
+        }
+        else
+        {
+            freemem(data);
+        }
+        c = fgetc(stream);
+    }
+    return n_queries;
+}
+
+void
+free_queries(size_t n_queries, char **queries)
+{
+    for (size_t i = 0; i < n_queries; i++)
+    {
+        freemem(queries[i]);
+    }
+    freemem(queries);
+}
+
+unsigned int
+default_number_of_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n < 1) ? 1 : (unsigned int) n;
+}
+
+static void *
+run_batch_jobs(void *data)
+{
+    Batch *batch = (Batch *) data;
+    while (true)
+    {
+        pthread_mutex_lock(&(batch->mutex));
+        size_t i = batch->next_job;
+        if (i < batch->n_jobs)
+        {
+            batch->next_job++;
+        }
+        pthread_mutex_unlock(&(batch->mutex));
+        if (i >= batch->n_jobs)
+        {
+            break;
+        }
+
+        BatchJob *job = &(batch->jobs[i]);
+        char *output = NULL;
+        size_t size = 0;
+        FILE *stream = open_memstream(&output, &size);
+        if (stream == NULL)
+        {
+            fprintf(stderr, "%s: error allocating memory\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        interpret_query(stream, job->query, batch->segments, batch->n_segments, batch->cache, batch->search_options, batch->options);
+        fclose(stream);
+
+        pthread_mutex_lock(&(batch->mutex));
+        job->output = output;
+        job->size = size;
+        job->done = true;
+        pthread_cond_broadcast(&(batch->job_done));
+        pthread_mutex_unlock(&(batch->mutex));
+    }
+    merge_statistics();
+    return NULL;
+}
+
+/* All queries share one term cache, so a term that appears in many queries
+ * is only looked up in each trie once.  The main thread prints each block of
+ * results as soon as it and every block before it are finished. */
+void
+interpret_queries(FILE *stream, size_t n_queries, char **queries, Segment *segments, size_t n_segments,
+                  SearchOptions search_options, OutputOptions options, unsigned int n_threads)
+{
+    assert(n_threads > 0);
+    Batch batch;
+    batch.jobs = (BatchJob *) allocmem((n_queries == 0) ? 1 : n_queries, sizeof(BatchJob));
+    for (size_t i = 0; i < n_queries; i++)
+    {
+        batch.jobs[i].query = queries[i];
+        batch.jobs[i].output = NULL;
+        batch.jobs[i].size = 0;
+        batch.jobs[i].done = false;
+    }
+    batch.n_jobs = n_queries;
+    batch.next_job = 0;
+    batch.segments = segments;
+    batch.n_segments = n_segments;
+    batch.cache = init_term_cache();
+    batch.search_options = search_options;
+    batch.options = options;
+    pthread_mutex_init(&(batch.mutex), NULL);
+    pthread_cond_init(&(batch.job_done), NULL);
+
+    if (n_threads > n_queries)
+    {
+        n_threads = (n_queries == 0) ? 1 : (unsigned int) n_queries;
+    }
+    pthread_t *threads = (pthread_t *) allocmem(n_threads, sizeof(pthread_t));
+    for (unsigned int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&(threads[i]), NULL, run_batch_jobs, &batch) != 0)
+        {
+            fprintf(stderr, "%s: error creating thread\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (size_t i = 0; i < n_queries; i++)
+    {
+        BatchJob *job = &(batch.jobs[i]);
+        pthread_mutex_lock(&(batch.mutex));
+        while (job->done == false)
+        {
+            pthread_cond_wait(&(batch.job_done), &(batch.mutex));
+        }
+        pthread_mutex_unlock(&(batch.mutex));
+        double phase_start = start_phase();
+        fprintf(stream, "query:%zu:%s\n", i + 1, job->query);
+        fwrite(job->output, sizeof(char), job->size, stream);
+        if ((job->size > 0) && (job->output[job->size-1] != '\n'))
+        {
+            fprintf(stream, "\n");
+        }
+        end_phase(PH_PRINT, phase_start);
+        free(job->output);
+        job->output = NULL;
+    }
+
+    for (unsigned int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    freemem(threads);
+    pthread_cond_destroy(&(batch.job_done));
+    pthread_mutex_destroy(&(batch.mutex));
+    free_term_cache(batch.cache);
+    freemem(batch.jobs);
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "interpreter.h"
+#include "output.h"
+#include "search.h"
+
+/* Each query in a batch writes its results to its own memory buffer.  The
+ * buffers are printed in the order that the queries were given, no matter
+ * which thread finishes first. */
+typedef struct BatchJob
+{
+    char *query;
+    char *output;
+    size_t size;
+    bool done;
+} BatchJob;
+
+typedef struct Batch
+{
+    BatchJob *jobs;
+    size_t n_jobs;
+    size_t next_job;
+    Segment *segments;
+    size_t n_segments;
+    TermCache *cache;
+    SearchOptions search_options;
+    OutputOptions options;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_done;
+} Batch;
+
+size_t read_queries(FILE *, char ***);
+void free_queries(size_t, char **);
+unsigned int default_number_of_threads(void);
+void interpret_queries(FILE *, size_t, char **, Segment *, size_t, SearchOptions, OutputOptions, unsigned int);
+
+#endif /* BATCH_H */
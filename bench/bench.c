@@ -0,0 +1,658 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "misc.h"
+
+/* The benchmark harness generates a deterministic synthetic corpus, runs wosp
+ * on it once per benchmark case, and prints one JSON object per measurement on
+ * stdout.  Each case runs wosp in a child process so that its peak resident
+ * set size can be read back with wait4.  The child also runs with --stats=json,
+ * and its report of counters and phase times is copied into the measurement. */
+
+static const char bench_name[] = "bench";
+
+typedef struct CorpusOptions
+{
+    unsigned long n_words;
+    unsigned long n_files;
+    unsigned long vocabulary;
+    double zipf_exponent;
+    unsigned long seed;
+    unsigned int min_sentence_words;
+    unsigned int max_sentence_words;
+    unsigned int max_paragraph_sentences;
+    unsigned int line_width;
+} CorpusOptions;
+
+typedef struct Corpus
+{
+    char **vocabulary;
+    double *cdf;
+    unsigned long n_vocabulary;
+    char **filenames;
+    unsigned long n_files;
+    unsigned long n_bytes;
+} Corpus;
+
+typedef struct BenchCase
+{
+    const char *name;
+    const char *phase;
+    char *query;
+} BenchCase;
+
+static CorpusOptions
+init_corpus_options(void)
+{
+    CorpusOptions options;
+    options.n_words = 20000;
+    options.n_files = 1;
+    options.vocabulary = 5000;
+    options.zipf_exponent = 1.0;
+    options.seed = 1;
+    options.min_sentence_words = 4;
+    options.max_sentence_words = 24;
+    options.max_paragraph_sentences = 6;
+    options.line_width = 72;
+    return options;
+}
+
+/* splitmix64, so the corpus only depends on the seed and not on the C
+ * library's random number generator. */
+static uint64_t
+next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static double
+uniform_random(uint64_t *state)
+{
+    return (double) (next_random(state) >> 11) / 9007199254740992.0;
+}
+
+static unsigned long
+range_random(uint64_t *state, unsigned long low, unsigned long high)
+{
+    return low + (unsigned long) (next_random(state) % (high - low + 1));
+}
+
+/* Word i is spelled by writing i in base 15 with a syllable for each digit, so
+ * every word is distinct and pronounceable enough to read in the output. */
+static char *
+vocabulary_word(unsigned long i)
+{
+    static const char *syllables[] = {"ka", "lo", "mi", "nu", "pe", "ra", "si", "to",
+                                      "vu", "be", "do", "fi", "ga", "he", "ju"};
+    size_t n_syllables = sizeof(syllables) / sizeof(syllables[0]);
+    char buffer[64];
+    size_t len = 0;
+    unsigned long j = i;
+    do
+    {
+        const char *syllable = syllables[j % n_syllables];
+        buffer[len++] = syllable[0];
+        buffer[len++] = syllable[1];
+        j /= n_syllables;
+    }
+    while ((j > 0) && (len + 2 < sizeof(buffer)));
+    if (len < 4)
+    {
+        buffer[len++] = 'n';
+    }
+    buffer[len] = '\0';
+    char *word = (char *) allocmem(len + 1, sizeof(char));
+    snprintf(word, len + 1, "%s", buffer);
+    return word;
+}
+
+static void
+init_vocabulary(Corpus *corpus, CorpusOptions options)
+{
+    corpus->n_vocabulary = options.vocabulary;
+    corpus->vocabulary = (char **) allocmem(options.vocabulary, sizeof(char *));
+    corpus->cdf = (double *) allocmem(options.vocabulary, sizeof(double));
+    double total = 0.0;
+    for (unsigned long i = 0; i < options.vocabulary; i++)
+    {
+        corpus->vocabulary[i] = vocabulary_word(i);
+        total += 1.0 / pow((double) (i + 1), options.zipf_exponent);
+        corpus->cdf[i] = total;
+    }
+    for (unsigned long i = 0; i < options.vocabulary; i++)
+    {
+        corpus->cdf[i] /= total;
+    }
+}
+
+static unsigned long
+zipf_random(Corpus *corpus, uint64_t *state)
+{
+    double u = uniform_random(state);
+    unsigned long low = 0, high = corpus->n_vocabulary - 1;
+    while (low < high)
+    {
+        unsigned long mid = low + (high - low) / 2;
+        if (corpus->cdf[mid] < u)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* Writes sentences of capitalized words ending in periods, with occasional
+ * commas, wrapped into lines and separated into paragraphs by blank lines. */
+static unsigned long
+write_corpus_file(FILE *f, Corpus *corpus, CorpusOptions options, unsigned long n_words, uint64_t *state)
+{
+    unsigned long n_bytes = 0, i = 0;
+    unsigned int column = 0;
+    while (i < n_words)
+    {
+        unsigned long n_sentences = range_random(state, 1, options.max_paragraph_sentences);
+        for (unsigned long j = 0; (j < n_sentences) && (i < n_words); j++)
+        {
+            unsigned long n_sentence_words = range_random(state, options.min_sentence_words, options.max_sentence_words);
+            for (unsigned long k = 0; (k < n_sentence_words) && (i < n_words); k++, i++)
+            {
+                char buffer[80];
+                int len = snprintf(buffer, sizeof(buffer), "%s", corpus->vocabulary[zipf_random(corpus, state)]);
+                if (k == 0)
+                {
+                    buffer[0] = (char) toupper(buffer[0]);
+                }
+                if ((k + 1 == n_sentence_words) || (i + 1 == n_words))
+                {
+                    buffer[len++] = '.';
+                }
+                else if (uniform_random(state) < 0.08)
+                {
+                    buffer[len++] = ',';
+                }
+                buffer[len] = '\0';
+                if ((column > 0) && (column + 1 + (unsigned int) len > options.line_width))
+                {
+                    fputc('\n', f);
+                    n_bytes++;
+                    column = 0;
+                }
+                if (column > 0)
+                {
+                    fputc(' ', f);
+                    n_bytes++;
+                    column++;
+                }
+                fputs(buffer, f);
+                n_bytes += (unsigned long) len;
+                column += (unsigned int) len;
+            }
+        }
+        fputs("\n\n", f);
+        n_bytes += 2;
+        column = 0;
+    }
+    return n_bytes;
+}
+
+static void
+generate_corpus(Corpus *corpus, CorpusOptions options, const char *directory)
+{
+    uint64_t state = options.seed;
+    if ((mkdir(directory, 0755) != 0) && (errno != EEXIST))
+    {
+        fprintf(stderr, "%s: Cannot create directory '%s'\n", bench_name, directory);
+        exit(EXIT_FAILURE);
+    }
+    init_vocabulary(corpus, options);
+    corpus->n_files = options.n_files;
+    corpus->filenames = (char **) allocmem(options.n_files, sizeof(char *));
+    corpus->n_bytes = 0;
+    for (unsigned long i = 0; i < options.n_files; i++)
+    {
+        size_t len = strlen(directory) + 32;
+        corpus->filenames[i] = (char *) allocmem(len, sizeof(char));
+        snprintf(corpus->filenames[i], len, "%s/doc%06lu.txt", directory, i);
+        FILE *f = fopen(corpus->filenames[i], "w");
+        if (f == NULL)
+        {
+            fprintf(stderr, "%s: Cannot write file '%s'\n", bench_name, corpus->filenames[i]);
+            exit(EXIT_FAILURE);
+        }
+        unsigned long n_words = options.n_words / options.n_files + ((i < options.n_words % options.n_files) ? 1 : 0);
+        corpus->n_bytes += write_corpus_file(f, corpus, options, n_words, &state);
+        fclose(f);
+    }
+}
+
+static void
+free_corpus(Corpus *corpus, bool remove_files)
+{
+    for (unsigned long i = 0; i < corpus->n_vocabulary; i++)
+    {
+        free(corpus->vocabulary[i]);
+    }
+    for (unsigned long i = 0; i < corpus->n_files; i++)
+    {
+        if (remove_files == true)
+        {
+            unlink(corpus->filenames[i]);
+        }
+        free(corpus->filenames[i]);
+    }
+    free(corpus->vocabulary);
+    free(corpus->cdf);
+    free(corpus->filenames);
+}
+
+static double
+elapsed_seconds(struct timespec start, struct timespec end)
+{
+    return (double) (end.tv_sec - start.tv_sec) + 1.0e-9 * (double) (end.tv_nsec - start.tv_nsec);
+}
+
+/* The last line of the child's stderr that looks like a JSON object. */
+static char *
+read_statistics(FILE *f)
+{
+    char *stats = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    rewind(f);
+    while (getline(&line, &size, f) > 0)
+    {
+        if (line[0] == '{')
+        {
+            free(stats);
+            line[strcspn(line, "\n")] = '\0';
+            stats = line;
+            line = NULL;
+            size = 0;
+        }
+    }
+    free(line);
+    return stats;
+}
+
+/* Runs wosp with the given arguments and the corpus files appended, sending
+ * its output to /dev/null. */
+static bool
+run_wosp(const char *wosp, char **args, size_t n_args, Corpus *corpus, double *seconds, long *peak_rss_kb, char **stats)
+{
+    size_t n = 2 + n_args + corpus->n_files + 1;
+    char **argv = (char **) allocmem(n, sizeof(char *));
+    argv[0] = (char *) wosp;
+    argv[1] = "--stats=json";
+    for (size_t i = 0; i < n_args; i++)
+    {
+        argv[2+i] = args[i];
+    }
+    for (unsigned long i = 0; i < corpus->n_files; i++)
+    {
+        argv[2+n_args+i] = corpus->filenames[i];
+    }
+    argv[n-1] = NULL;
+    FILE *errors = tmpfile();
+    *stats = NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+        {
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+        if (errors != NULL)
+        {
+            dup2(fileno(errors), STDERR_FILENO);
+        }
+        execv(wosp, argv);
+        _exit(127);
+    }
+    free(argv);
+    int status = 0;
+    struct rusage usage;
+    if ((pid < 0) || (wait4(pid, &status, 0, &usage) < 0))
+    {
+        if (errors != NULL)
+        {
+            fclose(errors);
+        }
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = elapsed_seconds(start, end);
+    *peak_rss_kb = usage.ru_maxrss;
+    if (errors != NULL)
+    {
+        *stats = read_statistics(errors);
+        fclose(errors);
+    }
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS));
+}
+
+static void
+print_json_string(const char *string)
+{
+    putchar('"');
+    for (size_t i = 0; string[i] != '\0'; i++)
+    {
+        if ((string[i] == '"') || (string[i] == '\\'))
+        {
+            putchar('\\');
+        }
+        putchar(string[i]);
+    }
+    putchar('"');
+}
+
+static void
+print_result(const char *name, const char *phase, const char *query, CorpusOptions options, Corpus *corpus,
+             unsigned int n_threads, unsigned int repeat, double seconds, long peak_rss_kb, char *stats, bool ok)
+{
+    printf("{\"case\":");
+    print_json_string(name);
+    printf(",\"phase\":");
+    print_json_string(phase);
+    printf(",\"query\":");
+    print_json_string(query);
+    printf(",\"words\":%lu,\"files\":%lu,\"bytes\":%lu,\"vocabulary\":%lu,\"seed\":%lu",
+           options.n_words, corpus->n_files, corpus->n_bytes, options.vocabulary, options.seed);
+    printf(",\"threads\":%u,\"repeat\":%u,\"seconds\":%.6f", n_threads, repeat, seconds);
+    printf(",\"words_per_second\":%.1f,\"mb_per_second\":%.3f",
+           (seconds > 0.0) ? (double) options.n_words / seconds : 0.0,
+           (seconds > 0.0) ? (double) corpus->n_bytes / seconds / 1.0e6 : 0.0);
+    printf(",\"peak_rss_kb\":%ld,\"stats\":%s", peak_rss_kb, (stats != NULL) ? stats : "null");
+    printf(",\"ok\":%s}\n", (ok == true) ? "true" : "false");
+    fflush(stdout);
+}
+
+static char *
+format_query(const char *format, const char *first, const char *second)
+{
+    size_t len = strlen(format) + strlen(first) + strlen(second) + 1;
+    char *query = (char *) allocmem(len, sizeof(char));
+    snprintf(query, len, format, first, second);
+    return query;
+}
+
+/* The cases cover each phase that wosp goes through.  A term that never occurs
+ * isolates the cost of reading the input and building the trie, and a very
+ * common term stresses the output. */
+static size_t
+init_bench_cases(BenchCase **cases, Corpus *corpus)
+{
+    const char *common = corpus->vocabulary[0];
+    const char *frequent = corpus->vocabulary[(corpus->n_vocabulary > 10) ? 10 : 0];
+    const char *middle = corpus->vocabulary[corpus->n_vocabulary / 20];
+    const char *rare = corpus->vocabulary[corpus->n_vocabulary / 2];
+    BenchCase list[] = {
+        {"ingest",     "ingest", format_query("zzqxzzqx", "", "")},
+        {"lookup",     "lookup", format_query("%s%s", rare, "")},
+        {"truncation", "expand", format_query("%s$3%s", middle, "")},
+        {"wildcard",   "expand", format_query("?%s%s", middle + 1, "")},
+        {"fuzzy",      "expand", format_query("ICASE2 %s%s", middle, "")},
+        {"or",         "eval",   format_query("%s OR %s", middle, rare)},
+        {"and",        "eval",   format_query("%s AND %s", middle, rare)},
+        {"not",        "eval",   format_query("%s NOT %s", middle, rare)},
+        {"xor",        "eval",   format_query("%s XOR %s", middle, rare)},
+        {"adj",        "eval",   format_query("%s ADJ %s", frequent, middle)},
+        {"near",       "eval",   format_query("%s NEAR5 %s", frequent, middle)},
+        {"among",      "eval",   format_query("%s AMONG %s", frequent, middle)},
+        {"along",      "eval",   format_query("%s ALONG %s", frequent, middle)},
+        {"with",       "eval",   format_query("%s WITH %s", frequent, middle)},
+        {"same",       "eval",   format_query("%s SAME %s", frequent, middle)},
+        {"not_with",   "eval",   format_query("%s NOT WITH %s", frequent, middle)},
+        {"output",     "output", format_query("%s%s", common, "")},
+    };
+    size_t n = sizeof(list) / sizeof(list[0]);
+    *cases = (BenchCase *) allocmem(n, sizeof(BenchCase));
+    for (size_t i = 0; i < n; i++)
+    {
+        (*cases)[i] = list[i];
+    }
+    return n;
+}
+
+static size_t
+parse_list(const char *arg, unsigned long **list)
+{
+    size_t n = 0;
+    *list = NULL;
+    const char *current = arg;
+    while (*current != '\0')
+    {
+        char *endptr;
+        unsigned long value = strtoul(current, &endptr, 10);
+        if ((endptr == current) || (value == 0) || ((*endptr != ',') && (*endptr != '\0')))
+        {
+            fprintf(stderr, "%s: Invalid list '%s'\n", bench_name, arg);
+            exit(EXIT_FAILURE);
+        }
+        n++;
+        *list = (unsigned long *) reallocmem(*list, n * sizeof(unsigned long));
+        (*list)[n-1] = value;
+        current = (*endptr == ',') ? endptr + 1 : endptr;
+    }
+    return n;
+}
+
+static char *
+option_argument(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "%s: Option '%s' requires an argument\n", bench_name, argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    (*i)++;
+    return argv[*i];
+}
+
+static void
+print_usage(FILE *stream)
+{
+    fprintf(stream, "Usage: %s [OPTION]...\n", bench_name);
+    fprintf(stream, "   or: %s --generate DIR [OPTION]...\n", bench_name);
+    fprintf(stream, "\n");
+    fprintf(stream, "  --wosp PATH              wosp binary to benchmark (default ./wosp)\n");
+    fprintf(stream, "  --generate DIR           only write the corpus to DIR\n");
+    fprintf(stream, "  --dir DIR                where to write corpora (default /tmp)\n");
+    fprintf(stream, "  --sizes N,...            corpus sizes in words (default 10000,20000)\n");
+    fprintf(stream, "  --words N                corpus size when generating\n");
+    fprintf(stream, "  --files N                number of files per corpus (default 1)\n");
+    fprintf(stream, "  --threads N,...          thread counts for batch runs (default 1,2,4)\n");
+    fprintf(stream, "  --repeat N               runs per case (default 1)\n");
+    fprintf(stream, "  --vocabulary N           distinct words (default 5000)\n");
+    fprintf(stream, "  --zipf S                 Zipf exponent (default 1.0)\n");
+    fprintf(stream, "  --seed N                 random seed (default 1)\n");
+    fprintf(stream, "  --sentence-words MIN,MAX words per sentence (default 4,24)\n");
+    fprintf(stream, "  --paragraph-sentences N  maximum sentences per paragraph (default 6)\n");
+    fprintf(stream, "  --line-width N           maximum characters per line (default 72)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    CorpusOptions options = init_corpus_options();
+    const char *wosp = "./wosp";
+    const char *generate_directory = NULL;
+    const char *directory = "/tmp";
+    unsigned long default_sizes[] = {10000, 20000};
+    unsigned long default_threads[] = {1, 2, 4};
+    unsigned long *sizes = NULL, *threads = NULL;
+    size_t n_sizes = 0, n_threads = 0;
+    unsigned int repeat = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if      (strcmp(argv[i], "--wosp") == 0)       {wosp = option_argument(argc, argv, &i);}
+        else if (strcmp(argv[i], "--generate") == 0)   {generate_directory = option_argument(argc, argv, &i);}
+        else if (strcmp(argv[i], "--dir") == 0)        {directory = option_argument(argc, argv, &i);}
+        else if (strcmp(argv[i], "--sizes") == 0)      {free(sizes); n_sizes = parse_list(option_argument(argc, argv, &i), &sizes);}
+        else if (strcmp(argv[i], "--threads") == 0)    {free(threads); n_threads = parse_list(option_argument(argc, argv, &i), &threads);}
+        else if (strcmp(argv[i], "--words") == 0)      {options.n_words = strtoul(option_argument(argc, argv, &i), NULL, 10);}
+        else if (strcmp(argv[i], "--files") == 0)      {options.n_files = strtoul(option_argument(argc, argv, &i), NULL, 10);}
+        else if (strcmp(argv[i], "--repeat") == 0)     {repeat = (unsigned int) strtoul(option_argument(argc, argv, &i), NULL, 10);}
+        else if (strcmp(argv[i], "--vocabulary") == 0) {options.vocabulary = strtoul(option_argument(argc, argv, &i), NULL, 10);}
+        else if (strcmp(argv[i], "--zipf") == 0)       {options.zipf_exponent = strtod(option_argument(argc, argv, &i), NULL);}
+        else if (strcmp(argv[i], "--seed") == 0)       {options.seed = strtoul(option_argument(argc, argv, &i), NULL, 10);}
+        else if (strcmp(argv[i], "--paragraph-sentences") == 0)
+        {
+            options.max_paragraph_sentences = (unsigned int) strtoul(option_argument(argc, argv, &i), NULL, 10);
+        }
+        else if (strcmp(argv[i], "--line-width") == 0)
+        {
+            options.line_width = (unsigned int) strtoul(option_argument(argc, argv, &i), NULL, 10);
+        }
+        else if (strcmp(argv[i], "--sentence-words") == 0)
+        {
+            unsigned long *range = NULL;
+            if (parse_list(option_argument(argc, argv, &i), &range) != 2 || range[0] > range[1])
+            {
+                fprintf(stderr, "%s: Option '--sentence-words' requires MIN,MAX\n", bench_name);
+                exit(EXIT_FAILURE);
+            }
+            options.min_sentence_words = (unsigned int) range[0];
+            options.max_sentence_words = (unsigned int) range[1];
+            free(range);
+        }
+        else if ((strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "--help") == 0))
+        {
+            print_usage(stdout);
+            return EXIT_SUCCESS;
+        }
+        else
+        {
+            fprintf(stderr, "%s: Unknown option '%s'\n", bench_name, argv[i]);
+            print_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((options.n_words == 0) || (options.n_files == 0) || (options.vocabulary == 0) || (repeat == 0) ||
+        (options.min_sentence_words == 0) || (options.max_paragraph_sentences == 0))
+    {
+        fprintf(stderr, "%s: Corpus options and repeat must be positive\n", bench_name);
+        return EXIT_FAILURE;
+    }
+
+    if (generate_directory != NULL)
+    {
+        Corpus corpus;
+        generate_corpus(&corpus, options, generate_directory);
+        free_corpus(&corpus, false);
+        return EXIT_SUCCESS;
+    }
+
+    if (sizes == NULL)
+    {
+        n_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+        sizes = (unsigned long *) allocmem(n_sizes, sizeof(unsigned long));
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+    if (threads == NULL)
+    {
+        n_threads = sizeof(default_threads) / sizeof(default_threads[0]);
+        threads = (unsigned long *) allocmem(n_threads, sizeof(unsigned long));
+        memcpy(threads, default_threads, sizeof(default_threads));
+    }
+
+    for (size_t s = 0; s < n_sizes; s++)
+    {
+        options.n_words = sizes[s];
+        size_t len = strlen(directory) + 64;
+        char *corpus_directory = (char *) allocmem(len, sizeof(char));
+        snprintf(corpus_directory, len, "%s/wosp-bench-%ld-%lu", directory, (long) getpid(), sizes[s]);
+        Corpus corpus;
+        generate_corpus(&corpus, options, corpus_directory);
+
+        BenchCase *cases = NULL;
+        size_t n_cases = init_bench_cases(&cases, &corpus);
+        for (size_t c = 0; c < n_cases; c++)
+        {
+            for (unsigned int r = 0; r < repeat; r++)
+            {
+                double seconds = 0.0;
+                long peak_rss_kb = 0;
+                char *stats = NULL;
+                bool ok = run_wosp(wosp, &(cases[c].query), 1, &corpus, &seconds, &peak_rss_kb, &stats);
+                print_result(cases[c].name, cases[c].phase, cases[c].query, options, &corpus, 1, r + 1, seconds, peak_rss_kb, stats, ok);
+                free(stats);
+            }
+        }
+
+        /* Every case together as one batch, across thread counts. */
+        size_t batch_len = strlen(corpus_directory) + 16;
+        char *batch_filename = (char *) allocmem(batch_len, sizeof(char));
+        snprintf(batch_filename, batch_len, "%s/queries", corpus_directory);
+        FILE *f = fopen(batch_filename, "w");
+        if (f == NULL)
+        {
+            fprintf(stderr, "%s: Cannot write file '%s'\n", bench_name, batch_filename);
+            exit(EXIT_FAILURE);
+        }
+        for (size_t c = 0; c < n_cases; c++)
+        {
+            fprintf(f, "%s\n", cases[c].query);
+        }
+        fclose(f);
+        for (size_t t = 0; t < n_threads; t++)
+        {
+            char jobs[32];
+            snprintf(jobs, sizeof(jobs), "%lu", threads[t]);
+            char *args[] = {"--batch", batch_filename, "--jobs", jobs};
+            for (unsigned int r = 0; r < repeat; r++)
+            {
+                double seconds = 0.0;
+                long peak_rss_kb = 0;
+                char *stats = NULL;
+                bool ok = run_wosp(wosp, args, 4, &corpus, &seconds, &peak_rss_kb, &stats);
+                print_result("batch", "batch", batch_filename, options, &corpus, (unsigned int) threads[t], r + 1, seconds, peak_rss_kb, stats, ok);
+                free(stats);
+            }
+        }
+        unlink(batch_filename);
+        free(batch_filename);
+
+        for (size_t c = 0; c < n_cases; c++)
+        {
+            free(cases[c].query);
+        }
+        free(cases);
+        free_corpus(&corpus, true);
+        rmdir(corpus_directory);
+        free(corpus_directory);
+    }
+    free(sizes);
+    free(threads);
+
+    return EXIT_SUCCESS;
+}
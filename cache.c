@@ -0,0 +1,472 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "input.h"
+#include "interpreter.h"
+#include "misc.h"
+#include "search.h"
+#include "statistics.h"
+#include "words.h"
+
+static ResultCache *result_cache = NULL;
+
+static const char result_suffix[] = ".result";
+
+/* Results are written by other processes too, so a result that cannot be
+ * read or written is treated as missing rather than as an error. */
+void
+open_result_cache(char *directory, size_t capacity)
+{
+    if ((mkdir(directory, 0777) != 0) && (errno != EEXIST))
+    {
+        fprintf(stderr, "%s: Cache '%s' could not be created\n", program_name, directory);
+        exit(EXIT_FAILURE);
+    }
+    result_cache = (ResultCache *) allocmem(1, sizeof(ResultCache));
+    result_cache->directory = (char *) allocmem(strlen(directory) + 1, sizeof(char));
+    snprintf(result_cache->directory, strlen(directory) + 1, "%s", directory);
+    result_cache->capacity = capacity;
+    pthread_mutex_init(&(result_cache->mutex), NULL);
+    result_cache->segments = NULL;
+    result_cache->fingerprinted = false;
+    result_cache->usable = false;
+    result_cache->fingerprint = 0;
+}
+
+void
+close_result_cache(void)
+{
+    if (result_cache != NULL)
+    {
+        pthread_mutex_destroy(&(result_cache->mutex));
+        freemem(result_cache->directory);
+        freemem(result_cache);
+        result_cache = NULL;
+    }
+}
+
+static uint64_t
+hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/* The name, size, and modification time of every document.  A corpus read
+ * from stdin has no file to check, so its results are never cached. */
+static bool
+fingerprint_corpus(Segment *segments, size_t n_segments, uint64_t *fingerprint)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < n_segments; i++)
+    {
+        for (size_t j = 0; j < segments[i].n_documents; j++)
+        {
+            Document *document = segments[i].documents[j];
+            if (document == NULL)
+            {
+                continue;
+            }
+            struct stat status;
+            if (stat(document->filename, &status) != 0)
+            {
+                return false;
+            }
+            uint64_t fields[4] = {(uint64_t) id_document(document), (uint64_t) status.st_size,
+                                  (uint64_t) status.st_mtim.tv_sec, (uint64_t) status.st_mtim.tv_nsec};
+            hash = hash_bytes(hash, document->filename, strlen(document->filename) + 1);
+            hash = hash_bytes(hash, fields, sizeof(fields));
+        }
+    }
+    *fingerprint = hash;
+    return true;
+}
+
+/* Returns NULL when there is no cache or the corpus cannot be cached.  The
+ * corpus is only checked once, since it does not change while it is being
+ * searched.  A query with limits is not cached either, since a result read
+ * from the cache would skip the checks that could reject the query. */
+char *
+key_result_cache(SyntaxTree *tree, SearchOptions search_options, Segment *segments, size_t n_segments)
+{
+    QueryLimits limits = limits_search_options(search_options);
+    if ((result_cache == NULL) || (limits.max_terms > 0) || (limits.max_matches > 0) || (limits.max_bytes > 0))
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&(result_cache->mutex));
+    if ((result_cache->fingerprinted == false) || (result_cache->segments != segments))
+    {
+        result_cache->usable = fingerprint_corpus(segments, n_segments, &(result_cache->fingerprint));
+        result_cache->segments = segments;
+        result_cache->fingerprinted = true;
+    }
+    bool usable = result_cache->usable;
+    uint64_t fingerprint = result_cache->fingerprint;
+    pthread_mutex_unlock(&(result_cache->mutex));
+    if (usable == false)
+    {
+        return NULL;
+    }
+
+    char *canonical = canonical_syntax_tree(tree);
+    size_t len = strlen(canonical) + strlen(record_separator_name()) + strlen(page_marker_name()) + 128;
+    char *key = (char *) allocmem(len, sizeof(char));
+    snprintf(key, len, "%s\ncase=%d edit=%u proximity=%d fields=%d records=%s pages=%s\ncorpus=%016llx", canonical,
+             (int) case_mode_search_options(search_options), edit_dist_search_options(search_options),
+             (int) proximity_mode_search_options(search_options), (int) header_fields_enabled(),
+             record_separator_name(), page_marker_name(), (unsigned long long) fingerprint);
+    free(canonical);
+    return key;
+}
+
+static char *
+path_result_cache(const char *name)
+{
+    size_t len = strlen(result_cache->directory) + strlen(name) + 2;
+    char *path = (char *) allocmem(len, sizeof(char));
+    snprintf(path, len, "%s/%s", result_cache->directory, name);
+    return path;
+}
+
+static char *
+result_path(char *key)
+{
+    char name[32];
+    uint64_t hash = hash_bytes(UINT64_C(14695981039346656037), key, strlen(key));
+    snprintf(name, sizeof(name), "%016llx%s", (unsigned long long) hash, result_suffix);
+    return path_result_cache(name);
+}
+
+static bool
+write_varint(FILE *file, uint64_t n)
+{
+    do
+    {
+        unsigned char byte = (unsigned char) (n & 0x7f);
+        n >>= 7;
+        if (n != 0)
+        {
+            byte |= 0x80;
+        }
+        if (putc(byte, file) == EOF)
+        {
+            return false;
+        }
+    }
+    while (n != 0);
+    return true;
+}
+
+static bool
+read_varint(FILE *file, uint64_t *n)
+{
+    *n = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        int c = getc(file);
+        if (c == EOF)
+        {
+            return false;
+        }
+        *n |= ((uint64_t) (c & 0x7f)) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A result is the magic, the length of the key and the key itself, the number
+ * of matches, and then each match.  The matches are canonical, so documents
+ * and start positions only increase, and each is stored as the difference
+ * from the one before: the document, the number of words, the start, and the
+ * gap to each following word. */
+static bool
+write_result(FILE *file, char *key, Match *matches)
+{
+    uint64_t len = (uint64_t) strlen(key);
+    if ((fwrite(result_magic, sizeof(result_magic), 1, file) != 1) || (fwrite(&len, sizeof(len), 1, file) != 1) ||
+        (fwrite(key, 1, (size_t) len, file) != (size_t) len) ||
+        (write_varint(file, (uint64_t) length_of_match_list(matches)) == false))
+    {
+        return false;
+    }
+    unsigned long last_document = 0;
+    unsigned long last_start = 0;
+    MatchIterator iterator = init_match_iterator(matches);
+    while (iterator_has_next_match(iterator) == true)
+    {
+        Match *match = iterator_next_match(&iterator);
+        unsigned long document = document_id_word(document_match(match));
+        size_t n = number_of_words_in_match(match);
+        unsigned long start = position_word(word_match(match, 0));
+        if (document != last_document)
+        {
+            last_start = 0;
+        }
+        if ((write_varint(file, document - last_document) == false) || (write_varint(file, (uint64_t) n) == false) ||
+            (write_varint(file, start - last_start) == false))
+        {
+            return false;
+        }
+        for (size_t i = 1; i < n; i++)
+        {
+            unsigned long gap = position_word(word_match(match, i)) - position_word(word_match(match, i-1));
+            if (write_varint(file, gap) == false)
+            {
+                return false;
+            }
+        }
+        last_document = document;
+        last_start = start;
+    }
+    return (fflush(file) == 0);
+}
+
+/* Returns false, leaving what was read in matches, when the file is not the
+ * result for the key or is damaged. */
+static bool
+read_result(FILE *file, char *key, Match **matches)
+{
+    char magic[sizeof(result_magic)];
+    uint64_t len = 0;
+    if ((fread(magic, sizeof(magic), 1, file) != 1) || (memcmp(magic, result_magic, sizeof(magic)) != 0) ||
+        (fread(&len, sizeof(len), 1, file) != 1) || (len != (uint64_t) strlen(key)))
+    {
+        return false;
+    }
+    char *stored = (char *) allocmem((size_t) len + 1, sizeof(char));
+    bool same = ((fread(stored, 1, (size_t) len, file) == (size_t) len) && (memcmp(stored, key, (size_t) len) == 0));
+    freemem(stored);
+    uint64_t n_matches = 0;
+    if ((same == false) || (read_varint(file, &n_matches) == false))
+    {
+        return false;
+    }
+
+    /* Each match takes at least three bytes, so a count that the rest of the
+     * file cannot hold means that the file is damaged. */
+    struct stat status;
+    off_t offset = ftello(file);
+    if ((fstat(fileno(file), &status) != 0) || (offset < 0) ||
+        (n_matches > (uint64_t) (status.st_size - offset) / 3))
+    {
+        return false;
+    }
+
+    Match *last = NULL;
+    uint64_t document_id = 0;
+    uint64_t start = 0;
+    for (uint64_t k = 0; k < n_matches; k++)
+    {
+        uint64_t document_delta = 0;
+        uint64_t n = 0;
+        uint64_t position = 0;
+        if ((read_varint(file, &document_delta) == false) || (read_varint(file, &n) == false) || (n == 0) ||
+            (read_varint(file, &position) == false))
+        {
+            return false;
+        }
+        document_id += document_delta;
+        position += (document_delta == 0) ? start : 0;
+        start = position;
+        Document *document = find_document((unsigned long) document_id);
+        if ((document == NULL) || (n > number_of_words_document(document)))
+        {
+            return false;
+        }
+        Match *match = NULL;
+        insert_match(&match, (size_t) n);
+        if (last == NULL)
+        {
+            *matches = match;
+        }
+        else
+        {
+            last->next = match;
+        }
+        last = match;
+        for (uint64_t i = 0; i < n; i++)
+        {
+            uint64_t gap = 0;
+            if ((i > 0) && (read_varint(file, &gap) == false))
+            {
+                return false;
+            }
+            position += gap;
+            if ((position < 1) || (position > number_of_words_document(document)))
+            {
+                return false;
+            }
+            set_match(match, (size_t) i, word_document(document, (unsigned long) position));
+        }
+    }
+    return true;
+}
+
+/* Sets found to whether the result was in the cache. */
+Match *
+find_result_cache(char *key, bool *found)
+{
+    *found = false;
+    char *path = result_path(key);
+    FILE *file = fopen(path, "rb");
+    freemem(path);
+    if (file == NULL)
+    {
+        count_statistic(CT_RESULT_CACHE_MISSES, 1);
+        return NULL;
+    }
+    Match *matches = NULL;
+    if (read_result(file, key, &matches) == true)
+    {
+        *found = true;
+        futimens(fileno(file), NULL);
+    }
+    else
+    {
+        free_matches(matches);
+        matches = NULL;
+    }
+    fclose(file);
+    count_statistic((*found == true) ? CT_RESULT_CACHE_HITS : CT_RESULT_CACHE_MISSES, 1);
+    return matches;
+}
+
+typedef struct ResultFile
+{
+    char *name;
+    off_t size;
+    struct timespec mtime;
+} ResultFile;
+
+static int
+compare_result_files(const void *a, const void *b)
+{
+    const ResultFile *first = (const ResultFile *) a;
+    const ResultFile *second = (const ResultFile *) b;
+    if (first->mtime.tv_sec != second->mtime.tv_sec)
+    {
+        return (first->mtime.tv_sec < second->mtime.tv_sec) ? -1 : +1;
+    }
+    else if (first->mtime.tv_nsec != second->mtime.tv_nsec)
+    {
+        return (first->mtime.tv_nsec < second->mtime.tv_nsec) ? -1 : +1;
+    }
+    return strcmp(first->name, second->name);
+}
+
+/* Removes the results read or written least recently until the rest fit.  A
+ * file that another process removed first is simply skipped. */
+static void
+evict_result_cache(void)
+{
+    DIR *directory = opendir(result_cache->directory);
+    if (directory == NULL)
+    {
+        return;
+    }
+    ResultFile *files = NULL;
+    size_t n_files = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        if ((len <= strlen(result_suffix)) ||
+            (strcmp(entry->d_name + len - strlen(result_suffix), result_suffix) != 0))
+        {
+            continue;
+        }
+        char *path = path_result_cache(entry->d_name);
+        struct stat status;
+        if (stat(path, &status) == 0)
+        {
+            if (n_files == capacity)
+            {
+                capacity = (capacity == 0) ? 64 : 2 * capacity;
+                files = (ResultFile *) reallocmem(files, capacity * sizeof(ResultFile));
+            }
+            files[n_files].name = path;
+            files[n_files].size = status.st_size;
+            files[n_files].mtime = status.st_mtim;
+            n_files++;
+            total += (uint64_t) status.st_size;
+        }
+        else
+        {
+            freemem(path);
+        }
+    }
+    closedir(directory);
+
+    if (total > (uint64_t) result_cache->capacity)
+    {
+        qsort(files, n_files, sizeof(ResultFile), compare_result_files);
+        for (size_t i = 0; (i < n_files) && (total > (uint64_t) result_cache->capacity); i++)
+        {
+            unlink(files[i].name);
+            total -= (uint64_t) files[i].size;
+        }
+    }
+    for (size_t i = 0; i < n_files; i++)
+    {
+        freemem(files[i].name);
+    }
+    freemem(files);
+}
+
+void
+store_result_cache(char *key, Match *matches)
+{
+    char *temporary = path_result_cache("tmp-XXXXXX");
+    int fd = mkstemp(temporary);
+    FILE *file = (fd < 0) ? NULL : fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(temporary);
+        }
+        freemem(temporary);
+        return;
+    }
+    bool written = write_result(file, key, matches);
+    if ((fclose(file) != 0) || (written == false))
+    {
+        unlink(temporary);
+    }
+    else
+    {
+        char *path = result_path(key);
+        if (rename(temporary, path) != 0)
+        {
+            unlink(temporary);
+        }
+        freemem(path);
+        pthread_mutex_lock(&(result_cache->mutex));
+        evict_result_cache();
+        pthread_mutex_unlock(&(result_cache->mutex));
+    }
+    freemem(temporary);
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "interpreter.h"
+#include "search.h"
+
+/* A result cache is a directory that keeps the matches of earlier queries so
+ * that a query run again on the same files is not evaluated again.  Each
+ * result is one file named by the hash of its key.  The key is the canonical
+ * form of the query, the search options, and a fingerprint of the files.  A
+ * result is written to a temporary file and renamed into place, so readers
+ * never see part of one.  Reading a result touches its file, and the files
+ * used least recently are removed when the directory grows past its size.
+ * The files are specific to the machine that wrote them. */
+static const char result_magic[8] = {'w', 'o', 's', 'p', 'r', 'e', 's', '1'};
+static const size_t default_result_cache_size = 64 << 20;
+
+typedef struct ResultCache
+{
+    char *directory;
+    size_t capacity; /* Bytes */
+    pthread_mutex_t mutex;
+    Segment *segments; /* The corpus that the fingerprint is for */
+    bool fingerprinted;
+    bool usable; /* Every document is a file that can be checked */
+    uint64_t fingerprint;
+} ResultCache;
+
+void open_result_cache(char *, size_t);
+void close_result_cache(void);
+char *key_result_cache(SyntaxTree *, SearchOptions, Segment *, size_t);
+Match *find_result_cache(char *, bool *);
+void store_result_cache(char *, Match *);
+
+#endif /* CACHE_H */
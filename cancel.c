@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cancel.h"
+#include "misc.h"
+#include "statistics.h"
+
+/* The query running on this thread.  A deadline of zero means none. */
+static THREAD_LOCAL bool watching = false;
+static THREAD_LOCAL bool stopped = false;
+static THREAD_LOCAL CancelToken *current_token = NULL;
+static THREAD_LOCAL double current_deadline = 0.0;
+static THREAD_LOCAL QueryLimits current_limits = {0, 0, 0};
+static THREAD_LOCAL size_t start_bytes = 0;
+static THREAD_LOCAL unsigned long n_terms = 0; /* Of the current expansion */
+static THREAD_LOCAL QueryLimit exceeded = QL_NONE;
+static THREAD_LOCAL char *limit_subtree = NULL;
+
+QueryLimits
+init_query_limits(void)
+{
+    QueryLimits limits;
+    limits.max_terms = 0;
+    limits.max_matches = 0;
+    limits.max_bytes = 0;
+    return limits;
+}
+
+void
+init_cancel_token(CancelToken *token)
+{
+    write_flag(&(token->cancelled), false);
+}
+
+/* Can be called from any thread. */
+void
+cancel_token(CancelToken *token)
+{
+    write_flag(&(token->cancelled), true);
+}
+
+/* Starts watching the query about to run on this thread, which stops when
+ * the token, if any, is cancelled, after timeout seconds, if positive, or
+ * when it goes over one of the limits. */
+void
+begin_cancellation(CancelToken *token, double timeout, QueryLimits limits)
+{
+    watching = ((token != NULL) || (timeout > 0.0) || (limits.max_terms > 0) || (limits.max_matches > 0) ||
+                (limits.max_bytes > 0));
+    stopped = false;
+    current_token = token;
+    current_deadline = (timeout > 0.0) ? wall_time() + timeout : 0.0;
+    current_limits = limits;
+    start_bytes = thread_bytes_allocated();
+    n_terms = 0;
+    exceeded = QL_NONE;
+    free(limit_subtree);
+    limit_subtree = NULL;
+}
+
+/* Whether the query running on this thread should stop.  Once it has been
+ * stopped it stays so until the query ends. */
+bool
+query_cancelled(void)
+{
+    if ((watching == false) || (stopped == true))
+    {
+        return stopped;
+    }
+    if ((current_limits.max_bytes > 0) && (thread_bytes_allocated() - start_bytes > current_limits.max_bytes))
+    {
+        exceed_query_limit(QL_BYTES);
+    }
+    else if ((current_deadline > 0.0) && (wall_time() >= current_deadline))
+    {
+        stopped = true;
+    }
+    else if (current_token != NULL)
+    {
+        stopped = read_flag(&(current_token->cancelled));
+    }
+    return stopped;
+}
+
+/* Whether the query has been found to be stopped so far, without checking
+ * again. */
+bool
+query_stopped(void)
+{
+    return stopped;
+}
+
+/* Stops watching the query on this thread and returns whether it was
+ * stopped. */
+bool
+end_cancellation(void)
+{
+    bool was_stopped = stopped;
+    if (was_stopped == true)
+    {
+        count_statistic(CT_QUERIES_STOPPED, 1);
+    }
+    watching = false;
+    stopped = false;
+    current_token = NULL;
+    current_deadline = 0.0;
+    current_limits = init_query_limits();
+    exceeded = QL_NONE;
+    free(limit_subtree);
+    limit_subtree = NULL;
+    return was_stopped;
+}
+
+/* Each expansion of a term counts its dictionary terms afresh. */
+void
+begin_expansion(void)
+{
+    n_terms = 0;
+}
+
+void
+count_expanded_terms(unsigned long n)
+{
+    n_terms += n;
+    if ((current_limits.max_terms > 0) && (n_terms > current_limits.max_terms))
+    {
+        exceed_query_limit(QL_TERMS);
+    }
+}
+
+/* The most matches that one operator may produce, or zero for no limit. */
+unsigned long
+match_limit(void)
+{
+    return current_limits.max_matches;
+}
+
+/* Stops the query for going over a limit.  Only the first limit reached is
+ * reported. */
+void
+exceed_query_limit(QueryLimit limit)
+{
+    if (watching == true)
+    {
+        if (exceeded == QL_NONE)
+        {
+            exceeded = limit;
+        }
+        stopped = true;
+    }
+}
+
+/* Starts counting the bytes allocated by the query again, as each window of a
+ * stream does. */
+void
+restart_query_allocation(void)
+{
+    start_bytes = thread_bytes_allocated();
+}
+
+QueryLimit
+exceeded_query_limit(void)
+{
+    return exceeded;
+}
+
+/* The subtree reported is the innermost one that was being evaluated when
+ * the limit was reached.  It is set by evaluation as it returns. */
+bool
+needs_limit_subtree(void)
+{
+    return ((exceeded != QL_NONE) && (limit_subtree == NULL));
+}
+
+/* Takes a string to be freed with free. */
+void
+set_limit_subtree(char *subtree)
+{
+    free(limit_subtree);
+    limit_subtree = subtree;
+}
+
+void
+report_query_limit(const char *query)
+{
+    const char *where = (limit_subtree == NULL) ? query : limit_subtree;
+    if (exceeded == QL_TERMS)
+    {
+        fprintf(stderr, "%s: Query '%s' stopped at '%s', which expands to more than %lu dictionary terms\n",
+                program_name, query, where, current_limits.max_terms);
+    }
+    else if (exceeded == QL_MATCHES)
+    {
+        fprintf(stderr, "%s: Query '%s' stopped at '%s', which produces more than %lu matches\n", program_name,
+                query, where, current_limits.max_matches);
+    }
+    else if (exceeded == QL_BYTES)
+    {
+        fprintf(stderr, "%s: Query '%s' stopped at '%s' after allocating more than %zu bytes\n", program_name,
+                query, where, current_limits.max_bytes);
+    }
+}
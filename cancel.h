@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A query can be stopped before it finishes, either by its deadline passing
+ * or by another thread cancelling its token.  Nothing is interrupted: the
+ * evaluation and output of the query running on a thread ask whether it has
+ * been stopped between units of work, and wind down when it has, so that the
+ * matches that were complete are still printed.  The flag is atomic, so
+ * checking it costs no lock. */
+typedef struct CancelToken
+{
+    bool cancelled;
+} CancelToken;
+
+/* Limits on what one query may use, so that one query cannot starve the
+ * others that share the process.  Zero means no limit.  A query that goes
+ * over a limit is stopped in the same way, but prints nothing, and the part
+ * of the query that was being evaluated is reported. */
+typedef enum QueryLimit
+{
+    QL_NONE,
+    QL_TERMS, /* Dictionary terms reached by one expansion */
+    QL_MATCHES, /* Matches produced by one operator */
+    QL_BYTES /* Bytes allocated while evaluating the query */
+} QueryLimit;
+
+typedef struct QueryLimits
+{
+    unsigned long max_terms;
+    unsigned long max_matches;
+    size_t max_bytes;
+} QueryLimits;
+
+QueryLimits init_query_limits(void);
+
+void init_cancel_token(CancelToken *);
+void cancel_token(CancelToken *);
+
+void begin_cancellation(CancelToken *, double, QueryLimits);
+bool query_cancelled(void);
+bool query_stopped(void);
+bool end_cancellation(void);
+
+void begin_expansion(void);
+void count_expanded_terms(unsigned long);
+unsigned long match_limit(void);
+void exceed_query_limit(QueryLimit);
+void restart_query_allocation(void);
+QueryLimit exceeded_query_limit(void);
+bool needs_limit_subtree(void);
+void set_limit_subtree(char *);
+void report_query_limit(const char *);
+
+#endif /* CANCEL_H */
@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cancel.h"
+#include "daat.h"
+#include "interpreter.h"
+#include "misc.h"
+#include "output.h"
+#include "rank.h"
+#include "search.h"
+#include "statistics.h"
+#include "words.h"
+
+static size_t
+count_leaves(SyntaxTree *tree)
+{
+    if (tree == NULL)
+    {
+        return 0;
+    }
+    if (type_syntax_tree(tree) == TK_WILDCARD)
+    {
+        return 1;
+    }
+    return count_leaves(left_syntax_tree(tree)) + count_leaves(right_syntax_tree(tree));
+}
+
+/* Searches for each term in the order that evaluation reaches them, with the
+ * case mode, edit distance, and field that applies to each. */
+static void
+expand_leaves(SyntaxTree *tree, TrieNode *trie, TermCache *cache, CaseMode case_mode, unsigned int edit_dist,
+              unsigned long field, Match **cursors, size_t *leaf)
+{
+    if (tree == NULL)
+    {
+        return;
+    }
+    TokenType type = type_syntax_tree(tree);
+    if (type == TK_WILDCARD)
+    {
+        cursors[(*leaf)++] = cached_wildcard_search(cache, trie, string_syntax_tree(tree), case_mode, edit_dist,
+                                                    field);
+    }
+    else if (search_operator_token_type(type) == true)
+    {
+        expand_leaves(left_syntax_tree(tree), trie, cache, case_mode_search_operator(type, case_mode),
+                      edit_dist_search_operator(tree, edit_dist), field_search_operator(tree, field), cursors, leaf);
+    }
+    else
+    {
+        expand_leaves( left_syntax_tree(tree), trie, cache, case_mode, edit_dist, field, cursors, leaf);
+        expand_leaves(right_syntax_tree(tree), trie, cache, case_mode, edit_dist, field, cursors, leaf);
+    }
+}
+
+/* Whether the terms present in a document could satisfy the tree.  Every
+ * leaf is visited so that the count stays in step with the slices. */
+static bool
+possible_syntax_tree(SyntaxTree *tree, Match **slices, size_t *leaf)
+{
+    if (tree == NULL)
+    {
+        return false;
+    }
+    TokenType type = type_syntax_tree(tree);
+    if (type == TK_WILDCARD)
+    {
+        return (slices[(*leaf)++] != NULL);
+    }
+    bool left = possible_syntax_tree(left_syntax_tree(tree), slices, leaf);
+    bool right = possible_syntax_tree(right_syntax_tree(tree), slices, leaf);
+    if (search_operator_token_type(type) == true)
+    {
+        return left;
+    }
+    else if ((type == TK_OR_OP) || (type == TK_XOR_OP))
+    {
+        return ((left == true) || (right == true));
+    }
+    else if ((type == TK_NOT_OP)       || (type == TK_NOT_ADJ_OP)   || (type == TK_NOT_NEAR_OP) ||
+             (type == TK_NOT_AMONG_OP) || (type == TK_NOT_ALONG_OP) || (type == TK_NOT_WITH_OP) ||
+             (type == TK_NOT_SAME_OP)  || (type == TK_NOT_PAGE_OP))
+    {
+        return left;
+    }
+    return ((left == true) && (right == true));
+}
+
+static unsigned long
+add_bounds(unsigned long a, unsigned long b)
+{
+    return (a > ULONG_MAX - b) ? ULONG_MAX : a + b;
+}
+
+static unsigned long
+multiply_bounds(unsigned long a, unsigned long b)
+{
+    return ((a != 0) && (b > ULONG_MAX / a)) ? ULONG_MAX : a * b;
+}
+
+/* The most matches that the tree could return for a document, from the
+ * matches of its terms there.  Boolean and negated operators return some of
+ * the matches of their operands, and proximity operators return pairs of
+ * them. */
+static unsigned long
+bound_syntax_tree(SyntaxTree *tree, Match **slices, size_t *leaf)
+{
+    if (tree == NULL)
+    {
+        return 0;
+    }
+    TokenType type = type_syntax_tree(tree);
+    if (type == TK_WILDCARD)
+    {
+        return length_of_match_list(slices[(*leaf)++]);
+    }
+    unsigned long left = bound_syntax_tree(left_syntax_tree(tree), slices, leaf);
+    unsigned long right = bound_syntax_tree(right_syntax_tree(tree), slices, leaf);
+    if (search_operator_token_type(type) == true)
+    {
+        return left;
+    }
+    else if ((boolean_operator_token_type(type) == true) || (negation_operator_token_type(type) == true))
+    {
+        return add_bounds(left, right);
+    }
+    return multiply_bounds(left, right);
+}
+
+static unsigned long
+document_id_match(Match *match)
+{
+    return document_id_word(document_match(match));
+}
+
+/* Cuts the matches of document id from the front of a cursor. */
+static Match *
+take_document_matches(Match **cursor, unsigned long id)
+{
+    Match *first = *cursor;
+    if ((first == NULL) || (document_id_match(first) != id))
+    {
+        return NULL;
+    }
+    Match *last = first;
+    while ((next_match(last) != NULL) && (document_id_match(next_match(last)) == id))
+    {
+        last = next_match(last);
+    }
+    *cursor = next_match(last);
+    last->next = NULL;
+    return first;
+}
+
+static unsigned int
+print_document_matches(FILE *stream, Match *matches, OutputOptions options)
+{
+    if (type_output_options(options) == OT_DOCUMENTS)
+    {
+        return print_documents_in_matches(stream, matches, options);
+    }
+    else if (type_output_options(options) == OT_MATCHES)
+    {
+        return print_matches(stream, matches, options);
+    }
+    else if (type_output_options(options) == OT_EXCERPTS)
+    {
+        return print_excerpts(stream, matches, options);
+    }
+    return 0;
+}
+
+/* Prints the results of each document to stream as it is evaluated and
+ * returns NULL, or returns all of the results in canonical order when stream
+ * is NULL. */
+Match *
+eval_by_document(FILE *stream, SyntaxTree *tree, Segment *segments, size_t n_segments, TermCache *cache,
+                 SearchOptions search_options, OutputOptions options, bool *error_flag)
+{
+    CaseMode case_mode = case_mode_search_options(search_options);
+    unsigned int edit_dist = edit_dist_search_options(search_options);
+    ProximityMode proximity_mode = proximity_mode_search_options(search_options);
+
+    double phase_start = start_phase();
+    size_t n_leaves = count_leaves(tree);
+    size_t n_cursors = n_segments * n_leaves;
+    Match **cursors = (Match **) allocmem((n_cursors == 0) ? 1 : n_cursors, sizeof(Match *));
+    for (size_t i = 0; i < n_segments; i++)
+    {
+        size_t leaf = 0;
+        expand_leaves(tree, segments[i].trie, cache, case_mode, edit_dist, end_field, &(cursors[i * n_leaves]),
+                      &leaf);
+    }
+    DocumentLeaves leaves;
+    leaves.slices = (Match **) allocmem((n_leaves == 0) ? 1 : n_leaves, sizeof(Match *));
+    leaves.n_slices = n_leaves;
+
+    /* Evaluating the tree without any matches reports its errors even when
+     * no document contains a term. */
+    for (size_t j = 0; j < n_leaves; j++)
+    {
+        leaves.slices[j] = NULL;
+    }
+    leaves.next = 0;
+    free_matches(eval_syntax_tree(tree, NULL, NULL, case_mode, edit_dist, end_field, proximity_mode, &leaves,
+                                  error_flag));
+    end_phase(PH_EVAL, phase_start);
+
+    /* Results that are ranked are only kept for documents that could be
+     * among the best, so the others are not evaluated at all. */
+    bool ranked = ((stream == NULL) && (top_output_options(options) > 0));
+    TopScores top;
+    init_top_scores(&top, top_output_options(options));
+
+    Match *results = NULL;
+    Match *last_result = NULL;
+    OutputOptions remaining = options;
+    while ((*error_flag == false) && ((stream == NULL) || (remaining.maximum > 0)) && (query_cancelled() == false))
+    {
+        phase_start = start_phase();
+        bool found = false;
+        unsigned long id = 0;
+        size_t segment = 0;
+        for (size_t i = 0; i < n_cursors; i++)
+        {
+            if ((cursors[i] != NULL) && ((found == false) || (document_id_match(cursors[i]) < id)))
+            {
+                found = true;
+                id = document_id_match(cursors[i]);
+                segment = i / n_leaves;
+            }
+        }
+        if (found == false)
+        {
+            end_phase(PH_EVAL, phase_start);
+            break;
+        }
+        for (size_t j = 0; j < n_leaves; j++)
+        {
+            leaves.slices[j] = take_document_matches(&(cursors[segment * n_leaves + j]), id);
+        }
+
+        Match *matches = NULL;
+        size_t leaf = 0;
+        size_t bound_leaf = 0;
+        if ((possible_syntax_tree(tree, leaves.slices, &leaf) == true) &&
+            ((ranked == false) ||
+             (could_enter_top_scores(&top, bound_syntax_tree(tree, leaves.slices, &bound_leaf)) == true)))
+        {
+            leaves.next = 0;
+            matches = eval_syntax_tree(tree, segments[segment].trie, cache, case_mode, edit_dist, end_field,
+                                       proximity_mode, &leaves, error_flag);
+            if (ranked == true)
+            {
+                add_top_score(&top, score_matches(matches));
+            }
+        }
+        else
+        {
+            count_statistic(CT_DOCUMENTS_SKIPPED, 1);
+        }
+        for (size_t j = 0; j < n_leaves; j++)
+        {
+            free_matches(leaves.slices[j]);
+        }
+        end_phase(PH_EVAL, phase_start);
+
+        if ((matches == NULL) || (*error_flag == true))
+        {
+            free_matches(matches);
+        }
+        else if (stream == NULL)
+        {
+            if (last_result == NULL)
+            {
+                results = matches;
+            }
+            else
+            {
+                last_result->next = matches;
+            }
+            last_result = matches;
+            while (next_match(last_result) != NULL)
+            {
+                last_result = next_match(last_result);
+            }
+        }
+        else
+        {
+            phase_start = start_phase();
+            unsigned int n_output = print_document_matches(stream, matches, remaining);
+            remaining.maximum -= (n_output < remaining.maximum) ? n_output : remaining.maximum;
+            free_matches(matches);
+            end_phase(PH_PRINT, phase_start);
+        }
+    }
+
+    for (size_t i = 0; i < n_cursors; i++)
+    {
+        free_matches(cursors[i]);
+    }
+    freemem(cursors);
+    freemem(leaves.slices);
+    free_top_scores(&top);
+    return results;
+}
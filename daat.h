@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef DAAT_H
+#define DAAT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "interpreter.h"
+#include "output.h"
+#include "search.h"
+
+/* Document-at-a-time evaluation.  The matches of each term form a cursor in
+ * document order, and the cursors advance together one document at a time.
+ * The whole query is evaluated on the matches of that document alone and its
+ * results are printed before the next document, so the intermediate results
+ * never span more than one document.  A document is skipped without
+ * evaluating it when the terms present in it cannot satisfy the query. */
+Match *eval_by_document(FILE *, SyntaxTree *, Segment *, size_t, TermCache *, SearchOptions, OutputOptions, bool *);
+
+#endif /* DAAT_H */
@@ -0,0 +1,1165 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "input.h"
+#include "misc.h"
+#include "search.h"
+#include "statistics.h"
+#include "words.h"
+
+/* A segment file holds a block of words for each of its documents and then a
+ * table of the number, offset, and length of each block.  The last eight bytes
+ * give the offset of the table.  The same structure is used while a segment is
+ * written. */
+typedef struct SegmentFile
+{
+    uint64_t number;
+    FILE *file;
+    size_t n_documents;
+    uint64_t *ids;
+    uint64_t *offsets;
+    uint64_t *lengths;
+    uint64_t bytes;
+} SegmentFile;
+
+static void
+index_error(Index *index, const char *message)
+{
+    fprintf(stderr, "%s: Index '%s' %s\n", program_name, index->directory, message);
+    exit(EXIT_FAILURE);
+}
+
+static char *
+path_index(Index *index, const char *name)
+{
+    size_t len = strlen(index->directory) + strlen(name) + 2;
+    char *path = (char *) allocmem(len, sizeof(char));
+    snprintf(path, len, "%s/%s", index->directory, name);
+    return path;
+}
+
+static char *
+segment_path_index(Index *index, uint64_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%06llu", (unsigned long long) number);
+    return path_index(index, name);
+}
+
+static void
+write_index_data(Index *index, FILE *file, const void *data, size_t size)
+{
+    if ((size > 0) && (fwrite(data, size, 1, file) != 1))
+    {
+        index_error(index, "could not be written");
+    }
+}
+
+static void
+write_index_number(Index *index, FILE *file, uint64_t n)
+{
+    write_index_data(index, file, &n, sizeof(n));
+}
+
+/* Numbers in blocks are written seven bits at a time, low bits first, since
+ * most lines, columns, and pages are small. */
+static void
+write_index_varint(Index *index, FILE *file, uint64_t n)
+{
+    unsigned char data[10];
+    size_t len = 0;
+    do
+    {
+        data[len] = (unsigned char) (n & 0x7f);
+        n >>= 7;
+        if (n != 0)
+        {
+            data[len] |= 0x80;
+        }
+        len++;
+    }
+    while (n != 0);
+    write_index_data(index, file, data, len);
+}
+
+static void
+read_index_data(Index *index, FILE *file, void *data, size_t size)
+{
+    if ((size > 0) && (fread(data, size, 1, file) != 1))
+    {
+        index_error(index, "is corrupt");
+    }
+}
+
+static uint64_t
+read_index_number(Index *index, FILE *file)
+{
+    uint64_t n = 0;
+    read_index_data(index, file, &n, sizeof(n));
+    return n;
+}
+
+static uint64_t
+read_index_varint(Index *index, FILE *file)
+{
+    uint64_t n = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(file);
+        if (c == EOF)
+        {
+            break;
+        }
+        n |= ((uint64_t) (c & 0x7f)) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return n;
+        }
+    }
+    index_error(index, "is corrupt");
+    return 0;
+}
+
+static void
+seek_index(Index *index, FILE *file, uint64_t offset)
+{
+    if (fseeko(file, (off_t) offset, SEEK_SET) != 0)
+    {
+        index_error(index, "is corrupt");
+    }
+}
+
+static void
+sync_index(Index *index, FILE *file)
+{
+    if ((fflush(file) != 0) || (fsync(fileno(file)) != 0))
+    {
+        index_error(index, "could not be written");
+    }
+}
+
+/* Writers hold the lock only while they read or replace the manifest, so
+ * neither an update nor a merge waits long for the other. */
+static void
+lock_index(Index *index)
+{
+    struct flock lock;
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    while (fcntl(index->lock_fd, F_SETLKW, &lock) != 0)
+    {
+        if (errno != EINTR)
+        {
+            index_error(index, "could not be locked");
+        }
+    }
+    index->locked = true;
+}
+
+static void
+unlock_index(Index *index)
+{
+    struct flock lock;
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    fcntl(index->lock_fd, F_SETLK, &lock);
+    index->locked = false;
+}
+
+static size_t
+hash_filename(const char *filename)
+{
+    /* FNV-1a */
+    size_t hash = 2166136261u;
+    for (size_t i = 0; filename[i] != '\0'; i++)
+    {
+        hash = (hash ^ (unsigned char) filename[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void
+init_slots(Index *index, size_t n_slots)
+{
+    freemem(index->slots);
+    index->n_slots = n_slots;
+    index->slots = (size_t *) allocmem(n_slots, sizeof(size_t));
+    for (size_t i = 0; i < n_slots; i++)
+    {
+        index->slots[i] = 0;
+    }
+}
+
+static void
+insert_slot(Index *index, size_t entry)
+{
+    size_t i = hash_filename(index->entries[entry].filename) % index->n_slots;
+    while (index->slots[i] != 0)
+    {
+        i = (i + 1) % index->n_slots;
+    }
+    index->slots[i] = entry + 1;
+}
+
+/* Only live entries are found, so a file that comes back after it was deleted
+ * gets a new document number. */
+static IndexEntry *
+find_entry(Index *index, const char *filename)
+{
+    size_t i = hash_filename(filename) % index->n_slots;
+    while (index->slots[i] != 0)
+    {
+        IndexEntry *entry = &(index->entries[index->slots[i]-1]);
+        if ((entry->deleted == false) && (strcmp(entry->filename, filename) == 0))
+        {
+            return entry;
+        }
+        i = (i + 1) % index->n_slots;
+    }
+    return NULL;
+}
+
+static IndexEntry *
+add_entry(Index *index, const char *filename)
+{
+    if (2 * (index->n_entries + 1) > index->n_slots)
+    {
+        init_slots(index, 2 * index->n_slots);
+        for (size_t i = 0; i < index->n_entries; i++)
+        {
+            insert_slot(index, i);
+        }
+    }
+    index->entries = (IndexEntry *) reallocmem(index->entries, (index->n_entries + 1) * sizeof(IndexEntry));
+    IndexEntry *entry = &(index->entries[index->n_entries]);
+    entry->filename = (char *) allocmem(strlen(filename) + 1, sizeof(char));
+    snprintf(entry->filename, strlen(filename) + 1, "%s", filename);
+    entry->deleted = false;
+    entry->size = 0;
+    entry->mtime_sec = 0;
+    entry->mtime_nsec = 0;
+    entry->hash = 0;
+    entry->segment = 0;
+    entry->length = 0;
+    insert_slot(index, index->n_entries);
+    index->n_entries++;
+    return entry;
+}
+
+static void
+add_segment(Index *index, uint64_t number, uint64_t bytes)
+{
+    index->segments = (IndexSegment *) reallocmem(index->segments, (index->n_segments + 1) * sizeof(IndexSegment));
+    index->segments[index->n_segments].number = number;
+    index->segments[index->n_segments].bytes = bytes;
+    index->n_segments++;
+}
+
+static bool
+has_segment(Index *index, uint64_t number)
+{
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        if (index->segments[i].number == number)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+clear_manifest(Index *index)
+{
+    for (size_t i = 0; i < index->n_entries; i++)
+    {
+        freemem(index->entries[i].filename);
+    }
+    freemem(index->entries);
+    index->entries = NULL;
+    index->n_entries = 0;
+    freemem(index->segments);
+    index->segments = NULL;
+    index->n_segments = 0;
+    init_slots(index, 1024);
+}
+
+/* The manifest lists the live segments and then every entry. */
+static void
+read_manifest(Index *index)
+{
+    clear_manifest(index);
+    char *path = path_index(index, "manifest");
+    FILE *file = fopen(path, "rb");
+    freemem(path);
+    if (file == NULL)
+    {
+        if (errno != ENOENT)
+        {
+            index_error(index, "could not be read");
+        }
+        return;
+    }
+    char magic[sizeof(manifest_magic)];
+    read_index_data(index, file, magic, sizeof(magic));
+    if (memcmp(magic, manifest_magic, sizeof(magic)) != 0)
+    {
+        index_error(index, "is not an index or is from another version");
+    }
+    uint64_t n_segments = read_index_number(index, file);
+    for (uint64_t i = 0; i < n_segments; i++)
+    {
+        uint64_t number = read_index_number(index, file);
+        uint64_t bytes = read_index_number(index, file);
+        add_segment(index, number, bytes);
+    }
+    uint64_t n_entries = read_index_number(index, file);
+    for (uint64_t i = 0; i < n_entries; i++)
+    {
+        uint64_t len = read_index_number(index, file);
+        char *filename = (char *) allocmem(len + 1, sizeof(char));
+        read_index_data(index, file, filename, len);
+        filename[len] = '\0';
+        IndexEntry *entry = add_entry(index, filename);
+        freemem(filename);
+        entry->deleted = (read_index_number(index, file) != 0);
+        entry->size = read_index_number(index, file);
+        entry->mtime_sec = (int64_t) read_index_number(index, file);
+        entry->mtime_nsec = (int64_t) read_index_number(index, file);
+        entry->hash = read_index_number(index, file);
+        entry->segment = read_index_number(index, file);
+        entry->length = read_index_number(index, file);
+    }
+    fclose(file);
+}
+
+/* The new manifest is written beside the old one and renamed over it once it
+ * is on disk, so an interrupted update leaves the old one in effect. */
+static void
+write_manifest(Index *index)
+{
+    char *tmp_path = path_index(index, "manifest.tmp");
+    char *path = path_index(index, "manifest");
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        index_error(index, "could not be written");
+    }
+    write_index_data(index, file, manifest_magic, sizeof(manifest_magic));
+    write_index_number(index, file, (uint64_t) index->n_segments);
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        write_index_number(index, file, index->segments[i].number);
+        write_index_number(index, file, index->segments[i].bytes);
+    }
+    write_index_number(index, file, (uint64_t) index->n_entries);
+    for (size_t i = 0; i < index->n_entries; i++)
+    {
+        IndexEntry *entry = &(index->entries[i]);
+        uint64_t len = (uint64_t) strlen(entry->filename);
+        write_index_number(index, file, len);
+        write_index_data(index, file, entry->filename, len);
+        write_index_number(index, file, (entry->deleted == true) ? 1 : 0);
+        write_index_number(index, file, entry->size);
+        write_index_number(index, file, (uint64_t) entry->mtime_sec);
+        write_index_number(index, file, (uint64_t) entry->mtime_nsec);
+        write_index_number(index, file, entry->hash);
+        write_index_number(index, file, entry->segment);
+        write_index_number(index, file, entry->length);
+    }
+    sync_index(index, file);
+    fclose(file);
+    if (rename(tmp_path, path) != 0)
+    {
+        index_error(index, "could not be written");
+    }
+    freemem(tmp_path);
+    freemem(path);
+    index->changed = false;
+}
+
+/* Segment numbers are claimed by creating the file, so two writers never
+ * pick the same one. */
+static SegmentFile *
+create_segment(Index *index)
+{
+    uint64_t number = 1;
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        if (index->segments[i].number >= number)
+        {
+            number = index->segments[i].number + 1;
+        }
+    }
+    int fd = -1;
+    while (fd < 0)
+    {
+        char *path = segment_path_index(index, number);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666);
+        freemem(path);
+        if ((fd < 0) && (errno != EEXIST))
+        {
+            index_error(index, "could not be written");
+        }
+        else if (fd < 0)
+        {
+            number++;
+        }
+    }
+    SegmentFile *segment = (SegmentFile *) allocmem(1, sizeof(SegmentFile));
+    segment->number = number;
+    segment->file = fdopen(fd, "w+b");
+    if (segment->file == NULL)
+    {
+        index_error(index, "could not be written");
+    }
+    segment->n_documents = 0;
+    segment->ids = NULL;
+    segment->offsets = NULL;
+    segment->lengths = NULL;
+    segment->bytes = 0;
+    write_index_data(index, segment->file, segment_magic, sizeof(segment_magic));
+    return segment;
+}
+
+static void
+add_document_segment(SegmentFile *segment, uint64_t id, uint64_t offset, uint64_t length)
+{
+    size_t n = segment->n_documents + 1;
+    segment->ids = (uint64_t *) reallocmem(segment->ids, n * sizeof(uint64_t));
+    segment->offsets = (uint64_t *) reallocmem(segment->offsets, n * sizeof(uint64_t));
+    segment->lengths = (uint64_t *) reallocmem(segment->lengths, n * sizeof(uint64_t));
+    segment->ids[n-1] = id;
+    segment->offsets[n-1] = offset;
+    segment->lengths[n-1] = length;
+    segment->n_documents = n;
+    segment->bytes += length;
+}
+
+static void
+close_segment(SegmentFile *segment)
+{
+    if (segment->file != NULL)
+    {
+        fclose(segment->file);
+    }
+    freemem(segment->ids);
+    freemem(segment->offsets);
+    freemem(segment->lengths);
+    freemem(segment);
+}
+
+static void
+finish_segment(Index *index, SegmentFile *segment)
+{
+    uint64_t table_offset = (uint64_t) ftello(segment->file);
+    write_index_number(index, segment->file, (uint64_t) segment->n_documents);
+    for (size_t i = 0; i < segment->n_documents; i++)
+    {
+        write_index_number(index, segment->file, segment->ids[i]);
+        write_index_number(index, segment->file, segment->offsets[i]);
+        write_index_number(index, segment->file, segment->lengths[i]);
+    }
+    write_index_number(index, segment->file, table_offset);
+    sync_index(index, segment->file);
+}
+
+static SegmentFile *
+open_segment(Index *index, uint64_t number)
+{
+    char *path = segment_path_index(index, number);
+    FILE *file = fopen(path, "rb");
+    freemem(path);
+    if (file == NULL)
+    {
+        index_error(index, "is missing a segment");
+    }
+    char magic[sizeof(segment_magic)];
+    read_index_data(index, file, magic, sizeof(magic));
+    if ((memcmp(magic, segment_magic, sizeof(magic) - 1) == 0) && (magic[sizeof(magic)-1] != segment_magic[sizeof(magic)-1]))
+    {
+        index_error(index, "was written by another version and must be created again");
+    }
+    if ((memcmp(magic, segment_magic, sizeof(magic)) != 0) || (fseeko(file, -8, SEEK_END) != 0))
+    {
+        index_error(index, "is corrupt");
+    }
+    uint64_t table_offset = read_index_number(index, file);
+    seek_index(index, file, table_offset);
+    SegmentFile *segment = (SegmentFile *) allocmem(1, sizeof(SegmentFile));
+    segment->number = number;
+    segment->file = NULL;
+    segment->n_documents = 0;
+    segment->ids = NULL;
+    segment->offsets = NULL;
+    segment->lengths = NULL;
+    segment->bytes = 0;
+    uint64_t n_documents = read_index_number(index, file);
+    for (uint64_t i = 0; i < n_documents; i++)
+    {
+        uint64_t id = read_index_number(index, file);
+        uint64_t offset = read_index_number(index, file);
+        uint64_t length = read_index_number(index, file);
+        add_document_segment(segment, id, offset, length);
+    }
+    segment->file = file;
+    return segment;
+}
+
+/* The block in the segment is current only if the entry still points to
+ * this segment. */
+static bool
+live_in_segment(Index *index, SegmentFile *segment, size_t i)
+{
+    uint64_t id = segment->ids[i];
+    return ((id < index->n_entries) &&
+            (index->entries[id].deleted == false) &&
+            (index->entries[id].segment == segment->number));
+}
+
+Index *
+open_index(char *directory)
+{
+    Index *index = (Index *) allocmem(1, sizeof(Index));
+    index->directory = (char *) allocmem(strlen(directory) + 1, sizeof(char));
+    snprintf(index->directory, strlen(directory) + 1, "%s", directory);
+    index->entries = NULL;
+    index->n_entries = 0;
+    index->slots = NULL;
+    index->segments = NULL;
+    index->n_segments = 0;
+    index->n_added = 0;
+    index->n_modified = 0;
+    index->n_deleted = 0;
+    index->n_unchanged = 0;
+    index->n_merged = 0;
+    index->changed = false;
+    index->merging = false;
+    index->locked = false;
+
+    if ((mkdir(directory, 0777) != 0) && (errno != EEXIST))
+    {
+        index_error(index, "could not be created");
+    }
+    char *path = path_index(index, "lock");
+    index->lock_fd = open(path, O_RDWR | O_CREAT, 0666);
+    freemem(path);
+    if (index->lock_fd < 0)
+    {
+        index_error(index, "is not an index directory");
+    }
+    lock_index(index);
+    read_manifest(index);
+    return index;
+}
+
+static char *
+read_file_contents(char *filename, size_t *size)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s: File '%s' does not exist\n", program_name, filename);
+        exit(EXIT_FAILURE);
+    }
+    size_t capacity = 4096;
+    char *data = (char *) allocmem(capacity, sizeof(char));
+    *size = 0;
+    size_t n = 0;
+    while ((n = fread(data + *size, 1, capacity - *size, f)) > 0)
+    {
+        *size += n;
+        if (*size == capacity)
+        {
+            capacity *= 2;
+            data = (char *) reallocmem(data, capacity);
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+static uint64_t
+hash_contents(const char *data, size_t size)
+{
+    /* FNV-1a */
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ (unsigned char) data[i]) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/* A block is the number of words, the names of the fields other than the
+ * body that they are in, and then the text, line, column, page, and field of
+ * each word.  The field is 0 for the body or one more than the number of its
+ * name in the block.  Positions are implied by the order. */
+static void
+write_block(Index *index, SegmentFile *segment, IndexEntry *entry, char *data, size_t size)
+{
+    Word *words = NULL;
+    if (size > 0)
+    {
+        FILE *stream = fmemopen(data, size, "r");
+        if (stream == NULL)
+        {
+            fprintf(stderr, "%s: Cannot read file '%s'\n", program_name, entry->filename);
+            exit(EXIT_FAILURE);
+        }
+        read_source_words(&words, stream, NULL);
+        fclose(stream);
+    }
+    uint64_t offset = (uint64_t) ftello(segment->file);
+    uint64_t n_words = 0;
+    for (Word *current = words; current != NULL; current = next_word(current))
+    {
+        n_words++;
+    }
+    write_index_varint(index, segment->file, n_words);
+
+    unsigned long *fields = NULL;
+    uint64_t n_fields = 0;
+    for (Word *current = words; current != NULL; current = next_word(current))
+    {
+        unsigned long field = field_word(current);
+        if ((field != full_text_field) && ((n_fields == 0) || (fields[n_fields-1] != field)))
+        {
+            uint64_t k = 0;
+            while ((k < n_fields) && (fields[k] != field))
+            {
+                k++;
+            }
+            if (k == n_fields)
+            {
+                fields = (unsigned long *) reallocmem(fields, (size_t) (n_fields + 1) * sizeof(unsigned long));
+                fields[n_fields++] = field;
+            }
+        }
+    }
+    write_index_varint(index, segment->file, n_fields);
+    for (uint64_t k = 0; k < n_fields; k++)
+    {
+        const char *name = name_field(fields[k]);
+        uint64_t len = (uint64_t) strlen(name);
+        write_index_varint(index, segment->file, len);
+        write_index_data(index, segment->file, name, len);
+    }
+
+    uint64_t k = 0;
+    for (Word *current = words; current != NULL; current = next_word(current))
+    {
+        uint64_t len = (uint64_t) strlen(original_word(current));
+        write_index_varint(index, segment->file, len);
+        write_index_data(index, segment->file, original_word(current), len);
+        write_index_varint(index, segment->file, line_word(current));
+        write_index_varint(index, segment->file, column_word(current));
+        write_index_varint(index, segment->file, page_word(current));
+        unsigned long field = field_word(current);
+        if (field == full_text_field)
+        {
+            write_index_varint(index, segment->file, 0);
+            continue;
+        }
+        if (fields[k] != field)
+        {
+            k = 0;
+            while (fields[k] != field)
+            {
+                k++;
+            }
+        }
+        write_index_varint(index, segment->file, k + 1);
+    }
+    freemem(fields);
+    entry->segment = segment->number;
+    entry->length = (uint64_t) ftello(segment->file) - offset;
+    add_document_segment(segment, (uint64_t) (entry - index->entries), offset, entry->length);
+    free_words(words);
+}
+
+/* Files whose size and modification time match the manifest are not read.
+ * Files that were touched but whose contents hash the same are not indexed
+ * again. */
+static void
+refresh_entry(Index *index, SegmentFile **segment, IndexEntry *entry, struct stat *status)
+{
+    bool known = (entry->segment != 0);
+    if ((known == true) &&
+        (entry->size == (uint64_t) status->st_size) &&
+        (entry->mtime_sec == (int64_t) status->st_mtim.tv_sec) &&
+        (entry->mtime_nsec == (int64_t) status->st_mtim.tv_nsec))
+    {
+        index->n_unchanged++;
+        return;
+    }
+    double phase_start = start_phase();
+    size_t size = 0;
+    char *data = read_file_contents(entry->filename, &size);
+    uint64_t hash = hash_contents(data, size);
+    if ((known == true) && (entry->size == (uint64_t) size) && (entry->hash == hash))
+    {
+        index->n_unchanged++;
+    }
+    else
+    {
+        if (*segment == NULL)
+        {
+            *segment = create_segment(index);
+        }
+        write_block(index, *segment, entry, data, size);
+        if (known == true)
+        {
+            index->n_modified++;
+        }
+        else
+        {
+            index->n_added++;
+        }
+    }
+    index->changed = true;
+    entry->size = (uint64_t) size;
+    entry->hash = hash;
+    entry->mtime_sec = (int64_t) status->st_mtim.tv_sec;
+    entry->mtime_nsec = (int64_t) status->st_mtim.tv_nsec;
+    freemem(data);
+    end_phase(PH_READ, phase_start);
+}
+
+/* Brings the index up to date with the named files and with every file that
+ * it already holds.  New and modified files go into one new segment, and
+ * files that no longer exist are tombstoned. */
+void
+update_index(Index *index, size_t n_names, char *names[])
+{
+    SegmentFile *segment = NULL;
+    size_t n_known = index->n_entries;
+    bool *seen = (bool *) allocmem((n_known == 0) ? 1 : n_known, sizeof(bool));
+    for (size_t i = 0; i < n_known; i++)
+    {
+        seen[i] = false;
+    }
+
+    for (size_t i = 0; i < n_names; i++)
+    {
+        struct stat status;
+        if (stat(names[i], &status) != 0)
+        {
+            fprintf(stderr, "%s: File '%s' does not exist\n", program_name, names[i]);
+            exit(EXIT_FAILURE);
+        }
+        IndexEntry *entry = find_entry(index, names[i]);
+        if (entry == NULL)
+        {
+            entry = add_entry(index, names[i]);
+        }
+        else if ((size_t) (entry - index->entries) < n_known)
+        {
+            if (seen[entry - index->entries] == true)
+            {
+                continue;
+            }
+            seen[entry - index->entries] = true;
+        }
+        else
+        {
+            continue;
+        }
+        refresh_entry(index, &segment, entry, &status);
+    }
+
+    for (size_t i = 0; i < n_known; i++)
+    {
+        IndexEntry *entry = &(index->entries[i]);
+        if ((entry->deleted == true) || (seen[i] == true))
+        {
+            continue;
+        }
+        struct stat status;
+        if (stat(entry->filename, &status) != 0)
+        {
+            entry->deleted = true;
+            index->changed = true;
+            index->n_deleted++;
+        }
+        else
+        {
+            refresh_entry(index, &segment, entry, &status);
+        }
+    }
+    freemem(seen);
+
+    if (segment != NULL)
+    {
+        finish_segment(index, segment);
+        add_segment(index, segment->number, segment->bytes);
+        close_segment(segment);
+    }
+    if (index->changed == true)
+    {
+        write_manifest(index);
+    }
+}
+
+static Word *
+read_block(Index *index, SegmentFile *segment, size_t i, Document *document)
+{
+    seek_index(index, segment->file, segment->offsets[i]);
+    Word *words = NULL;
+    uint64_t n_words = read_index_varint(index, segment->file);
+    uint64_t n_fields = read_index_varint(index, segment->file);
+    unsigned long *fields = (unsigned long *) allocmem((size_t) n_fields + 1, sizeof(unsigned long));
+    fields[0] = full_text_field;
+    for (uint64_t k = 1; k <= n_fields; k++)
+    {
+        uint64_t len = read_index_varint(index, segment->file);
+        char *name = (char *) allocmem(len + 1, sizeof(char));
+        read_index_data(index, segment->file, name, len);
+        fields[k] = find_field(name, (size_t) len, true);
+        freemem(name);
+    }
+    for (uint64_t j = 0; j < n_words; j++)
+    {
+        uint64_t len = read_index_varint(index, segment->file);
+        char *data = (char *) allocmem(len + 1, sizeof(char));
+        read_index_data(index, segment->file, data, len);
+        data[len] = '\0';
+        unsigned long line = (unsigned long) read_index_varint(index, segment->file);
+        unsigned long column = (unsigned long) read_index_varint(index, segment->file);
+        unsigned long page = (unsigned long) read_index_varint(index, segment->file);
+        uint64_t k = read_index_varint(index, segment->file);
+        if (k > n_fields)
+        {
+            index_error(index, "is corrupt");
+        }
+        append_word(&words, data, document, line, column, (unsigned long) j + 1, page, fields[k]);
+    }
+    freemem(fields);
+    return list_first_word(words);
+}
+
+/* Loads the live documents of each segment into a segment with its own trie.
+ * Every segment file is opened before the lock is released, so a merge that
+ * removes one afterwards does not affect this reader. */
+size_t
+load_index(Index *index, Segment **segments)
+{
+    SegmentFile **files = (SegmentFile **) allocmem((index->n_segments == 0) ? 1 : index->n_segments, sizeof(SegmentFile *));
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        files[i] = open_segment(index, index->segments[i].number);
+    }
+    if (index->locked == true)
+    {
+        unlock_index(index);
+    }
+
+    *segments = (Segment *) allocmem((index->n_segments == 0) ? 1 : index->n_segments, sizeof(Segment));
+    size_t n_segments = 0;
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        SegmentFile *file = files[i];
+        size_t n_documents = 0;
+        for (size_t j = 0; j < file->n_documents; j++)
+        {
+            if (live_in_segment(index, file, j) == true)
+            {
+                n_documents++;
+            }
+        }
+        if (n_documents > 0)
+        {
+            Segment *segment = &((*segments)[n_segments]);
+            segment->documents = (Document **) allocmem(n_documents, sizeof(Document *));
+            segment->n_documents = 0;
+            init_trie(&(segment->trie));
+            for (size_t j = 0; j < file->n_documents; j++)
+            {
+                if (live_in_segment(index, file, j) == false)
+                {
+                    continue;
+                }
+                uint64_t id = file->ids[j];
+                Document *document = init_document(index->entries[id].filename, (unsigned long) id);
+                double phase_start = start_phase();
+                Word *words = read_block(index, file, j, document);
+                index_document(document, words);
+                end_phase(PH_READ, phase_start);
+                phase_start = start_phase();
+                add_words_to_trie(segment->trie, words);
+                end_phase(PH_INDEX, phase_start);
+                segment->documents[segment->n_documents] = document;
+                segment->n_documents++;
+            }
+            n_segments++;
+        }
+        close_segment(file);
+    }
+    freemem(files);
+    return n_segments;
+}
+
+static size_t
+tier_of_size(uint64_t bytes)
+{
+    size_t tier = 0;
+    uint64_t limit = merge_minimum_bytes * merge_factor;
+    while ((bytes >= limit) && (tier < 63))
+    {
+        tier++;
+        limit *= merge_factor;
+    }
+    return tier;
+}
+
+/* Picks the segments to merge: the smallest tier that has filled up, any
+ * segment that is mostly dead, and any segment with nothing live at all. */
+static size_t
+choose_merge(Index *index, bool *chosen)
+{
+    uint64_t *live = (uint64_t *) allocmem((index->n_segments == 0) ? 1 : index->n_segments, sizeof(uint64_t));
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        live[i] = 0;
+        chosen[i] = false;
+    }
+    for (size_t i = 0; i < index->n_entries; i++)
+    {
+        IndexEntry *entry = &(index->entries[i]);
+        for (size_t j = 0; (j < index->n_segments) && (entry->deleted == false); j++)
+        {
+            if (index->segments[j].number == entry->segment)
+            {
+                live[j] += entry->length;
+                break;
+            }
+        }
+    }
+
+    size_t n_tier[64] = {0};
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        n_tier[tier_of_size(live[i])]++;
+    }
+    size_t full_tier = 64;
+    for (size_t t = 0; t < 64; t++)
+    {
+        if (n_tier[t] >= merge_factor)
+        {
+            full_tier = t;
+            break;
+        }
+    }
+
+    size_t n_chosen = 0;
+    for (size_t i = 0; i < index->n_segments; i++)
+    {
+        if ((tier_of_size(live[i]) == full_tier) || (2 * live[i] < index->segments[i].bytes))
+        {
+            chosen[i] = true;
+            n_chosen++;
+        }
+    }
+    freemem(live);
+    return n_chosen;
+}
+
+/* Merges until the policy finds nothing to do.  The live blocks are copied
+ * into a new segment without holding the lock, and the lock is only taken
+ * again to switch the manifest to it.  If another writer merged any of the
+ * same segments in the meantime, this merge is abandoned. */
+void
+merge_index(Index *index)
+{
+    while (true)
+    {
+        lock_index(index);
+        read_manifest(index);
+        bool *chosen = (bool *) allocmem((index->n_segments == 0) ? 1 : index->n_segments, sizeof(bool));
+        size_t n_chosen = choose_merge(index, chosen);
+        if (n_chosen == 0)
+        {
+            unlock_index(index);
+            freemem(chosen);
+            return;
+        }
+        SegmentFile **sources = (SegmentFile **) allocmem(n_chosen, sizeof(SegmentFile *));
+        size_t k = 0;
+        for (size_t i = 0; i < index->n_segments; i++)
+        {
+            if (chosen[i] == true)
+            {
+                sources[k] = open_segment(index, index->segments[i].number);
+                k++;
+            }
+        }
+        freemem(chosen);
+        unlock_index(index);
+
+        SegmentFile *merged = NULL;
+        char *buffer = NULL;
+        for (size_t i = 0; i < n_chosen; i++)
+        {
+            SegmentFile *source = sources[i];
+            for (size_t j = 0; j < source->n_documents; j++)
+            {
+                if (live_in_segment(index, source, j) == false)
+                {
+                    continue;
+                }
+                if (merged == NULL)
+                {
+                    merged = create_segment(index);
+                }
+                buffer = (char *) reallocmem(buffer, (size_t) source->lengths[j]);
+                seek_index(index, source->file, source->offsets[j]);
+                read_index_data(index, source->file, buffer, (size_t) source->lengths[j]);
+                add_document_segment(merged, source->ids[j], (uint64_t) ftello(merged->file), source->lengths[j]);
+                write_index_data(index, merged->file, buffer, (size_t) source->lengths[j]);
+            }
+        }
+        freemem(buffer);
+        if (merged != NULL)
+        {
+            finish_segment(index, merged);
+        }
+
+        lock_index(index);
+        read_manifest(index);
+        bool current = true;
+        for (size_t i = 0; i < n_chosen; i++)
+        {
+            if (has_segment(index, sources[i]->number) == false)
+            {
+                current = false;
+            }
+        }
+        if (current == true)
+        {
+            for (size_t i = 0; i < index->n_entries; i++)
+            {
+                IndexEntry *entry = &(index->entries[i]);
+                for (size_t j = 0; (j < n_chosen) && (merged != NULL); j++)
+                {
+                    if (entry->segment == sources[j]->number)
+                    {
+                        entry->segment = merged->number;
+                    }
+                }
+            }
+            size_t n_segments = 0;
+            for (size_t i = 0; i < index->n_segments; i++)
+            {
+                bool keep = true;
+                for (size_t j = 0; j < n_chosen; j++)
+                {
+                    if (index->segments[i].number == sources[j]->number)
+                    {
+                        keep = false;
+                    }
+                }
+                if (keep == true)
+                {
+                    index->segments[n_segments] = index->segments[i];
+                    n_segments++;
+                }
+            }
+            index->n_segments = n_segments;
+            if (merged != NULL)
+            {
+                add_segment(index, merged->number, merged->bytes);
+            }
+            write_manifest(index);
+            index->n_merged += n_chosen;
+        }
+        unlock_index(index);
+
+        for (size_t i = 0; i < n_chosen; i++)
+        {
+            if (current == true)
+            {
+                char *path = segment_path_index(index, sources[i]->number);
+                unlink(path);
+                freemem(path);
+            }
+            close_segment(sources[i]);
+        }
+        freemem(sources);
+        if (merged != NULL)
+        {
+            if (current == false)
+            {
+                char *path = segment_path_index(index, merged->number);
+                unlink(path);
+                freemem(path);
+            }
+            close_segment(merged);
+        }
+        if (current == false)
+        {
+            return;
+        }
+    }
+}
+
+static void *
+merge_index_thread(void *arg)
+{
+    merge_index((Index *) arg);
+    merge_statistics();
+    return NULL;
+}
+
+/* Queries run on the documents already loaded, so merging in the background
+ * does not hold them up. */
+void
+start_merge_index(Index *index)
+{
+    if (pthread_create(&(index->merge_thread), NULL, merge_index_thread, index) == 0)
+    {
+        index->merging = true;
+    }
+}
+
+void
+print_index_summary(FILE *stream, Index *index)
+{
+    fprintf(stream, "%s: %s: %lu added, %lu modified, %lu deleted, %lu unchanged, %lu segments merged\n",
+            program_name, index->directory, index->n_added, index->n_modified, index->n_deleted,
+            index->n_unchanged, index->n_merged);
+}
+
+void
+close_index(Index *index)
+{
+    if (index->merging == true)
+    {
+        pthread_join(index->merge_thread, NULL);
+    }
+    if (index->locked == true)
+    {
+        unlock_index(index);
+    }
+    close(index->lock_fd);
+    clear_manifest(index);
+    freemem(index->slots);
+    freemem(index->directory);
+    freemem(index);
+}
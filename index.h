@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "search.h"
+#include "words.h"
+
+/* A persistent index is a directory that keeps the words of each document so
+ * that unchanged files need not be read again.  The words live in immutable
+ * segment files.  Each update writes the new and modified documents as one new
+ * segment, and a manifest records which segment holds the current words of
+ * each document.  The manifest is replaced by renaming, so a reader sees
+ * either the old one or the new one.  The files are specific to the machine
+ * that wrote them. */
+static const char manifest_magic[8] = {'w', 'o', 's', 'p', 'm', 'a', 'n', '1'};
+static const char segment_magic[8]  = {'w', 'o', 's', 'p', 's', 'e', 'g', '2'};
+
+/* Segments are grouped into tiers by the size of their live words, each tier
+ * merge_factor times larger than the last.  A tier with merge_factor segments
+ * is merged into one segment. */
+static const size_t merge_factor = 4;
+static const uint64_t merge_minimum_bytes = 65536;
+
+/* Each entry is one document, and its slot is its document number.  Deleted
+ * files leave a tombstone so that the numbers of the others do not change. */
+typedef struct IndexEntry
+{
+    char *filename;
+    bool deleted;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash; /* FNV-1a of the contents */
+    uint64_t segment; /* Number of the segment with the current words */
+    uint64_t length; /* Length of the block of words in that segment */
+} IndexEntry;
+
+typedef struct IndexSegment
+{
+    uint64_t number;
+    uint64_t bytes; /* Length of all blocks, live or not */
+} IndexSegment;
+
+typedef struct Index
+{
+    char *directory;
+    int lock_fd;
+    bool locked;
+    IndexEntry *entries;
+    size_t n_entries;
+    size_t *slots; /* Hash table of entry number + 1 by filename */
+    size_t n_slots;
+    IndexSegment *segments;
+    size_t n_segments;
+    unsigned long n_added;
+    unsigned long n_modified;
+    unsigned long n_deleted;
+    unsigned long n_unchanged;
+    unsigned long n_merged;
+    bool changed; /* The manifest on disk is out of date */
+    bool merging;
+    pthread_t merge_thread;
+} Index;
+
+Index *open_index(char *);
+void update_index(Index *, size_t, char **);
+size_t load_index(Index *, Segment **);
+void merge_index(Index *);
+void start_merge_index(Index *);
+void print_index_summary(FILE *, Index *);
+void close_index(Index *);
+
+#endif /* INDEX_H */
@@ -2,15 +2,108 @@
 /* Copyright (C) 2025 Andrew Trettel */
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "input.h"
 #include "misc.h"
 #include "search.h"
+#include "statistics.h"
+#include "tokenize.h"
 #include "words.h"
 
+static bool header_fields = false;
+static RecordSeparator record_separator = RS_NONE;
+static const char *record_separator_spec = "none";
+static const char *separator_word = NULL;
+static const char *page_marker = NULL;
+
+void
+set_header_fields(bool enabled)
+{
+    header_fields = enabled;
+}
+
+bool
+header_fields_enabled(void)
+{
+    return header_fields;
+}
+
+/* Returns false when the marker is not one word. */
+bool
+set_page_marker(const char *marker)
+{
+    if (marker[0] == '\0')
+    {
+        return false;
+    }
+    for (size_t i = 0; marker[i] != '\0'; i++)
+    {
+        if (isspace((unsigned char) marker[i]) != 0)
+        {
+            return false;
+        }
+    }
+    page_marker = marker;
+    return true;
+}
+
+const char *
+page_marker_name(void)
+{
+    return (page_marker == NULL) ? "formfeed" : page_marker;
+}
+
+/* The separator is "blank", "formfeed", "nul", or "line:WORD".  Returns false
+ * when it is none of these. */
+bool
+set_record_separator(const char *spec)
+{
+    const char *line_prefix = "line:";
+    if (strcmp(spec, "blank") == 0)
+    {
+        record_separator = RS_BLANK_LINE;
+    }
+    else if (strcmp(spec, "formfeed") == 0)
+    {
+        record_separator = RS_FORM_FEED;
+    }
+    else if (strcmp(spec, "nul") == 0)
+    {
+        record_separator = RS_NUL;
+    }
+    else if ((strncmp(spec, line_prefix, strlen(line_prefix)) == 0) && (spec[strlen(line_prefix)] != '\0'))
+    {
+        separator_word = &(spec[strlen(line_prefix)]);
+        for (size_t i = 0; separator_word[i] != '\0'; i++)
+        {
+            if (isspace((unsigned char) separator_word[i]) != 0)
+            {
+                return false;
+            }
+        }
+        record_separator = RS_LINE;
+    }
+    else
+    {
+        return false;
+    }
+    record_separator_spec = spec;
+    return true;
+}
+
+const char *
+record_separator_name(void)
+{
+    return record_separator_spec;
+}
+
 void
 add_words_to_trie(TrieNode *trie, Word *list)
 {
@@ -22,122 +115,415 @@ add_words_to_trie(TrieNode *trie, Word *list)
     }
 }
 
+/* With partial reads, a block holds whatever input is available, so that a
+ * stream that is still being written is read as soon as each line arrives. */
+SourceReader
+init_source_reader(FILE *stream, bool partial_reads)
+{
+    SourceReader reader;
+    reader.stream = stream;
+    reader.fd = (partial_reads == true) ? fileno(stream) : -1;
+    reader.classify = select_classify_function();
+    /* The block is padded to a multiple of 64 bytes with spaces. */
+    reader.block = (unsigned char *) allocmem(source_block_length + 64, sizeof(unsigned char));
+    reader.spaces = (uint64_t *) allocmem(source_block_length / 64 + 1, sizeof(uint64_t));
+    reader.marks = (uint64_t *) allocmem(source_block_length / 64 + 1, sizeof(uint64_t));
+    reader.length = 0;
+    reader.next = 0;
+    reader.partial = NULL;
+    reader.n_partial = 0;
+    reader.partial_marked = false;
+    reader.line = 1;
+    reader.column = 1;
+    reader.position = 1;
+    reader.p = '\0';
+    reader.field = full_text_field;
+    reader.in_header = header_fields;
+    reader.blank_line = true;
+    reader.page = 1;
+    reader.page_breaks = 0;
+    reader.file_words = false;
+    reader.at_separator = false;
+    reader.in_separator = false;
+    reader.record_words = false;
+    reader.record_ended = false;
+    return reader;
+}
+
 void
-read_source_words(Word **list, FILE *stream, char *filename)
+free_source_reader(SourceReader *reader)
 {
-    unsigned long line = 1, column = 1, position = 1;
-    int p = '\0';
-    int c = fgetc(stream);
-    while (c != EOF)
+    freemem(reader->block);
+    freemem(reader->spaces);
+    freemem(reader->marks);
+    freemem(reader->partial);
+}
+
+static bool
+fill_source_block(SourceReader *reader)
+{
+    size_t n = 0;
+    if (reader->fd >= 0)
     {
-        size_t len = 0;
-        char *data = NULL;
-        while ((isspace(c) == false) && (c != EOF))
+        ssize_t m;
+        do
         {
-            len++;
-            column++;
-            if (data == NULL)
-            {
-                data = (char *) allocmem(len, sizeof(char));
-            }
-            else
-            {
-                char *tmp = (char *) reallocmem(data, len);
-                data = tmp;
-            }
-            data[len-1] = (char) c;
-            p = c;
-            c = fgetc(stream);
+            m = read(reader->fd, reader->block, source_block_length);
         }
-        if (len > 0)
+        while ((m < 0) && (errno == EINTR));
+        n = (m < 0) ? 0 : (size_t) m;
+    }
+    else
+    {
+        n = fread(reader->block, sizeof(unsigned char), source_block_length, reader->stream);
+    }
+    size_t padded = (n + 63) / 64 * 64;
+    memset(&(reader->block[n]), ' ', padded - n);
+    reader->classify(reader->block, padded, reader->spaces, reader->marks);
+    if (record_separator == RS_NUL)
+    {
+        /* A NUL byte separates words as well as records. */
+        unsigned char *nul = memchr(reader->block, '\0', n);
+        while (nul != NULL)
         {
-            len++;
-            char *tmp = (char *) reallocmem(data, len);
-            data = tmp;
-            data[len-1] = '\0';
-            append_word(list, data, filename, line, column, position, 1);
-            position++;
+            size_t i = (size_t) (nul - reader->block);
+            reader->spaces[i/64] |= UINT64_C(1) << (i % 64);
+            reader->marks[i/64] &= ~(UINT64_C(1) << (i % 64));
+            nul = memchr(nul + 1, '\0', n - i - 1);
         }
-        if ((p != '\r' && c == '\n') || c == '\r')
+    }
+    reader->length = n;
+    reader->next = 0;
+    return (n > 0);
+}
+
+static void
+end_header(SourceReader *reader)
+{
+    reader->in_header = false;
+    reader->field = full_text_field;
+}
+
+/* The length of the name of a header field when the word is one, such as
+ * "Subject:", or else zero. */
+static size_t
+header_name_length(const char *data, size_t len)
+{
+    if ((len < 2) || (data[len-1] != ':') || (isalpha((unsigned char) data[0]) == 0))
+    {
+        return 0;
+    }
+    for (size_t i = 1; i + 1 < len; i++)
+    {
+        if ((isalnum((unsigned char) data[i]) == 0) && (data[i] != '-') && (data[i] != '_'))
         {
-            line++;
-            column = 1;
+            return 0;
         }
-        else if (isblank(c) == true)
+    }
+    return len - 1;
+}
+
+/* Every whitespace character moves the column or starts a line.  A carriage
+ * return followed by a newline is one line break. */
+static void
+read_source_space(SourceReader *reader, int c)
+{
+    if (((reader->p != '\r') && (c == '\n')) || (c == '\r'))
+    {
+        if (reader->blank_line == true)
         {
-            column++;
+            end_header(reader);
+            reader->at_separator = (reader->at_separator == true) || (record_separator == RS_BLANK_LINE);
         }
-        p = c;
-        c = fgetc(stream);
+        reader->in_separator = false;
+        reader->line++;
+        reader->column = 1;
+        reader->blank_line = true;
     }
-    *list = list_first_word(*list);
+    else if ((c == ' ') || (c == '\t'))
+    {
+        reader->column++;
+    }
+    else if (((c == '\f') && (record_separator == RS_FORM_FEED)) || ((c == '\0') && (record_separator == RS_NUL)))
+    {
+        reader->at_separator = true;
+    }
+    else if (c == '\f')
+    {
+        reader->page_breaks++;
+    }
+    reader->p = c;
 }
 
-size_t
-read_data(int argc, char *argv[], TrieNode **trie, char ***filenames, Word ***words)
+/* Whether a separator comes between the words of the record so far and the
+ * next word.  If so, the reader starts the next record, whose words start
+ * again at position 1. */
+static bool
+end_source_record(SourceReader *reader)
 {
-    if (argc == 1)
+    if (reader->at_separator == false)
+    {
+        return false;
+    }
+    reader->at_separator = false;
+    if (reader->record_words == false)
     {
-        fprintf(stderr, "%s: No query given\n", program_name);
-        exit(EXIT_FAILURE);
+        return false;
     }
+    reader->record_words = false;
+    reader->record_ended = true;
+    reader->in_header = header_fields;
+    reader->field = full_text_field;
+    reader->position = 1;
+    return true;
+}
 
-    size_t n_files = (argc == 2) ? 1 : argc - 2;
-    *filenames = (char **) allocmem(n_files, sizeof(char *));
-    *words = (Word **) allocmem(n_files, sizeof(Word *));
-    for (size_t i = 0; i < n_files; i++)
+/* Keeps the start of a word that continues into the next block. */
+static void
+keep_partial_word(SourceReader *reader, size_t start, size_t end)
+{
+    size_t len = end - start;
+    reader->partial = (char *) reallocmem(reader->partial, reader->n_partial + len + 1);
+    memcpy(&(reader->partial[reader->n_partial]), &(reader->block[start]), len);
+    reader->n_partial += len;
+    reader->partial_marked = (reader->partial_marked == true) || (any_bit_set(reader->marks, start, end) == true);
+}
+
+/* Words without punctuation are copied as they are.  Otherwise the bitmap of
+ * punctuation gives the characters to leave out of the reduced form.  A word
+ * with a NUL byte is ended at it, as it would be as a C string.  Returns false
+ * when the word was the name of a header field or part of a separator or
+ * page marker line instead. */
+static bool
+append_source_word(SourceReader *reader, Word **list, Document *document, size_t start, size_t end)
+{
+    size_t n_block = end - start;
+    size_t len = reader->n_partial + n_block;
+    char *data = (char *) allocmem(len + 1, sizeof(char));
+    if (reader->n_partial > 0)
     {
-        (*filenames)[i] = NULL;
-        (*words)[i] = NULL;
+        memcpy(data, reader->partial, reader->n_partial);
     }
-    if (argc == 2)
+    memcpy(&(data[reader->n_partial]), &(reader->block[start]), n_block);
+    data[len] = '\0';
+    bool line_start = (reader->column == 1);
+    reader->column += len;
+    reader->p = (unsigned char) data[len-1];
+    reader->blank_line = false;
+
+    bool separator = (record_separator == RS_LINE) && (line_start == true) && (strcmp(data, separator_word) == 0);
+    bool marker = (page_marker != NULL) && (line_start == true) && (strcmp(data, page_marker) == 0);
+    if ((reader->in_separator == true) || (separator == true) || (marker == true))
     {
-        (*filenames)[0] = (char *) allocmem(6, sizeof(char));
-        snprintf((*filenames)[0], 6, "stdin");
+        reader->in_separator = true;
+        reader->at_separator = (reader->at_separator == true) || (separator == true);
+        reader->page_breaks += (marker == true) ? 1 : 0;
+        freemem(data);
+        reader->n_partial = 0;
+        reader->partial_marked = false;
+        return false;
     }
-    else
+    if (reader->in_header == true)
     {
-        for (size_t i = 0; i < n_files; i++)
+        size_t n_name = (line_start == true) ? header_name_length(data, len) : 0;
+        if (n_name > 0)
+        {
+            reader->field = find_field(data, n_name, true);
+            freemem(data);
+            reader->n_partial = 0;
+            reader->partial_marked = false;
+            return false;
+        }
+        else if ((line_start == true) || (reader->field == full_text_field))
         {
-            (*filenames)[i] = (char *) allocmem((strlen(argv[i+2])+1), sizeof(char));
-            snprintf((*filenames)[i], strlen(argv[i+2])+1, "%s", argv[i+2]);
+            end_header(reader);
         }
     }
-    init_trie(trie);
-    for (size_t i = 0; i < n_files; i++)
+
+    if ((reader->page_breaks > 0) && (reader->file_words == true))
+    {
+        reader->page += reader->page_breaks;
+    }
+    reader->page_breaks = 0;
+    reader->file_words = true;
+
+    bool marked = (reader->partial_marked == true) || (any_bit_set(reader->marks, start, end) == true);
+    if ((marked == true) && ((reader->n_partial > 0) || (memchr(data, '\0', len) != NULL)))
+    {
+        append_word(list, data, document, reader->line, reader->column, reader->position, reader->page,
+                    reader->field);
+    }
+    else
     {
-        (*words)[i] = NULL;
-        if (argc == 2)
+        char *reduced = NULL;
+        if (marked == false)
         {
-            read_source_words(&((*words)[i]), stdin, (*filenames)[i]);
+            reduced = (char *) allocmem(len + 1, sizeof(char));
+            memcpy(reduced, data, len + 1);
         }
         else
         {
-            FILE *f = fopen((*filenames)[i], "r");
+            size_t n_reduced = n_block - (size_t) count_set_bits(reader->marks, start, end);
+            reduced = (char *) allocmem(n_reduced + 1, sizeof(char));
+            size_t j = 0;
+            for (size_t i = start; i < end; i++)
+            {
+                if (((reader->marks[i/64] >> (i % 64)) & 1) == 0)
+                {
+                    reduced[j++] = (char) reader->block[i];
+                }
+            }
+            reduced[j] = '\0';
+        }
+        append_reduced_word(list, data, reduced, flags_word_data(data, len), document, reader->line, reader->column,
+                            reader->position, reader->page, reader->field);
+    }
+    reader->position++;
+    reader->n_partial = 0;
+    reader->partial_marked = false;
+    reader->record_words = true;
+    return true;
+}
+
+/* Appends the next word of the stream to the list.  Returns false at the end
+ * of the stream, or at the end of a record with record_ended set, in which
+ * case the next call continues with the next record. */
+bool
+read_source_word(SourceReader *reader, Word **list, Document *document)
+{
+    reader->record_ended = false;
+    while (true)
+    {
+        if ((reader->next == reader->length) && (fill_source_block(reader) == false))
+        {
+            if ((reader->n_partial > 0) && (end_source_record(reader) == false) &&
+                (append_source_word(reader, list, document, reader->next, reader->next) == true))
+            {
+                return true;
+            }
+            return false;
+        }
+        size_t start = reader->next;
+        if (reader->n_partial == 0)
+        {
+            start = next_clear_bit(reader->spaces, reader->next, reader->length);
+            for (size_t i = reader->next; i < start; i++)
+            {
+                read_source_space(reader, reader->block[i]);
+            }
+            reader->next = start;
+            if (start == reader->length)
+            {
+                continue;
+            }
+        }
+        size_t end = next_set_bit(reader->spaces, start, reader->length);
+        if (end == reader->length)
+        {
+            keep_partial_word(reader, start, end);
+            reader->next = end;
+            continue;
+        }
+        if (end_source_record(reader) == true)
+        {
+            return false;
+        }
+        bool appended = append_source_word(reader, list, document, start, end);
+        reader->next = end;
+        if (appended == true)
+        {
+            return true;
+        }
+    }
+}
+
+void
+read_source_words(Word **list, FILE *stream, Document *document)
+{
+    SourceReader reader = init_source_reader(stream, false);
+    while (read_source_word(&reader, list, document) == true)
+    {
+        continue;
+    }
+    free_source_reader(&reader);
+    *list = list_first_word(*list);
+}
+
+/* With no names given, the input is read from stdin.  Each file is one
+ * document, or one document for each of its records. */
+size_t
+read_data(size_t n_names, char *names[], TrieNode **trie, Document ***documents)
+{
+    size_t n_files = (n_names == 0) ? 1 : n_names;
+    size_t n_documents = 0;
+    size_t capacity = n_files;
+    *documents = (Document **) allocmem(capacity, sizeof(Document *));
+    init_trie(trie);
+    for (size_t i = 0; i < n_files; i++)
+    {
+        char *name = (n_names == 0) ? "stdin" : names[i];
+        FILE *f = stdin;
+        if (n_names > 0)
+        {
+            f = fopen(names[i], "r");
             if (f == NULL)
             {
-                fprintf(stderr, "%s: File '%s' does not exist\n", program_name, (*filenames)[i]);
+                fprintf(stderr, "%s: File '%s' does not exist\n", program_name, names[i]);
                 exit(EXIT_FAILURE);
             }
-            read_source_words(&((*words)[i]), f, (*filenames)[i]);
+        }
+        SourceReader reader = init_source_reader(f, false);
+        unsigned long record = 0;
+        bool more_records = true;
+        while (more_records == true)
+        {
+            double phase_start = start_phase();
+            Document *document = init_document(name, (unsigned long) n_documents);
+            Word *words = NULL;
+            while (read_source_word(&reader, &words, document) == true)
+            {
+                continue;
+            }
+            more_records = reader.record_ended;
+            words = list_first_word(words);
+            if ((words == NULL) && (record > 0))
+            {
+                /* Nothing follows the last separator. */
+                free_document(document);
+                end_phase(PH_READ, phase_start);
+                break;
+            }
+            record++;
+            document->record = (record_separator == RS_NONE) ? 0 : record;
+            if (n_documents == capacity)
+            {
+                capacity *= 2;
+                *documents = (Document **) reallocmem(*documents, capacity * sizeof(Document *));
+            }
+            (*documents)[n_documents++] = document;
+            index_document(document, words);
+            end_phase(PH_READ, phase_start);
+            phase_start = start_phase();
+            add_words_to_trie(*trie, words);
+            end_phase(PH_INDEX, phase_start);
+        }
+        free_source_reader(&reader);
+        if (n_names > 0)
+        {
             fclose(f);
         }
-        add_words_to_trie(*trie, (*words)[i]);
     }
 
-    return n_files;
+    return n_documents;
 }
 
 void
-free_data(size_t n_files, TrieNode *trie, char **filenames, Word **words)
+free_data(size_t n_documents, TrieNode *trie, Document **documents)
 {
     free_trie(trie);
-    for (size_t i = 0; i < n_files; i++)
+    for (size_t i = 0; i < n_documents; i++)
     {
-        free(filenames[i]);
-        free_words(words[i]);
+        free_document(documents[i]);
     }
-    free(filenames);
-    free(words);
+    freemem(documents);
 }
-
@@ -3,14 +3,83 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "search.h"
+#include "tokenize.h"
 #include "words.h"
 
+/* The position in a stream of source text between calls that read one word
+ * at a time.  The words of each block are found from its bitmaps. */
+typedef struct SourceReader
+{
+    FILE *stream;
+    int fd; /* For partial reads, or -1 */
+    ClassifyFunction classify;
+    unsigned char *block;
+    uint64_t *spaces;
+    uint64_t *marks;
+    size_t length;
+    size_t next;
+    char *partial; /* The start of a word that continues into the next block */
+    size_t n_partial;
+    bool partial_marked;
+    unsigned long line;
+    unsigned long column;
+    unsigned long position;
+    int p; /* The character before the next one */
+    unsigned long field;
+    bool in_header; /* Reading the header fields at the start of the input */
+    bool blank_line; /* No word yet on the current line */
+    unsigned long page;
+    unsigned long page_breaks; /* Since the last word */
+    bool file_words; /* The file has a word before the next one */
+    bool at_separator; /* A record separator since the last word */
+    bool in_separator; /* Reading the rest of a separator or page marker line */
+    bool record_words; /* The current record has a word */
+    bool record_ended; /* The last read stopped at the end of a record */
+} SourceReader;
+
+/* A form feed starts a new page, as does a line that starts with the page
+ * marker, if there is one.  The marker line is not part of either page.
+ * Pages are numbered from 1 within their file, and page breaks before the
+ * first word of a file are ignored. */
+bool set_page_marker(const char *);
+const char *page_marker_name(void);
+
+/* With a record separator, each file is split into records and each record
+ * is a document of its own.  Records are separated by blank lines, form
+ * feeds, NUL bytes, or lines that start with a given word, such as the
+ * "From " lines of a mailbox.  A separator line is not part of either
+ * record.  Records are numbered from 1 within their file, and their lines
+ * keep their numbers within the file. */
+typedef enum RecordSeparator
+{
+    RS_NONE,
+    RS_BLANK_LINE,
+    RS_FORM_FEED,
+    RS_NUL,
+    RS_LINE
+} RecordSeparator;
+
+/* With header fields, each document may start with lines of the form
+ * "Name: value", where a line that starts with whitespace continues the
+ * value of the line before.  The header ends at the first blank line or the
+ * first line of another form, and the rest of the document is its body.  The
+ * words of each value are in the field of that name, and the names
+ * themselves are not words of the document. */
+void set_header_fields(bool);
+bool header_fields_enabled(void);
+bool set_record_separator(const char *);
+const char *record_separator_name(void);
 void add_words_to_trie(TrieNode *, Word *);
-void read_source_words(Word **, FILE *, char *);
-size_t read_data(int, char **, TrieNode **, char ***, Word ***);
-void free_data(size_t, TrieNode *, char **, Word **);
+SourceReader init_source_reader(FILE *, bool);
+void free_source_reader(SourceReader *);
+bool read_source_word(SourceReader *, Word **, Document *);
+void read_source_words(Word **, FILE *, Document *);
+size_t read_data(size_t, char **, TrieNode **, Document ***);
+void free_data(size_t, TrieNode *, Document **);
 
 #endif /* INPUT_H */
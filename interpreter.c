@@ -5,10 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
+#include "cancel.h"
+#include "daat.h"
+#include "input.h"
 #include "interpreter.h"
 #include "misc.h"
 #include "operations.h"
 #include "output.h"
+#include "rank.h"
+#include "spill.h"
+#include "statistics.h"
 
 #include <stdio.h>
 
@@ -21,7 +28,7 @@ insert_token(Token **list, TokenType type, int n, char *string, TokenType defaul
         cumulative_quotes = (*list)->cumulative_quotes;
     }
     TokenType prev_type = type_token(*list);
-    if ((     (type == TK_WILDCARD) ||      (type == TK_QUOTE) ||      (type == TK_L_PAREN)) &&
+    if ((     (type == TK_WILDCARD) ||      (type == TK_QUOTE) ||      (type == TK_L_PAREN) || (type == TK_FIELD_OP)) &&
         ((prev_type == TK_WILDCARD) || (prev_type == TK_QUOTE) || (prev_type == TK_R_PAREN))
         && (cumulative_quotes % 2 == 0))
     {
@@ -39,6 +46,7 @@ insert_token(Token **list, TokenType type, int n, char *string, TokenType defaul
         else if (type == TK_ALONG_OP) { new_type = TK_NOT_ALONG_OP; }
         else if (type == TK_WITH_OP)  { new_type = TK_NOT_WITH_OP;  }
         else if (type == TK_SAME_OP)  { new_type = TK_NOT_SAME_OP;  }
+        else if (type == TK_PAGE_OP)  { new_type = TK_NOT_PAGE_OP;  }
         type = new_type;
         char *prev_string = string_token(*list);
         char *tmp = (char *) allocmem((strlen(prev_string)+strlen(string)+1), sizeof(char));
@@ -51,11 +59,11 @@ insert_token(Token **list, TokenType type, int n, char *string, TokenType defaul
             tmp[strlen(prev_string)+i] = string[i];
         }
         tmp[strlen(prev_string)+strlen(string)] = '\0';
-        free(string);
+        freemem(string);
         string = tmp;
         Token *prev_tkn = prev_token(*list);
-        free((*list)->string);
-        free(*list);
+        freemem((*list)->string);
+        freemem(*list);
         *list = prev_tkn;
     }
     else if ((cumulative_quotes % 2 == 1) && (type != TK_QUOTE))
@@ -178,13 +186,13 @@ free_tokens(Token *list)
     while (iterator_has_next_token(iterator) == true)
     {
         Token *current = iterator_next_token(&iterator);
-        free(current->string);
-        free(current);
+        freemem(current->string);
+        freemem(current);
     }
 }
 
-static const char  *operator_prefixes[] = {    "or",     "and",     "not",     "xor",     "adj",     "near",     "among",     "along",     "with",     "same",      "notadj",      "notnear",      "notamong",      "notalong",      "notwith",      "notsame",     "icase",     "scase",     "lcase",     "ucase",     "tcase"};
-static const TokenType operator_types[] = {TK_OR_OP, TK_AND_OP, TK_NOT_OP, TK_XOR_OP, TK_ADJ_OP, TK_NEAR_OP, TK_AMONG_OP, TK_ALONG_OP, TK_WITH_OP, TK_SAME_OP, TK_NOT_ADJ_OP, TK_NOT_NEAR_OP, TK_NOT_AMONG_OP, TK_NOT_ALONG_OP, TK_NOT_WITH_OP, TK_NOT_SAME_OP, TK_ICASE_OP, TK_SCASE_OP, TK_LCASE_OP, TK_UCASE_OP, TK_TCASE_OP};
+static const char  *operator_prefixes[] = {    "or",     "and",     "not",     "xor",     "adj",     "near",     "among",     "along",     "with",     "same",   "onpage",      "notadj",      "notnear",      "notamong",      "notalong",      "notwith",      "notsame",    "notonpage",     "icase",     "scase",     "lcase",     "ucase",     "tcase"};
+static const TokenType operator_types[] = {TK_OR_OP, TK_AND_OP, TK_NOT_OP, TK_XOR_OP, TK_ADJ_OP, TK_NEAR_OP, TK_AMONG_OP, TK_ALONG_OP, TK_WITH_OP, TK_SAME_OP, TK_PAGE_OP, TK_NOT_ADJ_OP, TK_NOT_NEAR_OP, TK_NOT_AMONG_OP, TK_NOT_ALONG_OP, TK_NOT_WITH_OP, TK_NOT_SAME_OP, TK_NOT_PAGE_OP, TK_ICASE_OP, TK_SCASE_OP, TK_LCASE_OP, TK_UCASE_OP, TK_TCASE_OP};
 
 static const char  *alias_prefixes[] = {  "around",    "notaround"};
 static const TokenType alias_types[] = {TK_NEAR_OP, TK_NOT_NEAR_OP};
@@ -305,9 +313,9 @@ identify_token_type(char *data, TokenType *type, int *n)
         *type = TK_WILDCARD;
         *n = 0;
     }
-    free(lcase);
-    free(prefix);
-    free(suffix);
+    freemem(lcase);
+    freemem(prefix);
+    freemem(suffix);
 }
 
 TokenIterator
@@ -331,6 +339,23 @@ iterator_has_next_token(TokenIterator iterator)
     return (iterator.next != NULL);
 }
 
+/* The length of the name when a word starts with a field name and a colon,
+ * as in subject:meeting, or else zero. */
+static size_t
+field_name_length(const char *data)
+{
+    if (isalpha((unsigned char) data[0]) == 0)
+    {
+        return 0;
+    }
+    size_t i = 1;
+    while ((isalnum((unsigned char) data[i]) != 0) || (data[i] == '-') || (data[i] == '_'))
+    {
+        i++;
+    }
+    return (data[i] == ':') ? i : 0;
+}
+
 Token *
 lex_query(char *query, TokenType default_operator_type)
 {
@@ -360,6 +385,23 @@ lex_query(char *query, TokenType default_operator_type)
             insert_token(&tokens, type, 0, tmp, default_operator_type);
             i++;
         }
+        /* With header fields, a word that starts with a name and a colon
+         * restricts what follows to that field, and the rest of the word is
+         * lexed as if it were a word of its own, as in subject:(hi OR bye). */
+        size_t n_name = (header_fields_enabled() == true) ? field_name_length(&(query[i])) : 0;
+        if ((n_name > 0) && ((tokens == NULL) || (tokens->cumulative_quotes % 2 == 0)))
+        {
+            char *name = (char *) allocmem(n_name + 2, sizeof(char));
+            for (size_t k = 0; k < n_name; k++)
+            {
+                name[k] = (char) tolower((unsigned char) query[i+k]);
+            }
+            name[n_name] = ':';
+            name[n_name+1] = '\0';
+            insert_token(&tokens, TK_FIELD_OP, 0, name, default_operator_type);
+            i += n_name + 1;
+            continue;
+        }
         size_t len = 1;
         char *data = (char *) allocmem(len, sizeof(char));
         data[len - 1] = '\0';
@@ -381,7 +423,7 @@ lex_query(char *query, TokenType default_operator_type)
         }
         else
         {
-            free(data);
+            freemem(data);
         }
         if ((query[i] != ')') && (query[i] != '"') && (query[i] != '\''))
         {
@@ -427,7 +469,8 @@ proximity_operator_token_type(TokenType type)
         type == TK_AMONG_OP || type == TK_NOT_AMONG_OP ||
         type == TK_ALONG_OP || type == TK_NOT_ALONG_OP ||
         type == TK_WITH_OP  || type == TK_NOT_WITH_OP  ||
-        type == TK_SAME_OP  || type == TK_NOT_SAME_OP)
+        type == TK_SAME_OP  || type == TK_NOT_SAME_OP  ||
+        type == TK_PAGE_OP  || type == TK_NOT_PAGE_OP)
     {
         return true;
     }
@@ -441,7 +484,25 @@ search_operator_token_type(TokenType type)
 {
     if (type == TK_ICASE_OP || type == TK_SCASE_OP ||
         type == TK_LCASE_OP || type == TK_UCASE_OP ||
-        type == TK_TCASE_OP)
+        type == TK_TCASE_OP || type == TK_FIELD_OP)
+    {
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+/* Operators whose result can lose matches when an operand gains some. */
+bool
+negation_operator_token_type(TokenType type)
+{
+    if (type == TK_NOT_OP       || type == TK_XOR_OP       ||
+        type == TK_NOT_ADJ_OP   || type == TK_NOT_NEAR_OP  ||
+        type == TK_NOT_AMONG_OP || type == TK_NOT_ALONG_OP ||
+        type == TK_NOT_WITH_OP  || type == TK_NOT_SAME_OP  ||
+        type == TK_NOT_PAGE_OP)
     {
         return true;
     }
@@ -527,6 +588,73 @@ count_errors_tokens(Token *list, bool print_errors)
     return n;
 }
 
+SearchOptions init_search_options(void)
+{
+    SearchOptions options;
+    options.case_mode = CM_INSENSITIVE;
+    options.edit_dist = 0;
+    options.proximity_mode = PM_INCLUSIVE;
+    options.default_operator_type = TK_OR_OP;
+    options.explain = false;
+    options.by_document = false;
+    options.timeout = 0.0;
+    options.cancel = NULL;
+    options.limits = init_query_limits();
+    return options;
+}
+
+CaseMode case_mode_search_options(SearchOptions options)
+{
+    return options.case_mode;
+}
+
+unsigned int edit_dist_search_options(SearchOptions options)
+{
+    return options.edit_dist;
+}
+
+ProximityMode proximity_mode_search_options(SearchOptions options)
+{
+    return options.proximity_mode;
+}
+
+TokenType default_operator_type_search_options(SearchOptions options)
+{
+    return options.default_operator_type;
+}
+
+bool explain_search_options(SearchOptions options)
+{
+    return options.explain;
+}
+
+bool by_document_search_options(SearchOptions options)
+{
+    return options.by_document;
+}
+
+double timeout_search_options(SearchOptions options)
+{
+    return options.timeout;
+}
+
+CancelToken *cancel_search_options(SearchOptions options)
+{
+    return options.cancel;
+}
+
+/* Queries run with these options stop once the token is cancelled.  The token
+ * must outlive them. */
+void set_cancel_search_options(SearchOptions *options, CancelToken *token)
+{
+    options->cancel = token;
+}
+
+QueryLimits limits_search_options(SearchOptions options)
+{
+    return options.limits;
+}
+
 TokenType type_syntax_tree(SyntaxTree *tree)
 {
     return tree->type;
@@ -561,9 +689,18 @@ insert_parent(TokenType type, int n, char *string, SyntaxTree *left, SyntaxTree
     current->string = string;
     current->left = left;
     current->right = right;
+    current->profile = NULL;
     return current;
 }
 
+/* A field operator is written as the name of its field. */
+static const char *
+operator_name(SyntaxTree *tree)
+{
+    TokenType type = type_syntax_tree(tree);
+    return (type == TK_FIELD_OP) ? string_syntax_tree(tree) : find_operator_prefix(type);
+}
+
 void
 print_syntax_tree(FILE *stream, SyntaxTree *tree, bool terminal)
 {
@@ -581,7 +718,7 @@ print_syntax_tree(FILE *stream, SyntaxTree *tree, bool terminal)
         else if (search_operator_token_type(type) == true)
         {
             fprintf(stream, "(");
-            fprintf(stream, "%s", find_operator_prefix(type));
+            fprintf(stream, "%s", operator_name(tree));
             if (number_syntax_tree(tree) != 0)
             {
                 fprintf(stream, "%d", number_syntax_tree(tree));
@@ -610,6 +747,213 @@ print_syntax_tree(FILE *stream, SyntaxTree *tree, bool terminal)
     }
 }
 
+static int
+compare_strings(const void *a, const void *b)
+{
+    return strcmp(*((char * const *) a), *((char * const *) b));
+}
+
+static char *canonical_operand(SyntaxTree *);
+
+/* Gathers the operands of a chain of the same operator, such as a OR (b OR c). */
+static void
+collect_operands(SyntaxTree *tree, TokenType type, char ***operands, size_t *n_operands)
+{
+    if ((type_syntax_tree(tree) == type) && (number_syntax_tree(tree) == 0))
+    {
+        collect_operands(left_syntax_tree(tree), type, operands, n_operands);
+        collect_operands(right_syntax_tree(tree), type, operands, n_operands);
+    }
+    else
+    {
+        *operands = (char **) reallocmem(*operands, (*n_operands + 1) * sizeof(char *));
+        (*operands)[(*n_operands)++] = canonical_operand(tree);
+    }
+}
+
+static char *
+canonical_operand(SyntaxTree *tree)
+{
+    char *string = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&string, &size);
+    if (stream == NULL)
+    {
+        fprintf(stderr, "%s: error allocating memory\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    TokenType type = type_syntax_tree(tree);
+    if ((type == TK_OR_OP) || (type == TK_AND_OP))
+    {
+        char **operands = NULL;
+        size_t n_operands = 0;
+        collect_operands(tree, type, &operands, &n_operands);
+        qsort(operands, n_operands, sizeof(char *), compare_strings);
+        fprintf(stream, "(");
+        for (size_t i = 0; i < n_operands; i++)
+        {
+            fprintf(stream, "%s%s", (i > 0) ? " " : "", operands[i]);
+            if (i + 1 < n_operands)
+            {
+                fprintf(stream, " %s", find_operator_prefix(type));
+            }
+            free(operands[i]);
+        }
+        fprintf(stream, ")");
+        freemem(operands);
+    }
+    else if ((type == TK_WILDCARD) || (type == TK_ERROR))
+    {
+        print_syntax_tree(stream, tree, false);
+    }
+    else
+    {
+        char *left = canonical_operand(left_syntax_tree(tree));
+        char *right = (search_operator_token_type(type) == true) ? NULL : canonical_operand(right_syntax_tree(tree));
+        if ((type == TK_XOR_OP) && (strcmp(left, right) > 0))
+        {
+            char *tmp = left;
+            left = right;
+            right = tmp;
+        }
+        fprintf(stream, "(");
+        if (right != NULL)
+        {
+            fprintf(stream, "%s ", left);
+        }
+        fprintf(stream, "%s", operator_name(tree));
+        if (number_syntax_tree(tree) != 0)
+        {
+            fprintf(stream, "%d", number_syntax_tree(tree));
+        }
+        fprintf(stream, " %s)", (right != NULL) ? right : left);
+        free(left);
+        free(right);
+    }
+    fclose(stream);
+    return string;
+}
+
+/* The query as a string that does not depend on how it was written.  Spacing
+ * and the default operator are already gone from the tree.  The operands of a
+ * chain of ORs or ANDs are sorted, since neither their order nor their
+ * grouping changes the result.  XOR is not associative here, so each XOR
+ * keeps its shape and only its two operands are ordered.  The caller frees
+ * the string with free. */
+char *
+canonical_syntax_tree(SyntaxTree *tree)
+{
+    return canonical_operand(tree);
+}
+
+void
+init_profile_syntax_tree(SyntaxTree *tree)
+{
+    if (tree != NULL)
+    {
+        tree->profile = (SyntaxTreeProfile *) allocmem(1, sizeof(SyntaxTreeProfile));
+        tree->profile->evaluated = false;
+        tree->profile->seconds = 0.0;
+        tree->profile->n_input = 0;
+        tree->profile->n_output = 0;
+        tree->profile->n_documents = 0;
+        tree->profile->n_terms = 0;
+        tree->profile->bytes = 0;
+        init_profile_syntax_tree(left_syntax_tree(tree));
+        init_profile_syntax_tree(right_syntax_tree(tree));
+    }
+}
+
+/* Gathers the operands of a chain of ORs, which is evaluated as one union. */
+static void
+collect_union_operands(SyntaxTree *tree, SyntaxTree ***operands, size_t *n_operands)
+{
+    if (type_syntax_tree(tree) == TK_OR_OP)
+    {
+        collect_union_operands(left_syntax_tree(tree), operands, n_operands);
+        collect_union_operands(right_syntax_tree(tree), operands, n_operands);
+    }
+    else
+    {
+        *operands = (SyntaxTree **) reallocmem(*operands, (*n_operands + 1) * sizeof(SyntaxTree *));
+        (*operands)[(*n_operands)++] = tree;
+    }
+}
+
+/* One line per node, indented by depth.  The time and bytes include the
+ * children, and the self time excludes them.  A chain of ORs is shown as one
+ * operator over all of its operands, as it is evaluated. */
+void
+print_profile_syntax_tree(FILE *stream, SyntaxTree *tree, unsigned int depth)
+{
+    if ((tree != NULL) && (tree->profile != NULL))
+    {
+        SyntaxTreeProfile *profile = tree->profile;
+        TokenType type = type_syntax_tree(tree);
+        for (unsigned int i = 0; i < depth; i++)
+        {
+            fprintf(stream, "  ");
+        }
+        if (type == TK_WILDCARD)
+        {
+            fprintf(stream, "%s", string_syntax_tree(tree));
+        }
+        else if (type == TK_ERROR)
+        {
+            fprintf(stream, "error");
+        }
+        else
+        {
+            const char *prefix = operator_name(tree);
+            for (size_t i = 0; prefix[i] != '\0'; i++)
+            {
+                fputc(toupper(prefix[i]), stream);
+            }
+            if (number_syntax_tree(tree) != 0)
+            {
+                fprintf(stream, "%d", number_syntax_tree(tree));
+            }
+        }
+        if (profile->evaluated == false)
+        {
+            fprintf(stream, "  (not evaluated)\n");
+            return;
+        }
+        SyntaxTree **children = NULL;
+        size_t n_children = 0;
+        if (type == TK_OR_OP)
+        {
+            collect_union_operands(tree, &children, &n_children);
+        }
+        else
+        {
+            children = (SyntaxTree **) allocmem(2, sizeof(SyntaxTree *));
+            children[n_children++] = left_syntax_tree(tree);
+            children[n_children++] = right_syntax_tree(tree);
+        }
+        double child_seconds = 0.0;
+        for (size_t i = 0; i < n_children; i++)
+        {
+            if ((children[i] != NULL) && (children[i]->profile != NULL))
+            {
+                child_seconds += children[i]->profile->seconds;
+            }
+        }
+        fprintf(stream, "  time=%.3fms self=%.3fms", 1.0e3 * profile->seconds, 1.0e3 * (profile->seconds - child_seconds));
+        if (type != TK_WILDCARD)
+        {
+            fprintf(stream, " in=%lu", profile->n_input);
+        }
+        fprintf(stream, " out=%lu docs=%lu terms=%lu bytes=%zu\n",
+                profile->n_output, profile->n_documents, profile->n_terms, profile->bytes);
+        for (size_t i = 0; i < n_children; i++)
+        {
+            print_profile_syntax_tree(stream, children[i], depth + 1);
+        }
+        freemem(children);
+    }
+}
+
 void
 free_syntax_tree(SyntaxTree *tree)
 {
@@ -617,8 +961,9 @@ free_syntax_tree(SyntaxTree *tree)
     {
         free_syntax_tree(left_syntax_tree(tree));
         free_syntax_tree(right_syntax_tree(tree));
+        freemem(tree->profile);
     }
-    free(tree);
+    freemem(tree);
 }
 
 bool
@@ -680,7 +1025,14 @@ SyntaxTree *
 parse_negation_op(Token **token)
 {
     TokenType list[] = {TK_NOT_OP};
-    return parse_types(token, list, 1, parse_paragraph_prox_op);
+    return parse_types(token, list, 1, parse_page_prox_op);
+}
+
+SyntaxTree *
+parse_page_prox_op(Token **token)
+{
+    TokenType list[] = {TK_PAGE_OP, TK_NOT_PAGE_OP};
+    return parse_types(token, list, 2, parse_paragraph_prox_op);
 }
 
 SyntaxTree *
@@ -799,40 +1151,164 @@ parse_atom(Token **token)
     }
 }
 
+/* The case mode that a search operator applies to its operand. */
+CaseMode
+case_mode_search_operator(TokenType type, CaseMode case_mode)
+{
+    if      (type == TK_ICASE_OP) {return CM_INSENSITIVE;}
+    else if (type == TK_SCASE_OP) {return CM_SENSITIVE;}
+    else if (type == TK_LCASE_OP) {return CM_LOWERCASE;}
+    else if (type == TK_UCASE_OP) {return CM_UPPERCASE;}
+    else if (type == TK_TCASE_OP) {return CM_TITLE_CASE;}
+    return case_mode;
+}
+
+/* The edit distance that a search operator applies to its operand.  A field
+ * operator keeps the one that applies to it. */
+unsigned int
+edit_dist_search_operator(SyntaxTree *tree, unsigned int edit_dist)
+{
+    if (type_syntax_tree(tree) == TK_FIELD_OP)
+    {
+        return edit_dist;
+    }
+    return (unsigned int) number_syntax_tree(tree);
+}
+
+/* The field that a search operator restricts its operand to. */
+unsigned long
+field_search_operator(SyntaxTree *tree, unsigned long field)
+{
+    if (type_syntax_tree(tree) == TK_FIELD_OP)
+    {
+        char *name = string_syntax_tree(tree);
+        return find_field(name, strlen(name) - 1, false);
+    }
+    return field;
+}
+
+/* Terms are searched for in the trie, or taken from leaves when evaluating
+ * one document at a time. */
 Match *
-eval_syntax_tree(SyntaxTree *tree, TrieNode *trie, CaseMode case_mode, unsigned int edit_dist, ProximityMode proximity_mode, bool *error_flag)
+eval_syntax_tree(SyntaxTree *tree, TrieNode *trie, TermCache *cache, CaseMode case_mode, unsigned int edit_dist, unsigned long field, ProximityMode proximity_mode, DocumentLeaves *leaves, bool *error_flag)
 {
+    SyntaxTreeProfile *profile = tree->profile;
+    double start_time = 0.0;
+    size_t start_bytes = 0;
+    unsigned long start_terms = 0;
+    if (profile != NULL)
+    {
+        start_time = wall_time();
+        start_bytes = statistic(CT_ALLOCATED_BYTES);
+        start_terms = statistic(CT_TERMS_EXPANDED);
+    }
+
     Match *matches = NULL;
+    bool skipped = false;
     TokenType type = type_syntax_tree(tree);
     if (type == TK_ERROR)
     {
         *error_flag = true;
         fprintf(stderr, "%s: Syntax error in token '%s'\n", program_name, string_syntax_tree(tree));
     }
+    else if (query_cancelled() == true)
+    {
+        /* Nothing more is evaluated once the query has been stopped. */
+        skipped = true;
+    }
     else if (type == TK_WILDCARD)
     {
-        matches = wildcard_search(trie, string_syntax_tree(tree), case_mode, edit_dist);
+        if (leaves == NULL)
+        {
+            matches = cached_wildcard_search(cache, trie, string_syntax_tree(tree), case_mode, edit_dist, field);
+        }
+        else if (leaves->next < leaves->n_slices)
+        {
+            matches = leaves->slices[leaves->next];
+            leaves->slices[leaves->next] = NULL;
+            leaves->next++;
+        }
     }
     else if (search_operator_token_type(type) == true)
     {
-        CaseMode case_mode_tmp = case_mode;
-        if      (type == TK_ICASE_OP) {case_mode_tmp = CM_INSENSITIVE;}
-        else if (type == TK_SCASE_OP) {case_mode_tmp = CM_SENSITIVE;}
-        else if (type == TK_LCASE_OP) {case_mode_tmp = CM_LOWERCASE;}
-        else if (type == TK_UCASE_OP) {case_mode_tmp = CM_UPPERCASE;}
-        else if (type == TK_TCASE_OP) {case_mode_tmp = CM_TITLE_CASE;}
-        unsigned int edit_dist_tmp = (unsigned int) number_syntax_tree(tree);
-        matches  = eval_syntax_tree(left_syntax_tree(tree), trie, case_mode_tmp, edit_dist_tmp, proximity_mode, error_flag);
+        CaseMode case_mode_tmp = case_mode_search_operator(type, case_mode);
+        unsigned int edit_dist_tmp = edit_dist_search_operator(tree, edit_dist);
+        unsigned long field_tmp = field_search_operator(tree, field);
+        matches  = eval_syntax_tree(left_syntax_tree(tree), trie, cache, case_mode_tmp, edit_dist_tmp, field_tmp, proximity_mode, leaves, error_flag);
+        if (profile != NULL)
+        {
+            profile->n_input += length_of_match_list(matches);
+        }
+    }
+    else if (type == TK_OR_OP)
+    {
+        /* A chain of ORs is one union of all of its operands.  Each operand
+         * but the last sits idle while the others are evaluated, so move it
+         * to disk when over the memory budget. */
+        SyntaxTree **operand_trees = NULL;
+        size_t n_operands = 0;
+        collect_union_operands(tree, &operand_trees, &n_operands);
+        Match **operands = (Match **) allocmem(n_operands, sizeof(Match *));
+        MatchSpill **spills = (MatchSpill **) allocmem(n_operands, sizeof(MatchSpill *));
+        for (size_t i = 0; i < n_operands; i++)
+        {
+            operands[i] = eval_syntax_tree(operand_trees[i], trie, cache, case_mode, edit_dist, field, proximity_mode, leaves, error_flag);
+            spills[i] = NULL;
+            if ((i + 1 < n_operands) && (memory_over_budget() == true) && (operands[i] != NULL))
+            {
+                spills[i] = init_match_spill();
+                spill_matches(spills[i], &(operands[i]));
+            }
+        }
+        for (size_t i = 0; i < n_operands; i++)
+        {
+            if (spills[i] != NULL)
+            {
+                operands[i] = merge_match_spill(spills[i], NULL);
+            }
+            if (profile != NULL)
+            {
+                profile->n_input += length_of_match_list(operands[i]);
+            }
+        }
+        if (*error_flag == false)
+        {
+            matches = op_union(operands, n_operands);
+        }
+        for (size_t i = 0; i < n_operands; i++)
+        {
+            free_matches(operands[i]);
+        }
+        freemem(spills);
+        freemem(operands);
+        freemem(operand_trees);
+        matches = canonical_matches(collect_spilled_matches(matches));
     }
     else
     {
-        Match *left  = eval_syntax_tree( left_syntax_tree(tree), trie, case_mode, edit_dist, proximity_mode, error_flag);
-        Match *right = eval_syntax_tree(right_syntax_tree(tree), trie, case_mode, edit_dist, proximity_mode, error_flag);
+        Match *left  = eval_syntax_tree( left_syntax_tree(tree), trie, cache, case_mode, edit_dist, field, proximity_mode, leaves, error_flag);
+
+        /* The left operand sits idle while the right one is evaluated, so
+         * move it to disk when over the memory budget. */
+        MatchSpill *left_spill = NULL;
+        if ((memory_over_budget() == true) && (left != NULL))
+        {
+            left_spill = init_match_spill();
+            spill_matches(left_spill, &left);
+        }
+        Match *right = eval_syntax_tree(right_syntax_tree(tree), trie, cache, case_mode, edit_dist, field, proximity_mode, leaves, error_flag);
+        if (left_spill != NULL)
+        {
+            left = merge_match_spill(left_spill, NULL);
+        }
         int n = number_syntax_tree(tree);
+        if (profile != NULL)
+        {
+            profile->n_input += length_of_match_list(left) + length_of_match_list(right);
+        }
         if (*error_flag == false)
         {
-            if      (type == TK_OR_OP)        {matches = op_or(       left, right   );}
-            else if (type == TK_AND_OP)       {matches = op_and(      left, right   );}
+            if      (type == TK_AND_OP)       {matches = op_and(      left, right   );}
             else if (type == TK_NOT_OP)       {matches = op_not(      left, right   );}
             else if (type == TK_XOR_OP)       {matches = op_xor(      left, right   );}
             else if (type == TK_ADJ_OP)       {matches = op_adj(      left, right, n, proximity_mode);}
@@ -841,12 +1317,14 @@ eval_syntax_tree(SyntaxTree *tree, TrieNode *trie, CaseMode case_mode, unsigned
             else if (type == TK_ALONG_OP)     {matches = op_along(    left, right, n, proximity_mode);}
             else if (type == TK_WITH_OP)      {matches = op_with(     left, right, n, proximity_mode);}
             else if (type == TK_SAME_OP)      {matches = op_same(     left, right, n, proximity_mode);}
+            else if (type == TK_PAGE_OP)      {matches = op_page(     left, right, n, proximity_mode);}
             else if (type == TK_NOT_ADJ_OP)   {matches = op_not_adj(  left, right, n, proximity_mode);}
             else if (type == TK_NOT_NEAR_OP)  {matches = op_not_near( left, right, n, proximity_mode);}
             else if (type == TK_NOT_AMONG_OP) {matches = op_not_among(left, right, n, proximity_mode);}
             else if (type == TK_NOT_ALONG_OP) {matches = op_not_along(left, right, n, proximity_mode);}
             else if (type == TK_NOT_WITH_OP)  {matches = op_not_with( left, right, n, proximity_mode);}
             else if (type == TK_NOT_SAME_OP)  {matches = op_not_same( left, right, n, proximity_mode);}
+            else if (type == TK_NOT_PAGE_OP)  {matches = op_not_page( left, right, n, proximity_mode);}
             else
             {
                 *error_flag = true;
@@ -855,50 +1333,213 @@ eval_syntax_tree(SyntaxTree *tree, TrieNode *trie, CaseMode case_mode, unsigned
         }
         free_matches(left);
         free_matches(right);
+        matches = canonical_matches(collect_spilled_matches(matches));
+
+        /* Once the query has been stopped, the operands may be missing
+         * matches, which is only safe for operators that cannot lose matches
+         * because of that.  The others keep nothing, so that every match
+         * printed is a true one. */
+        if ((query_stopped() == true) && (negation_operator_token_type(type) == true))
+        {
+            free_matches(matches);
+            matches = NULL;
+        }
+    }
+
+    /* The subtree blamed for going over a limit is the innermost one that
+     * was being evaluated when the limit was reached. */
+    if ((match_limit() > 0) && (length_of_match_list(matches) > match_limit()))
+    {
+        exceed_query_limit(QL_MATCHES);
+    }
+    if ((skipped == false) && (needs_limit_subtree() == true))
+    {
+        set_limit_subtree(canonical_syntax_tree(tree));
+    }
+
+    if (profile != NULL)
+    {
+        DocumentNode *documents = document_list_match_list(matches);
+        profile->evaluated = true;
+        profile->seconds += wall_time() - start_time;
+        profile->n_output += length_of_match_list(matches);
+        profile->n_documents += length_of_document_list(documents);
+        profile->n_terms += statistic(CT_TERMS_EXPANDED) - start_terms;
+        profile->bytes += statistic(CT_ALLOCATED_BYTES) - start_bytes;
+        free_document_list(documents);
     }
     return matches;
 }
 
+/* Reports syntax errors in a query without evaluating it. */
+bool
+check_query(char *query, SearchOptions search_options)
+{
+    Token *tokens = lex_query(query, default_operator_type_search_options(search_options));
+    unsigned int n_errors = count_errors_tokens(tokens, true);
+    free_tokens(tokens);
+    if (n_errors > 0)
+    {
+        fprintf(stderr, "%s: One of more syntax errors found after tokenization\n", program_name);
+    }
+    return (n_errors == 0);
+}
+
 void
-interpret_query(char *query, TrieNode *trie, CaseMode case_mode, unsigned int edit_dist, ProximityMode proximity_mode, TokenType default_operator_type, OutputOptions options)
+interpret_query(FILE *stream, char *query, Segment *segments, size_t n_segments, TermCache *cache, SearchOptions search_options,
+                OutputOptions options)
 {
-    Token *tokens = lex_query(query, default_operator_type);
+    count_statistic(CT_QUERIES, 1);
+    double phase_start = start_phase();
+    Token *tokens = lex_query(query, default_operator_type_search_options(search_options));
     unsigned int n_errors = count_errors_tokens(tokens, true);
     if (n_errors == 0)
     {
         Token *current = tokens;
         SyntaxTree *tree = parse_query(&current);
+        end_phase(PH_PARSE, phase_start);
         if (debug_syntax_tree == true)
         {
-            print_syntax_tree(stdout, tree, true);
+            print_syntax_tree(stream, tree, true);
+        }
+        if (explain_search_options(search_options) == true)
+        {
+            init_profile_syntax_tree(tree);
         }
         bool error_flag = false;
-        Match *matches = eval_syntax_tree(tree, trie, case_mode, edit_dist, proximity_mode, &error_flag);
-        if (error_flag == false)
+        begin_cancellation(cancel_search_options(search_options), timeout_search_options(search_options),
+                           limits_search_options(search_options));
+        phase_start = start_phase();
+        Match *matches = NULL;
+
+        /* An explained query is always evaluated, so that it has a profile.
+         * Results evaluated one document at a time are printed as they are
+         * found, and never held together to be cached, unless they are
+         * ranked. */
+        char *cache_key = NULL;
+        bool cached = false;
+        bool evaluated = false;
+        bool printed = false;
+        if (by_document_search_options(search_options) == true)
+        {
+            FILE *document_stream = (top_output_options(options) > 0) ? NULL : stream;
+            end_phase(PH_EVAL, phase_start);
+            matches = eval_by_document(document_stream, tree, segments, n_segments, cache, search_options, options,
+                                       &error_flag);
+            phase_start = start_phase();
+            printed = (document_stream != NULL);
+            evaluated = true;
+        }
+        else if (explain_search_options(search_options) == false)
+        {
+            cache_key = key_result_cache(tree, search_options, segments, n_segments);
+        }
+        if (cache_key != NULL)
+        {
+            matches = find_result_cache(cache_key, &cached);
+            evaluated = cached;
+        }
+        for (size_t i = 0; (i < n_segments) && (error_flag == false) && (evaluated == false) &&
+                           (query_cancelled() == false); i++)
+        {
+            Match *segment_matches = eval_syntax_tree(tree, segments[i].trie, cache,
+                                                      case_mode_search_options(search_options),
+                                                      edit_dist_search_options(search_options), end_field,
+                                                      proximity_mode_search_options(search_options), NULL, &error_flag);
+            if (segment_matches != NULL)
+            {
+                Match *last = segment_matches;
+                while (next_match(last) != NULL)
+                {
+                    last = next_match(last);
+                }
+                last->next = matches;
+                matches = segment_matches;
+            }
+        }
+
+        /* A query stopped during evaluation still merges and prints the
+         * matches that it found, however long that takes.  Otherwise the
+         * output is stopped too once the query runs out of time.  A query
+         * that went over a limit prints nothing, and is only reported. */
+        bool over_limit = (exceeded_query_limit() != QL_NONE);
+        bool partial = query_stopped();
+        if ((partial == true) && (over_limit == false))
+        {
+            end_cancellation();
+        }
+        if ((n_segments > 1) && (evaluated == false))
+        {
+            matches = canonical_matches(matches);
+        }
+        if ((cache_key != NULL) && (cached == false) && (error_flag == false) && (partial == false))
+        {
+            store_result_cache(cache_key, matches);
+        }
+        freemem(cache_key);
+        end_phase(PH_EVAL, phase_start);
+        if (explain_search_options(search_options) == true)
+        {
+            /* Write the report in one piece so that reports from queries
+             * running on other threads are not interleaved with it. */
+            char *report = NULL;
+            size_t size = 0;
+            FILE *report_stream = open_memstream(&report, &size);
+            if (report_stream != NULL)
+            {
+                fprintf(report_stream, "%s: explain: %s\n", program_name, query);
+                print_profile_syntax_tree(report_stream, tree, 1);
+                fclose(report_stream);
+                fputs(report, stderr);
+                free(report);
+            }
+        }
+        if ((error_flag == false) && (printed == false) && (over_limit == false))
         {
+            phase_start = start_phase();
+            if (top_output_options(options) > 0)
+            {
+                matches = rank_matches(matches, top_output_options(options));
+            }
             if (type_output_options(options) == OT_DOCUMENTS)
             {
-                print_documents_in_matches(matches, options);
+                print_documents_in_matches(stream, matches, options);
             }
             else if (type_output_options(options) == OT_MATCHES)
             {
-                print_matches(matches, options);
+                print_matches(stream, matches, options);
             }
             else if (type_output_options(options) == OT_EXCERPTS)
             {
-                print_excerpts(matches, options);
+                print_excerpts(stream, matches, options);
             }
+            end_phase(PH_PRINT, phase_start);
         }
-        else
+        else if (error_flag == true)
         {
             print_syntax_tree(stderr, tree, true);
             fprintf(stderr, "%s: One or more syntax errors found during evaluation\n", program_name);
         }
+        if (exceeded_query_limit() != QL_NONE)
+        {
+            over_limit = true;
+            report_query_limit(query);
+        }
+        if (end_cancellation() == true)
+        {
+            partial = true;
+        }
+        if ((partial == true) && (error_flag == false) && (over_limit == false))
+        {
+            fprintf(stderr, "%s: Query '%s' was stopped before it finished, so its results are partial\n",
+                    program_name, query);
+        }
         free_syntax_tree(tree);
         free_matches(matches);
     }
     else
     {
+        end_phase(PH_PARSE, phase_start);
         fprintf(stderr, "%s: One of more syntax errors found after tokenization\n", program_name);
     }
     free_tokens(tokens);
@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "cancel.h"
 #include "output.h"
 #include "search.h"
 
@@ -27,17 +28,20 @@ typedef enum TokenType
     TK_ALONG_OP,
     TK_WITH_OP,
     TK_SAME_OP,
+    TK_PAGE_OP,
     TK_NOT_ADJ_OP,
     TK_NOT_NEAR_OP,
     TK_NOT_AMONG_OP,
     TK_NOT_ALONG_OP,
     TK_NOT_WITH_OP,
     TK_NOT_SAME_OP,
+    TK_NOT_PAGE_OP,
     TK_ICASE_OP,
     TK_SCASE_OP,
     TK_LCASE_OP,
     TK_UCASE_OP,
     TK_TCASE_OP,
+    TK_FIELD_OP, /* subject: */
     TK_ERROR
 } TokenType;
 
@@ -79,8 +83,47 @@ bool operator_token_type(TokenType);
 bool boolean_operator_token_type(TokenType);
 bool proximity_operator_token_type(TokenType);
 bool search_operator_token_type(TokenType);
+bool negation_operator_token_type(TokenType);
 unsigned int count_errors_tokens(Token *, bool);
 
+typedef struct SearchOptions
+{
+    CaseMode case_mode;
+    unsigned int edit_dist;
+    ProximityMode proximity_mode;
+    TokenType default_operator_type;
+    bool explain;
+    bool by_document;
+    double timeout; /* Seconds, or zero for none */
+    CancelToken *cancel;
+    QueryLimits limits;
+} SearchOptions;
+
+SearchOptions init_search_options(void);
+CaseMode case_mode_search_options(SearchOptions);
+unsigned int edit_dist_search_options(SearchOptions);
+ProximityMode proximity_mode_search_options(SearchOptions);
+TokenType default_operator_type_search_options(SearchOptions);
+bool explain_search_options(SearchOptions);
+bool by_document_search_options(SearchOptions);
+double timeout_search_options(SearchOptions);
+CancelToken *cancel_search_options(SearchOptions);
+void set_cancel_search_options(SearchOptions *, CancelToken *);
+QueryLimits limits_search_options(SearchOptions);
+
+/* The cost of evaluating a node, including its children.  Nodes only have a
+ * profile when the query is explained. */
+typedef struct SyntaxTreeProfile
+{
+    bool evaluated;
+    double seconds;
+    unsigned long n_input; /* Matches returned by the children */
+    unsigned long n_output;
+    unsigned long n_documents;
+    unsigned long n_terms; /* Dictionary entries reached while expanding */
+    size_t bytes;
+} SyntaxTreeProfile;
+
 typedef struct SyntaxTree
 {
     TokenType type;
@@ -88,6 +131,7 @@ typedef struct SyntaxTree
     char *string;
     struct SyntaxTree *left;
     struct SyntaxTree *right;
+    SyntaxTreeProfile *profile;
 } SyntaxTree;
 
 TokenType type_syntax_tree(SyntaxTree *);
@@ -98,6 +142,9 @@ SyntaxTree *right_syntax_tree(SyntaxTree *);
 
 SyntaxTree *insert_parent(TokenType, int, char *, SyntaxTree *, SyntaxTree *);
 void print_syntax_tree(FILE *, SyntaxTree *, bool);
+char *canonical_syntax_tree(SyntaxTree *);
+void init_profile_syntax_tree(SyntaxTree *);
+void print_profile_syntax_tree(FILE *, SyntaxTree *, unsigned int);
 void free_syntax_tree(SyntaxTree *);
 
 bool type_in_list(TokenType, TokenType *, size_t);
@@ -107,6 +154,7 @@ SyntaxTree *parse_query(Token **);
 SyntaxTree *parse_disjunction_op(Token **);
 SyntaxTree *parse_conjunction_op(Token **);
 SyntaxTree *parse_negation_op(Token **);
+SyntaxTree *parse_page_prox_op(Token **);
 SyntaxTree *parse_paragraph_prox_op(Token **);
 SyntaxTree *parse_sentence_prox_op(Token **);
 SyntaxTree *parse_clause_prox_op(Token **);
@@ -115,7 +163,22 @@ SyntaxTree *parse_adj_op(Token **);
 SyntaxTree *parse_search_op(Token **);
 SyntaxTree *parse_atom(Token **);
 
-Match *eval_syntax_tree(SyntaxTree *, TrieNode *, CaseMode, unsigned int, ProximityMode, bool *);
-void interpret_query(char *, TrieNode *, CaseMode, unsigned int, ProximityMode, TokenType, OutputOptions);
+/* The matches of each term of a query in one document, in the order that
+ * evaluation reaches the terms.  Evaluating a tree against them takes each
+ * one in turn instead of searching the trie. */
+typedef struct DocumentLeaves
+{
+    Match **slices;
+    size_t n_slices;
+    size_t next;
+} DocumentLeaves;
+
+CaseMode case_mode_search_operator(TokenType, CaseMode);
+unsigned int edit_dist_search_operator(SyntaxTree *, unsigned int);
+unsigned long field_search_operator(SyntaxTree *, unsigned long);
+Match *eval_syntax_tree(SyntaxTree *, TrieNode *, TermCache *, CaseMode, unsigned int, unsigned long, ProximityMode,
+                        DocumentLeaves *, bool *);
+bool check_query(char *, SearchOptions);
+void interpret_query(FILE *, char *, Segment *, size_t, TermCache *, SearchOptions, OutputOptions);
 
 #endif /* INTERPRETER_H */
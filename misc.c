@@ -1,31 +1,271 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 /* Copyright (C) 2025 Andrew Trettel */
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+/* The allocator needs the usable size of a block and an atomic counter, and
+ * neither is in C99.  This is the one place to port them: the usable size
+ * comes from the C library, and the counter uses the GCC and Clang builtins or
+ * else a mutex.  Without a usable size, nothing is counted and the memory
+ * budget never triggers. */
+#if defined(__GLIBC__) || defined(__FreeBSD__)
+#if defined(__GLIBC__)
+#include <malloc.h>
+#else
+#include <malloc_np.h>
+#endif
+#define block_size(data) malloc_usable_size(data)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define block_size(data) malloc_size(data)
+#else
+#define block_size(data) ((size_t) 0)
+#endif
+
+#include <pthread.h>
 
 #include "misc.h"
+#include "statistics.h"
+
+/* The allocator keeps track of how many bytes are in use so that evaluation
+ * can spill intermediate results to disk when the memory budget is exceeded.
+ * The count uses the usable size of each block, so blocks from other sources
+ * (like open_memstream) must still be released with free rather than freemem.
+ * The count is shared by all threads and updated atomically. */
+static size_t bytes_in_use = 0;
+static size_t memory_budget = 0; /* Zero means no budget */
+static THREAD_LOCAL size_t thread_bytes = 0; /* Requested by this thread */
+#if !defined(__GNUC__)
+static pthread_mutex_t bytes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flag_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Memory set aside so that a failed allocation can be retried.  Releasing it
+ * marks memory as short, which counts as over budget until a spill frees
+ * enough to set it aside again, so operators spill what they have before the
+ * program gives up. */
+static const size_t memory_reserve_size = 16 << 20;
+static void *memory_reserve = NULL;
+static bool memory_short = false;
+static pthread_mutex_t reserve_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Adds and removes usable sizes in one step, for reallocations. */
+static void
+add_bytes_in_use(size_t added, size_t removed)
+{
+#if defined(__GNUC__)
+    __atomic_add_fetch(&bytes_in_use, added, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&bytes_in_use, removed, __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&bytes_mutex);
+    bytes_in_use += added;
+    bytes_in_use -= removed;
+    pthread_mutex_unlock(&bytes_mutex);
+#endif
+}
+
+/* Flags shared between threads, like the cancellation of a query, are read
+ * and written atomically. */
+bool
+read_flag(const bool *flag)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+#else
+    pthread_mutex_lock(&flag_mutex);
+    bool value = *flag;
+    pthread_mutex_unlock(&flag_mutex);
+    return value;
+#endif
+}
+
+void
+write_flag(bool *flag, bool value)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(flag, value, __ATOMIC_RELEASE);
+#else
+    pthread_mutex_lock(&flag_mutex);
+    *flag = value;
+    pthread_mutex_unlock(&flag_mutex);
+#endif
+}
+
+/* Returns false if the reserve was already released. */
+static bool
+release_memory_reserve(void)
+{
+    pthread_mutex_lock(&reserve_mutex);
+    void *reserve = memory_reserve;
+    memory_reserve = NULL;
+    pthread_mutex_unlock(&reserve_mutex);
+    if (reserve == NULL)
+    {
+        return false;
+    }
+    free(reserve);
+    write_flag(&memory_short, true);
+    return true;
+}
+
+/* Sets the reserve aside, at startup and again after each spill. */
+void
+reserve_memory(void)
+{
+    pthread_mutex_lock(&reserve_mutex);
+    if (memory_reserve == NULL)
+    {
+        memory_reserve = malloc(memory_reserve_size);
+    }
+    if (memory_reserve != NULL)
+    {
+        write_flag(&memory_short, false);
+    }
+    pthread_mutex_unlock(&reserve_mutex);
+}
 
 void *
 allocmem(size_t len, size_t size)
 {
     void *tmp = malloc(len * size);
+    if ((tmp == NULL) && (release_memory_reserve() == true))
+    {
+        tmp = malloc(len * size);
+    }
     if (tmp == NULL)
     {
         fprintf(stderr, "%s: error allocating memory\n", program_name);
         exit(EXIT_FAILURE);
     }
+    add_bytes_in_use(block_size(tmp), 0);
+    thread_bytes += len * size;
+    count_statistic(CT_ALLOCATIONS, 1);
+    count_statistic(CT_ALLOCATED_BYTES, len * size);
     return tmp;
 }
 
 void *
 reallocmem(void *data, size_t len)
 {
+    /* Reallocations count the full new length, since the old length is not
+     * known here. */
+    size_t old_size = (data == NULL) ? 0 : block_size(data);
     void *tmp = realloc(data, len);
+    if ((tmp == NULL) && (release_memory_reserve() == true))
+    {
+        tmp = realloc(data, len);
+    }
     if (tmp == NULL)
     {
         fprintf(stderr, "%s: error reallocating memory\n", program_name);
         exit(EXIT_FAILURE);
     }
+    add_bytes_in_use(block_size(tmp), old_size);
+    thread_bytes += len;
+    count_statistic(CT_ALLOCATIONS, 1);
+    count_statistic(CT_ALLOCATED_BYTES, len);
     return tmp;
 }
+
+void
+freemem(void *data)
+{
+    if (data != NULL)
+    {
+        add_bytes_in_use(0, block_size(data));
+        free(data);
+    }
+}
+
+size_t
+memory_in_use(void)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(&bytes_in_use, __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&bytes_mutex);
+    size_t n = bytes_in_use;
+    pthread_mutex_unlock(&bytes_mutex);
+    return n;
+#endif
+}
+
+/* Bytes allocated by the current thread so far, counted as in the
+ * statistics. */
+size_t
+thread_bytes_allocated(void)
+{
+    return thread_bytes;
+}
+
+void
+set_memory_budget(size_t budget)
+{
+    memory_budget = budget;
+}
+
+bool
+memory_over_budget(void)
+{
+    if (read_flag(&memory_short) == true)
+    {
+        return true;
+    }
+    return ((memory_budget != 0) && (memory_in_use() > memory_budget));
+}
+
+/* Sizes are a number of bytes with an optional K, M, or G suffix.  Returns
+ * false if the string is not a valid size, including a negative one or one
+ * too large for a size_t. */
+bool
+parse_memory_size(const char *string, size_t *size)
+{
+    if (isdigit((unsigned char) string[0]) == 0)
+    {
+        return false;
+    }
+    char *endptr;
+    errno = 0;
+    unsigned long long n = strtoull(string, &endptr, 10);
+    if (errno == ERANGE)
+    {
+        return false;
+    }
+    unsigned int shift = 0;
+    if ((*endptr == 'k') || (*endptr == 'K'))
+    {
+        shift = 10;
+        endptr++;
+    }
+    else if ((*endptr == 'm') || (*endptr == 'M'))
+    {
+        shift = 20;
+        endptr++;
+    }
+    else if ((*endptr == 'g') || (*endptr == 'G'))
+    {
+        shift = 30;
+        endptr++;
+    }
+    if ((*endptr != '\0') || (n > ((unsigned long long) SIZE_MAX >> shift)))
+    {
+        return false;
+    }
+    *size = (size_t) (n << shift);
+    return true;
+}
+
+/* Seconds on a monotonic clock, for measuring intervals only. */
+double
+wall_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + 1.0e-9 * (double) now.tv_nsec;
+}
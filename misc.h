@@ -3,12 +3,32 @@
 #ifndef MISC_H
 #define MISC_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+/* Storage with one copy per thread.  C11 spells this _Thread_local; older
+ * compilers need the __thread extension, which GCC and Clang accept.  This is
+ * the only place to change for a compiler with another spelling. */
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 static const char program_name[]    = "wosp";
 static const char program_version[] = "0.0.0";
 
+bool read_flag(const bool *);
+void write_flag(bool *, bool);
+void reserve_memory(void);
 void *allocmem(size_t, size_t);
 void *reallocmem(void *, size_t);
+void freemem(void *);
+size_t memory_in_use(void);
+size_t thread_bytes_allocated(void);
+void set_memory_budget(size_t);
+bool memory_over_budget(void);
+bool parse_memory_size(const char *, size_t *);
+double wall_time(void);
 
 #endif /* MISC_H */
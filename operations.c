@@ -4,29 +4,33 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "cancel.h"
+#include "misc.h"
 #include "operations.h"
 #include "search.h"
+#include "spill.h"
+#include "statistics.h"
 #include "words.h"
 
 static Match *
 op_boolean(Match *first_match, Match *second_match, bool condition(DocumentNode *, DocumentNode *, Word *))
 {
     Match *match = NULL;
+    unsigned long n_unspilled = 0;
     DocumentNode *first_documents = document_list_match_list(first_match);
     DocumentNode *second_documents = document_list_match_list(second_match);
-    bool processed_first = false;
-    MatchIterator iterator = init_match_iterator(first_match);
-    while (iterator_has_next_match(iterator) == true)
+    Match *operands[2] = {first_match, second_match};
+    for (size_t i = 0; i < 2; i++)
     {
-        Match *current_match = iterator_next_match(&iterator);
-        if (condition(first_documents, second_documents, document_match(current_match)) == true)
+        MatchIterator iterator = init_match_iterator(operands[i]);
+        while (iterator_has_next_match(iterator) == true)
         {
-            append_match(current_match, &match);
-        }
-        if ((iterator_has_next_match(iterator) == false) && (processed_first == false))
-        {
-            processed_first = true;
-            iterator = init_match_iterator(second_match);
+            Match *current_match = iterator_next_match(&iterator);
+            if (condition(first_documents, second_documents, document_match(current_match)) == true)
+            {
+                append_match(current_match, &match);
+                spill_if_over_budget(&match, &n_unspilled);
+            }
         }
     }
     free_document_list(first_documents);
@@ -34,13 +38,21 @@ op_boolean(Match *first_match, Match *second_match, bool condition(DocumentNode
     return match;
 }
 
+/* Both operands are canonical, so they are merged in order in one pass, and
+ * an occurrence found by both is kept once. */
 Match *
 op_or(Match *first_match, Match *second_match)
 {
-    Match *match = NULL;
-    concatenate_matches(first_match, &match);
-    concatenate_matches(second_match, &match);
-    return match;
+    Match *operands[2] = {first_match, second_match};
+    return op_union(operands, 2);
+}
+
+/* The union of a chain of ORs, such as a OR b OR c, merges every operand at
+ * once instead of copying the matches of the first ones again at each OR. */
+Match *
+op_union(Match **operands, size_t n_operands)
+{
+    return union_matches(operands, n_operands, false);
 }
 
 static bool
@@ -146,43 +158,93 @@ op_same(Match *first_match, Match *second_match, int n, ProximityMode proximity_
     return proximity_search(first_match, second_match, LE_PARAGRAPH, -n, +n, proximity_mode);
 }
 
+Match *
+op_page(Match *first_match, Match *second_match, int n, ProximityMode proximity_mode)
+{
+    assert(n > 0);
+    return proximity_search(first_match, second_match, LE_PAGE, -n, +n, proximity_mode);
+}
+
+/* A word of a document, as a key that sorts by document and position. */
+typedef struct WordKey
+{
+    unsigned long id;
+    unsigned long position;
+} WordKey;
+
+static int
+compare_word_keys(const void *a, const void *b)
+{
+    const WordKey *first = (const WordKey *) a;
+    const WordKey *second = (const WordKey *) b;
+    if (first->id != second->id)
+    {
+        return (first->id < second->id) ? -1 : +1;
+    }
+    if (first->position != second->position)
+    {
+        return (first->position < second->position) ? -1 : +1;
+    }
+    return 0;
+}
+
+static WordKey
+key_word(Word *word)
+{
+    WordKey key = {document_id_word(word), position_word(word)};
+    return key;
+}
+
+/* Keeps the matches of either operand that share no word with a match of the
+ * proximity operator.  The words of those matches are sorted once, so each
+ * word is looked up rather than compared with every match. */
 static Match *
 op_not_prox(Match *first_match, Match *second_match, int n, Match *op_prox(Match *, Match *, int, ProximityMode), ProximityMode proximity_mode)
 {
-    Match *union_match = op_or(first_match, second_match);
-    Match *prox_match = op_prox(first_match, second_match, n, proximity_mode);
+    /* Collect what the inner operations spilled before this one spills its
+     * own output. */
+    Match *union_match = collect_spilled_matches(op_or(first_match, second_match));
+    Match *prox_match = collect_spilled_matches(op_prox(first_match, second_match, n, proximity_mode));
+    size_t n_keys = 0;
+    MatchIterator inner_iterator = init_match_iterator(prox_match);
+    while (iterator_has_next_match(inner_iterator) == true)
+    {
+        n_keys += number_of_words_in_match(iterator_next_match(&inner_iterator));
+    }
+    WordKey *keys = (WordKey *) allocmem((n_keys == 0) ? 1 : n_keys, sizeof(WordKey));
+    size_t k = 0;
+    inner_iterator = init_match_iterator(prox_match);
+    while (iterator_has_next_match(inner_iterator) == true)
+    {
+        Match *inner_match = iterator_next_match(&inner_iterator);
+        for (size_t j = 0; j < number_of_words_in_match(inner_match); j++)
+        {
+            keys[k++] = key_word(word_match(inner_match, j));
+        }
+    }
+    qsort(keys, n_keys, sizeof(WordKey), compare_word_keys);
+
     Match *match = NULL;
+    unsigned long n_unspilled = 0;
     MatchIterator outer_iterator = init_match_iterator(union_match);
-    while (iterator_has_next_match(outer_iterator) == true)
+    while ((iterator_has_next_match(outer_iterator) == true) && (query_cancelled() == false))
     {
         Match *outer_match = iterator_next_match(&outer_iterator);
         size_t n_outer = number_of_words_in_match(outer_match);
         bool found = false;
-        MatchIterator inner_iterator = init_match_iterator(prox_match);
-        while (iterator_has_next_match(inner_iterator) == true)
+        for (size_t i = 0; (i < n_outer) && (found == false); i++)
         {
-            Match *inner_match = iterator_next_match(&inner_iterator);
-            size_t n_inner = number_of_words_in_match(inner_match);
-            for (size_t i = 0; i < n_outer; i++)
-            {
-                for (size_t j = 0; j < n_inner; j++)
-                {
-                    if (word_match(outer_match, i) == word_match(inner_match, j))
-                    {
-                        found = true;
-                    }
-                }
-            }
+            WordKey key = key_word(word_match(outer_match, i));
+            count_statistic(CT_PROXIMITY_PAIRS, 1);
+            found = (bsearch(&key, keys, n_keys, sizeof(WordKey), compare_word_keys) != NULL);
         }
         if (found == false)
         {
-            insert_match(&match, n_outer);
-            for (size_t i = 0; i < n_outer; i++)
-            {
-                set_match(match, i, word_match(outer_match, i));
-            }
+            append_match(outer_match, &match);
+            spill_if_over_budget(&match, &n_unspilled);
         }
     }
+    freemem(keys);
     free_matches(union_match);
     free_matches(prox_match);
     return match;
@@ -223,3 +285,9 @@ op_not_same(Match *first_match, Match *second_match, int n, ProximityMode proxim
 {
     return op_not_prox(first_match, second_match, n, op_same, proximity_mode);
 }
+
+Match *
+op_not_page(Match *first_match, Match *second_match, int n, ProximityMode proximity_mode)
+{
+    return op_not_prox(first_match, second_match, n, op_page, proximity_mode);
+}
@@ -6,6 +6,7 @@
 #include "search.h"
 
 Match *op_or(Match *, Match *);
+Match *op_union(Match **, size_t);
 Match *op_and(Match *, Match *);
 Match *op_not(Match *, Match *);
 Match *op_xor(Match *, Match *);
@@ -16,6 +17,7 @@ Match *op_among(Match *, Match *, int, ProximityMode);
 Match *op_along(Match *, Match *, int, ProximityMode);
 Match *op_with( Match *, Match *, int, ProximityMode);
 Match *op_same( Match *, Match *, int, ProximityMode);
+Match *op_page( Match *, Match *, int, ProximityMode);
 
 Match *op_not_adj(  Match *, Match *, int, ProximityMode);
 Match *op_not_near( Match *, Match *, int, ProximityMode);
@@ -23,5 +25,6 @@ Match *op_not_among(Match *, Match *, int, ProximityMode);
 Match *op_not_along(Match *, Match *, int, ProximityMode);
 Match *op_not_with( Match *, Match *, int, ProximityMode);
 Match *op_not_same( Match *, Match *, int, ProximityMode);
+Match *op_not_page( Match *, Match *, int, ProximityMode);
 
 #endif /* OPERATIONS_H */
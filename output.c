@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cancel.h"
 #include "misc.h"
 #include "output.h"
 #include "search.h"
@@ -24,6 +25,7 @@ OutputOptions init_output_options(void)
     options.page_number = false;
     options.count_matches = false;
     options.maximum = UINT_MAX;
+    options.top = 0;
     options.type = OT_EXCERPTS;
     return options;
 }
@@ -68,17 +70,61 @@ unsigned int maximum_output_options(OutputOptions options)
     return options.maximum;
 }
 
+unsigned int top_output_options(OutputOptions options)
+{
+    return options.top;
+}
+
 OutputType type_output_options(OutputOptions options)
 {
     return options.type;
 }
 
+/* A shard worker records where each unit of output ends so that the
+ * coordinator can apply the maximum to the output of all shards together. */
+static THREAD_LOCAL OutputUnits *output_units = NULL;
+
 void
-print_matches(Match *match, OutputOptions options)
+record_output_units(OutputUnits *units)
+{
+    output_units = units;
+    if (units != NULL)
+    {
+        units->ends = NULL;
+        units->n_units = 0;
+    }
+}
+
+static void
+end_output_unit(FILE *stream)
+{
+    if (output_units != NULL)
+    {
+        fflush(stream);
+        output_units->ends = (size_t *) reallocmem(output_units->ends, (output_units->n_units + 1) * sizeof(size_t));
+        output_units->ends[output_units->n_units] = (size_t) ftello(stream);
+        output_units->n_units++;
+    }
+}
+
+/* A record is named by its file and its number, as in "mail.mbox#12". */
+static void
+print_filename(FILE *stream, Word *word)
+{
+    fprintf(stream, "%s", filename_word(word));
+    if (record_word(word) > 0)
+    {
+        fprintf(stream, "#%lu", record_word(word));
+    }
+}
+
+unsigned int
+print_matches(FILE *stream, Match *match, OutputOptions options)
 {
     unsigned int output_count = 0;
     MatchIterator match_iterator = init_match_iterator(match);
-    while ((iterator_has_next_match(match_iterator) == true) && (output_count < maximum_output_options(options)))
+    while ((iterator_has_next_match(match_iterator) == true) && (output_count < maximum_output_options(options)) &&
+           (query_cancelled() == false))
     {
         Match *current_match = iterator_next_match(&match_iterator);
         LanguageElement print_element = element_output_options(options);
@@ -92,15 +138,16 @@ print_matches(Match *match, OutputOptions options)
         Word   *end_word = advance_word(  end_word_match(current_match), print_element,   end_n);
         if (filename_output_options(options) == true)
         {
-            printf("%s:", filename_word(start_word));
+            print_filename(stream, start_word);
+            fprintf(stream, ":");
         }
         if (page_number_output_options(options) == true)
         {
-            printf("%lu:", page_word(start_word));
+            fprintf(stream, "%lu:", page_word(start_word));
         }
         if (line_number_output_options(options) == true)
         {
-            printf("%lu:", line_word(start_word));
+            fprintf(stream, "%lu:", line_word(start_word));
         }
         Word *current_word = start_word;
         WordIterator word_iterator = init_word_iterator(start_word, next_word, true);
@@ -109,25 +156,28 @@ print_matches(Match *match, OutputOptions options)
             current_word = iterator_next_word(&word_iterator);
             if (current_word != start_word)
             {
-                printf(" ");
+                fprintf(stream, " ");
             }
-            printf("%s", original_word(current_word));
+            fprintf(stream, "%s", original_word(current_word));
         }
-        printf("\n");
+        fprintf(stream, "\n");
         output_count++;
+        end_output_unit(stream);
     }
+    return output_count;
 }
 
-void
-print_documents_in_matches(Match *match, OutputOptions options)
+unsigned int
+print_documents_in_matches(FILE *stream, Match *match, OutputOptions options)
 {
     unsigned int output_count = 0;
     DocumentNode *documents = document_list_match_list(match);
     DocumentIterator document_iterator = init_document_iterator(documents);
-    while ((iterator_has_next_document(document_iterator) == true) && (output_count < maximum_output_options(options)))
+    while ((iterator_has_next_document(document_iterator) == true) && (output_count < maximum_output_options(options)) &&
+           (query_cancelled() == false))
     {
         DocumentNode *current = iterator_next_document(&document_iterator);
-        printf("%s", filename_document(current));
+        print_filename(stream, document_document(current));
         if (count_matches_output_options(options) == true)
         {
             unsigned long count = 0;
@@ -140,132 +190,182 @@ print_documents_in_matches(Match *match, OutputOptions options)
                     count++;
                 }
             }
-            printf(":%lu", count);
+            fprintf(stream, ":%lu", count);
         }
-        printf("\n");
+        fprintf(stream, "\n");
         output_count++;
+        end_output_unit(stream);
     }
     free_document_list(documents);
+    return output_count;
 }
 
-void
-print_excerpts(Match *match, OutputOptions options)
+/* Marks each word of a document that is part of a match or within the
+ * context of one.  The array is indexed by position - 1. */
+static ExcerptStatus *
+mark_excerpt_words(Match *match, Word *document, Word *words, size_t n_words, OutputOptions options)
 {
-    unsigned int output_count = 0;
-    DocumentNode *documents = document_list_match_list(match);
-    DocumentIterator document_iterator = init_document_iterator(documents);
-    while ((iterator_has_next_document(document_iterator) == true) && (output_count < maximum_output_options(options)))
+    ExcerptStatus *word_print = (ExcerptStatus *) allocmem(n_words, sizeof(ExcerptStatus));
+    for (size_t i = 0; i < n_words; i++)
     {
-        DocumentNode *current_document = iterator_next_document(&document_iterator);
-        Word *words = list_first_word(document_document(current_document));
-        size_t n_words = (size_t) position_word(list_last_word(words));
-
-        ExcerptStatus *word_print = (ExcerptStatus *) allocmem(n_words, sizeof(ExcerptStatus));
-        for (size_t i = 0; i < n_words; i++)
-        {
-            word_print[i] = ES_EXCLUDE;
-        }
-        MatchIterator match_iterator = init_match_iterator(match);
-        while (iterator_has_next_match(match_iterator) == true)
+        word_print[i] = ES_EXCLUDE;
+    }
+    MatchIterator match_iterator = init_match_iterator(match);
+    while (iterator_has_next_match(match_iterator) == true)
+    {
+        Match *current_match = iterator_next_match(&match_iterator);
+        if (document_match(current_match) == document)
         {
-            Match *current_match = iterator_next_match(&match_iterator);
-            if (document_match(current_match) == document_document(current_document))
+            size_t n_match = number_of_words_in_match(current_match);
+            for (size_t i = 0; i < n_match; i++)
             {
-                size_t n_match = number_of_words_in_match(current_match);
-                for (size_t i = 0; i < n_match; i++)
-                {
-                    Word *current_word = word_match(current_match, i);
-                    word_print[(size_t) position_word(current_word) - 1] = ES_MATCH;
-                }
+                Word *current_word = word_match(current_match, i);
+                word_print[(size_t) position_word(current_word) - 1] = ES_MATCH;
             }
         }
+    }
 
-        Word *current_word = words;
-        for (size_t i = 0; i < n_words; i++)
+    Word *current_word = words;
+    for (size_t i = 0; i < n_words; i++)
+    {
+        if (word_print[i] == ES_MATCH)
         {
-            if (word_print[i] == ES_MATCH)
+            Word *start_word = advance_word(current_word, element_output_options(options), -before_output_options(options));
+            Word *end_word   = advance_word(current_word, element_output_options(options),  +after_output_options(options));
+            size_t i_start = (size_t) position_word(start_word) - 1;
+            size_t i_end   = (size_t) position_word(end_word)   - 1;
+            for (size_t j = i_start; j < i_end; j++)
             {
-                Word *start_word = advance_word(current_word, element_output_options(options), -before_output_options(options));
-                Word *end_word   = advance_word(current_word, element_output_options(options),  +after_output_options(options));
-                size_t i_start = (size_t) position_word(start_word) - 1;
-                size_t i_end   = (size_t) position_word(end_word)   - 1;
-                for (size_t j = i_start; j < i_end; j++)
+                if (word_print[j] == ES_EXCLUDE)
                 {
-                    if (word_print[j] == ES_EXCLUDE)
-                    {
-                        word_print[j] = ES_INCLUDE;
-                    }
+                    word_print[j] = ES_INCLUDE;
                 }
             }
-            current_word = next_word(current_word);
         }
+        current_word = next_word(current_word);
+    }
+    return word_print;
+}
+
+ExcerptState
+init_excerpt_state(void)
+{
+    ExcerptState state;
+    state.printing = false;
+    state.n_excerpts = 0;
+    state.n_output = 0;
+    return state;
+}
+
+static void
+end_excerpt(FILE *stream, ExcerptState *state, OutputOptions options)
+{
+    if (state->printing == true)
+    {
+        if (count_matches_output_options(options) == true)
+        {
+            state->n_excerpts++;
+        }
+        else
+        {
+            fprintf(stream, "\n");
+        }
+        state->n_output++;
+        end_output_unit(stream);
+    }
+    state->printing = false;
+}
 
-        Word *start_word = words;
-        bool prev_print = false;
-        unsigned int excerpt_count = 0;
-        WordIterator word_iterator = init_word_iterator(words, next_word, false);
-        while (iterator_has_next_word(word_iterator) == true)
+/* Prints the marked words from first to last, or to the end of the document
+ * when last is NULL.  An excerpt that is still open at last is continued by
+ * the next call. */
+static void
+print_excerpt_words(FILE *stream, Word *first, Word *last, ExcerptStatus *word_print, ExcerptState *state,
+                    OutputOptions options)
+{
+    bool done = false;
+    WordIterator word_iterator = init_word_iterator(first, next_word, false);
+    while ((done == false) && (iterator_has_next_word(word_iterator) == true))
+    {
+        Word *current_word = iterator_next_word(&word_iterator);
+        done = (current_word == last);
+        size_t i = (size_t) position_word(current_word) - 1;
+        if (word_print[i] == ES_EXCLUDE)
         {
-            current_word = iterator_next_word(&word_iterator);
-            size_t i = (size_t) position_word(current_word) - 1;
-            if (word_print[i] == ES_EXCLUDE)
+            end_excerpt(stream, state, options);
+        }
+        else
+        {
+            if (count_matches_output_options(options) == true)
             {
-                if (prev_print == true)
-                {
-                    if (count_matches_output_options(options) == true)
-                    {
-                        excerpt_count++;
-                    }
-                    else
-                    {
-                        printf("\n");
-                    }
-                    output_count++;
-                }
-                prev_print = false;
+                state->printing = true;
             }
             else
             {
-                if (count_matches_output_options(options) == true)
+                if (state->printing == false)
                 {
-                    if (prev_print == false)
+                    if (filename_output_options(options) == true)
                     {
-                        prev_print = true;
+                        print_filename(stream, current_word);
+                        fprintf(stream, ":");
                     }
-                }
-                else
-                {
-                    if (prev_print == false)
+                    if (page_number_output_options(options) == true)
                     {
-                        if (filename_output_options(options) == true)
-                        {
-                            printf("%s:", filename_word(current_word));
-                        }
-                        if (page_number_output_options(options) == true)
-                        {
-                            printf("%lu:", page_word(current_word));
-                        }
-                        if (line_number_output_options(options) == true)
-                        {
-                            printf("%lu:", line_word(current_word));
-                        }
-                        start_word = current_word;
-                        prev_print = true;
+                        fprintf(stream, "%lu:", page_word(current_word));
                     }
-                    if (current_word != start_word)
+                    if (line_number_output_options(options) == true)
                     {
-                        printf(" ");
+                        fprintf(stream, "%lu:", line_word(current_word));
                     }
-                    printf("%s", original_word(current_word));
+                    fprintf(stream, "%s", original_word(current_word));
+                    state->printing = true;
+                }
+                else
+                {
+                    fprintf(stream, " %s", original_word(current_word));
                 }
             }
         }
+    }
+}
 
+unsigned int
+print_excerpts(FILE *stream, Match *match, OutputOptions options)
+{
+    unsigned int output_count = 0;
+    DocumentNode *documents = document_list_match_list(match);
+    DocumentIterator document_iterator = init_document_iterator(documents);
+    while ((iterator_has_next_document(document_iterator) == true) && (output_count < maximum_output_options(options)) &&
+           (query_cancelled() == false))
+    {
+        DocumentNode *current_document = iterator_next_document(&document_iterator);
+        Word *words = list_first_word(document_document(current_document));
+        size_t n_words = (size_t) position_word(list_last_word(words));
+        ExcerptStatus *word_print = mark_excerpt_words(match, document_document(current_document), words, n_words,
+                                                       options);
+        ExcerptState state = init_excerpt_state();
+        print_excerpt_words(stream, words, NULL, word_print, &state, options);
+        end_excerpt(stream, &state, options);
+        output_count += state.n_output;
         if (count_matches_output_options(options) == true)
         {
-            printf("%s:%u\n", filename_document(current_document), excerpt_count);
+            print_filename(stream, document_document(current_document));
+            fprintf(stream, ":%u\n", state.n_excerpts);
         }
-        free(word_print);
+        freemem(word_print);
     }
     free_document_list(documents);
+    return output_count;
+}
+
+/* Prints the excerpts of the words from first to last of a window of a
+ * stream.  The words around them in the window give the context. */
+void
+print_excerpts_window(FILE *stream, Match *match, Word *first, Word *last, ExcerptState *state, OutputOptions options)
+{
+    Word *words = list_first_word(first);
+    size_t n_words = (size_t) position_word(list_last_word(words));
+    ExcerptStatus *word_print = mark_excerpt_words(match, document_word(first), words, n_words, options);
+    print_excerpt_words(stream, first, last, word_print, state, options);
+    freemem(word_print);
 }
@@ -3,6 +3,8 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
+#include <stdio.h>
+
 #include "search.h"
 
 typedef enum OutputType
@@ -22,6 +24,7 @@ typedef struct OutputOptions
     bool page_number;
     bool count_matches;
     unsigned int maximum;
+    unsigned int top; /* Rank the documents and keep this many, or 0 */
     OutputType type;
 } OutputOptions;
 
@@ -34,6 +37,7 @@ bool line_number_output_options(OutputOptions);
 bool page_number_output_options(OutputOptions);
 bool count_matches_output_options(OutputOptions);
 unsigned int maximum_output_options(OutputOptions);
+unsigned int top_output_options(OutputOptions);
 OutputType type_output_options(OutputOptions);
 
 typedef enum ExcerptStatus
@@ -43,8 +47,29 @@ typedef enum ExcerptStatus
     ES_MATCH,
 } ExcerptStatus;
 
-void print_matches(Match *, OutputOptions);
-void print_documents_in_matches(Match *, OutputOptions);
-void print_excerpts(Match *, OutputOptions);
+/* Offsets in the output stream just past the end of each excerpt, match, or
+ * document printed. */
+typedef struct OutputUnits
+{
+    size_t *ends;
+    size_t n_units;
+} OutputUnits;
+
+/* Excerpts of a stream are printed one window at a time, and one may continue
+ * from one window into the next. */
+typedef struct ExcerptState
+{
+    bool printing;
+    unsigned int n_excerpts;
+    unsigned int n_output;
+} ExcerptState;
+
+void record_output_units(OutputUnits *);
+/* Each returns the number of units of output that it printed. */
+unsigned int print_matches(FILE *, Match *, OutputOptions);
+unsigned int print_documents_in_matches(FILE *, Match *, OutputOptions);
+unsigned int print_excerpts(FILE *, Match *, OutputOptions);
+ExcerptState init_excerpt_state(void);
+void print_excerpts_window(FILE *, Match *, Word *, Word *, ExcerptState *, OutputOptions);
 
 #endif /* OUTPUT_H */
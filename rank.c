@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "misc.h"
+#include "rank.h"
+#include "search.h"
+#include "words.h"
+
+static double
+bound_matches(unsigned long n_matches)
+{
+    return 2.0 * (double) n_matches;
+}
+
+static double
+bound_ranked_document(RankedDocument *document)
+{
+    return bound_matches(document->n_matches);
+}
+
+static double
+score_ranked_document(RankedDocument *document)
+{
+    double score = 0.0;
+    Match *current = document->first;
+    while (current != NULL)
+    {
+        score += 1.0 + 1.0 / (double) width_match(current);
+        current = (current == document->last) ? NULL : next_match(current);
+    }
+    return score;
+}
+
+/* The score of a list of matches of one document. */
+double
+score_matches(Match *matches)
+{
+    double score = 0.0;
+    MatchIterator iterator = init_match_iterator(matches);
+    while (iterator_has_next_match(iterator) == true)
+    {
+        score += 1.0 + 1.0 / (double) width_match(iterator_next_match(&iterator));
+    }
+    return score;
+}
+
+void
+init_top_scores(TopScores *top, unsigned int k)
+{
+    top->scores = (double *) allocmem((k == 0) ? 1 : k, sizeof(double));
+    top->n_scores = 0;
+    top->k = k;
+}
+
+/* Whether a document with at most n_matches matches could rank among the
+ * best K.  Documents are evaluated in order, so one that ties the lowest
+ * score kept ranks below it. */
+bool
+could_enter_top_scores(TopScores *top, unsigned long n_matches)
+{
+    return ((top->n_scores < top->k) || (bound_matches(n_matches) > top->scores[0]));
+}
+
+void
+add_top_score(TopScores *top, double score)
+{
+    double *heap = top->scores;
+    size_t i = 0;
+    if (top->n_scores < top->k)
+    {
+        i = top->n_scores++;
+        heap[i] = score;
+        while ((i > 0) && (heap[i] < heap[(i-1)/2]))
+        {
+            double tmp = heap[i];
+            heap[i] = heap[(i-1)/2];
+            heap[(i-1)/2] = tmp;
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if ((top->k == 0) || (score <= heap[0]))
+    {
+        return;
+    }
+    heap[0] = score;
+    while (true)
+    {
+        size_t lowest = i;
+        size_t left = 2 * i + 1;
+        size_t right = 2 * i + 2;
+        if ((left < top->n_scores) && (heap[left] < heap[lowest]))
+        {
+            lowest = left;
+        }
+        if ((right < top->n_scores) && (heap[right] < heap[lowest]))
+        {
+            lowest = right;
+        }
+        if (lowest == i)
+        {
+            break;
+        }
+        double tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+void
+free_top_scores(TopScores *top)
+{
+    freemem(top->scores);
+    top->scores = NULL;
+}
+
+/* Whether the first document ranks below the second.  Ties go to the earlier
+ * document. */
+static bool
+ranks_below(RankedDocument *first, RankedDocument *second)
+{
+    if (first->score != second->score)
+    {
+        return (first->score < second->score);
+    }
+    return (first->id > second->id);
+}
+
+static int
+compare_bounds(const void *a, const void *b)
+{
+    RankedDocument *first = (RankedDocument *) a;
+    RankedDocument *second = (RankedDocument *) b;
+    if (first->n_matches != second->n_matches)
+    {
+        return (first->n_matches > second->n_matches) ? -1 : +1;
+    }
+    return (first->id < second->id) ? -1 : +1;
+}
+
+static int
+compare_ranks(const void *a, const void *b)
+{
+    RankedDocument *first = *((RankedDocument **) a);
+    RankedDocument *second = *((RankedDocument **) b);
+    return (ranks_below(first, second) == true) ? +1 : -1;
+}
+
+/* The heap keeps the lowest ranked of the documents kept at its root. */
+static void
+sift_down(RankedDocument **heap, size_t n, size_t i)
+{
+    while (true)
+    {
+        size_t lowest = i;
+        size_t left = 2 * i + 1;
+        size_t right = 2 * i + 2;
+        if ((left < n) && (ranks_below(heap[left], heap[lowest]) == true))
+        {
+            lowest = left;
+        }
+        if ((right < n) && (ranks_below(heap[right], heap[lowest]) == true))
+        {
+            lowest = right;
+        }
+        if (lowest == i)
+        {
+            break;
+        }
+        RankedDocument *tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+static void
+sift_up(RankedDocument **heap, size_t i)
+{
+    while ((i > 0) && (ranks_below(heap[i], heap[(i-1)/2]) == true))
+    {
+        RankedDocument *tmp = heap[i];
+        heap[i] = heap[(i-1)/2];
+        heap[(i-1)/2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+/* Returns the matches of the k best documents, best first, and frees the
+ * rest.  The matches must be canonical, so that those of each document are
+ * together. */
+Match *
+rank_matches(Match *matches, unsigned int k)
+{
+    RankedDocument *documents = NULL;
+    size_t n_documents = 0;
+    size_t capacity = 0;
+    Match *current = matches;
+    while (current != NULL)
+    {
+        unsigned long id = document_id_word(document_match(current));
+        if ((n_documents == 0) || (documents[n_documents-1].id != id))
+        {
+            if (n_documents == capacity)
+            {
+                capacity = (capacity == 0) ? 64 : 2 * capacity;
+                documents = (RankedDocument *) reallocmem(documents, capacity * sizeof(RankedDocument));
+            }
+            documents[n_documents].id = id;
+            documents[n_documents].first = current;
+            documents[n_documents].n_matches = 0;
+            documents[n_documents].score = 0.0;
+            n_documents++;
+        }
+        documents[n_documents-1].last = current;
+        documents[n_documents-1].n_matches++;
+        current = next_match(current);
+    }
+    for (size_t i = 0; i < n_documents; i++)
+    {
+        documents[i].last->next = NULL;
+    }
+    qsort(documents, n_documents, sizeof(RankedDocument), compare_bounds);
+
+    size_t n_kept = 0;
+    size_t n_heap = ((size_t) k < n_documents) ? (size_t) k : n_documents;
+    RankedDocument **heap = (RankedDocument **) allocmem((n_heap == 0) ? 1 : n_heap, sizeof(RankedDocument *));
+    for (size_t i = 0; i < n_documents; i++)
+    {
+        if ((n_kept == n_heap) &&
+            ((n_heap == 0) || (bound_ranked_document(&(documents[i])) < heap[0]->score)))
+        {
+            break;
+        }
+        documents[i].score = score_ranked_document(&(documents[i]));
+        if (n_kept < n_heap)
+        {
+            heap[n_kept] = &(documents[i]);
+            sift_up(heap, n_kept);
+            n_kept++;
+        }
+        else if (ranks_below(heap[0], &(documents[i])) == true)
+        {
+            heap[0] = &(documents[i]);
+            sift_down(heap, n_kept, 0);
+        }
+    }
+
+    qsort(heap, n_kept, sizeof(RankedDocument *), compare_ranks);
+    Match *ranked = NULL;
+    Match *last = NULL;
+    for (size_t j = 0; j < n_kept; j++)
+    {
+        if (last == NULL)
+        {
+            ranked = heap[j]->first;
+        }
+        else
+        {
+            last->next = heap[j]->first;
+        }
+        last = heap[j]->last;
+        heap[j]->first = NULL;
+    }
+    for (size_t j = 0; j < n_documents; j++)
+    {
+        free_matches(documents[j].first);
+    }
+    freemem(heap);
+    freemem(documents);
+    return ranked;
+}
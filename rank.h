@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef RANK_H
+#define RANK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "search.h"
+
+/* Each match scores one point plus a bonus for tightness of 1 / width, so a
+ * document scores at most two points per match.  Documents are scored in
+ * order of that bound, and scoring stops once no document left can beat the
+ * worst one kept. */
+typedef struct RankedDocument
+{
+    unsigned long id;
+    Match *first; /* The matches of the document */
+    Match *last;
+    unsigned long n_matches;
+    double score;
+} RankedDocument;
+
+/* The K best scores of the documents evaluated so far, lowest at the root,
+ * so that evaluation one document at a time can pass over a document whose
+ * bound cannot beat the lowest of them. */
+typedef struct TopScores
+{
+    double *scores;
+    size_t n_scores;
+    size_t k;
+} TopScores;
+
+Match *rank_matches(Match *, unsigned int);
+double score_matches(Match *);
+void init_top_scores(TopScores *, unsigned int);
+bool could_enter_top_scores(TopScores *, unsigned long);
+void add_top_score(TopScores *, double);
+void free_top_scores(TopScores *);
+
+#endif /* RANK_H */
@@ -7,24 +7,138 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cancel.h"
 #include "misc.h"
 #include "search.h"
+#include "spill.h"
+#include "statistics.h"
 #include "words.h"
 
-void
-insert_match(Match **list, size_t n)
+static Match *
+new_match(size_t n, Match **list)
 {
-    assert(n > 0);
     Match *current = (Match *) allocmem(1, sizeof(Match));
     current->n = n;
-    current->words = (Word **) allocmem(n, sizeof(Word *));
-    for (size_t i = 0; i < n; i++)
-    {
-        current->words[i] = NULL;
-    }
+    current->start = NULL;
+    current->end = NULL;
+    current->words = NULL;
+    current->references = 1;
+    current->ordered = false;
+    current->children[0] = NULL;
+    current->children[1] = NULL;
     current->next = *list;
     current->document = NULL;
     *list = current;
+    return current;
+}
+
+void
+insert_match(Match **list, size_t n)
+{
+    assert(n > 0);
+    Match *current = new_match(n, list);
+    if (n > 1)
+    {
+        current->words = (Word **) allocmem(n, sizeof(Word *));
+        for (size_t i = 0; i < n; i++)
+        {
+            current->words[i] = NULL;
+        }
+    }
+}
+
+/* Inserts a match of the words of both matches, which become its children.
+ * The matches must be in the same document. */
+void
+insert_joined_match(Match **list, Match *first, Match *second)
+{
+    assert(document_match(first) == document_match(second));
+    Match *current = new_match(first->n + second->n, list);
+    current->start = (position_word(second->start) < position_word(first->start)) ? second->start : first->start;
+    current->end = (position_word(second->end) > position_word(first->end)) ? second->end : first->end;
+    current->children[0] = first;
+    current->children[1] = second;
+    first->references++;
+    second->references++;
+    current->document = document_match(first);
+}
+
+static void
+release_match(Match *match)
+{
+    if (match == NULL)
+    {
+        return;
+    }
+    assert(match->references > 0);
+    match->references--;
+    if (match->references == 0)
+    {
+        release_match(match->children[0]);
+        release_match(match->children[1]);
+        freemem(match->words);
+        freemem(match);
+    }
+}
+
+/* Returns the words of the match in the order of the text.  A join merges the
+ * words of its children, which it then no longer needs, and a copy reads those
+ * of the match that it copies.  The words of a match read from elsewhere are
+ * few, so insertion sort is enough. */
+static Word **
+flatten_match(Match *match)
+{
+    if (match->n == 1)
+    {
+        return &(match->start);
+    }
+    else if ((match->children[0] != NULL) && (match->children[1] == NULL))
+    {
+        return flatten_match(match->children[0]);
+    }
+    else if (match->words == NULL)
+    {
+        Match *first = match->children[0];
+        Match *second = match->children[1];
+        Word **first_words = flatten_match(first);
+        Word **second_words = flatten_match(second);
+        match->words = (Word **) allocmem(match->n, sizeof(Word *));
+        size_t i = 0;
+        size_t j = 0;
+        for (size_t k = 0; k < match->n; k++)
+        {
+            if ((j == second->n) ||
+                ((i < first->n) && (position_word(first_words[i]) <= position_word(second_words[j]))))
+            {
+                match->words[k] = first_words[i++];
+            }
+            else
+            {
+                match->words[k] = second_words[j++];
+            }
+        }
+        match->children[0] = NULL;
+        match->children[1] = NULL;
+        release_match(first);
+        release_match(second);
+        match->ordered = true;
+    }
+    else if (match->ordered == false)
+    {
+        for (size_t i = 1; i < match->n; i++)
+        {
+            Word *word = match->words[i];
+            size_t j = i;
+            while ((j > 0) && (position_word(match->words[j-1]) > position_word(word)))
+            {
+                match->words[j] = match->words[j-1];
+                j--;
+            }
+            match->words[j] = word;
+        }
+        match->ordered = true;
+    }
+    return match->words;
 }
 
 void
@@ -37,18 +151,36 @@ set_match(Match *match, size_t i, Word *word)
         match->document = document_word(word);
     }
     assert(document_match(match) == document_word(word));
-    match->words[i] = word;
+    if (match->words != NULL)
+    {
+        match->words[i] = word;
+        match->ordered = false;
+    }
+    if ((match->start == NULL) || (position_word(word) < position_word(match->start)))
+    {
+        match->start = word;
+    }
+    if ((match->end == NULL) || (position_word(word) > position_word(match->end)))
+    {
+        match->end = word;
+    }
 }
 
-/* This only copies current match.  It does not go down the list. */
+/* This only copies current match.  It does not go down the list.  A copy of a
+ * match of more than one word refers to the match for its words, while a copy
+ * of one word does not, since the lists of single words in a trie are read by
+ * many threads at once. */
 void
 append_match(Match *current, Match **dest)
 {
-    size_t n = number_of_words_in_match(current);
-    insert_match(dest, n);
-    for (size_t i = 0; i < n; i++)
+    Match *match = new_match(number_of_words_in_match(current), dest);
+    match->start = current->start;
+    match->end = current->end;
+    match->document = current->document;
+    if (match->n > 1)
     {
-        set_match(*dest, i, word_match(current, i));
+        match->children[0] = current;
+        current->references++;
     }
 }
 
@@ -76,7 +208,7 @@ word_match(Match *match, size_t i)
 {
     assert(i >= 0);
     assert(i < number_of_words_in_match(match));
-    return match->words[i];
+    return flatten_match(match)[i];
 }
 
 Word *
@@ -86,14 +218,35 @@ document_match(Match *match)
     return match->document;
 }
 
+/* The documents are listed in the order in which they first appear. */
 DocumentNode *
 document_list_match_list(Match *match)
 {
     DocumentNode *list = NULL;
+    DocumentNode *last = NULL;
     MatchIterator iterator = init_match_iterator(match);
     while (iterator_has_next_match(iterator) == true)
     {
-        insert_document(&list, document_match(iterator_next_match(&iterator)));
+        Word *document = document_match(iterator_next_match(&iterator));
+        if ((last != NULL) && (document_document(last) == document))
+        {
+            continue;
+        }
+        if (has_document(list, document) == false)
+        {
+            DocumentNode *current = (DocumentNode *) allocmem(1, sizeof(DocumentNode));
+            current->document = document;
+            current->next = NULL;
+            if (last == NULL)
+            {
+                list = current;
+            }
+            else
+            {
+                last->next = current;
+            }
+            last = current;
+        }
     }
     return list;
 }
@@ -114,33 +267,13 @@ next_match(Match *match)
 Word *
 start_word_match(Match *match)
 {
-    Word *start = word_match(match, 0);
-    size_t n = number_of_words_in_match(match);
-    for (size_t i = 1; i < n; i++)
-    {
-        Word *word = word_match(match, i);
-        if (position_word(word) < position_word(start))
-        {
-            start = word;
-        }
-    }
-    return start;
+    return match->start;
 }
 
 Word *
 end_word_match(Match *match)
 {
-    Word *end = word_match(match, 0);
-    size_t n = number_of_words_in_match(match);
-    for (size_t i = 1; i < n; i++)
-    {
-        Word *word = word_match(match, i);
-        if (position_word(word) > position_word(end))
-        {
-            end = word;
-        }
-    }
-    return end;
+    return match->end;
 }
 
 unsigned int
@@ -174,6 +307,323 @@ concatenate_matches(Match *src, Match **dest)
     }
 }
 
+/* Unlike concatenate_matches, this preserves the order of the list. */
+Match *
+copy_matches(Match *src)
+{
+    Match *match = NULL;
+    Match *last = NULL;
+    MatchIterator iterator = init_match_iterator(src);
+    while (iterator_has_next_match(iterator) == true)
+    {
+        Match *current = NULL;
+        append_match(iterator_next_match(&iterator), &current);
+        if (last == NULL)
+        {
+            match = current;
+        }
+        else
+        {
+            last->next = current;
+        }
+        last = current;
+    }
+    return match;
+}
+
+/* Matches are ordered by document, then start position, then end position.
+ * Matches that tie on all three are ordered by their words, so that equal
+ * matches end up next to each other. */
+int
+compare_match_order(Match *first, Match *second)
+{
+    if ((number_of_words_in_match(first) == 1) && (number_of_words_in_match(second) == 1))
+    {
+        unsigned long first_id = document_id_word(document_match(first));
+        unsigned long second_id = document_id_word(document_match(second));
+        if (first_id != second_id)
+        {
+            return (first_id < second_id) ? -1 : +1;
+        }
+        unsigned long first_position = position_word(word_match(first, 0));
+        unsigned long second_position = position_word(word_match(second, 0));
+        if (first_position != second_position)
+        {
+            return (first_position < second_position) ? -1 : +1;
+        }
+        return 0;
+    }
+    unsigned long keys[2][4] = {
+        {document_id_word(document_match(first)),  start_position_match(first),  end_position_match(first),
+         (unsigned long) number_of_words_in_match(first)},
+        {document_id_word(document_match(second)), start_position_match(second), end_position_match(second),
+         (unsigned long) number_of_words_in_match(second)},
+    };
+    for (size_t i = 0; i < 4; i++)
+    {
+        if (keys[0][i] != keys[1][i])
+        {
+            return (keys[0][i] < keys[1][i]) ? -1 : +1;
+        }
+    }
+    size_t n = number_of_words_in_match(first);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned long first_position = position_word(word_match(first, i));
+        unsigned long second_position = position_word(word_match(second, i));
+        if (first_position != second_position)
+        {
+            return (first_position < second_position) ? -1 : +1;
+        }
+    }
+    return 0;
+}
+
+static int
+compare_matches(const void *a, const void *b)
+{
+    return compare_match_order(*((Match **) a), *((Match **) b));
+}
+
+/* Sorts by document, then start position, then end position. */
+Match *
+sort_matches(Match *list)
+{
+    unsigned long n = length_of_match_list(list);
+    if (n < 2)
+    {
+        return list;
+    }
+    Match **array = (Match **) allocmem(n, sizeof(Match *));
+    MatchIterator iterator = init_match_iterator(list);
+    for (unsigned long i = 0; i < n; i++)
+    {
+        array[i] = iterator_next_match(&iterator);
+    }
+    qsort(array, n, sizeof(Match *), compare_matches);
+    for (unsigned long i = 0; i + 1 < n; i++)
+    {
+        array[i]->next = array[i+1];
+    }
+    array[n-1]->next = NULL;
+    Match *sorted = array[0];
+    freemem(array);
+    return sorted;
+}
+
+/* Merges two canonical lists into one, freeing the duplicates. */
+static Match *
+merge_canonical_matches(Match *first, Match *second)
+{
+    Match head;
+    Match *last = &head;
+    while ((first != NULL) && (second != NULL))
+    {
+        int order = compare_match_order(first, second);
+        if (order <= 0)
+        {
+            last->next = first;
+            last = first;
+            first = next_match(first);
+            if (order == 0)
+            {
+                Match *duplicate = second;
+                second = next_match(second);
+                duplicate->next = NULL;
+                free_matches(duplicate);
+            }
+        }
+        else
+        {
+            last->next = second;
+            last = second;
+            second = next_match(second);
+        }
+    }
+    last->next = (first != NULL) ? first : second;
+    return head.next;
+}
+
+/* Returns the list as a set: sorted by compare_match_order, with duplicates
+ * freed.  Every operator returns its matches in this form, so that the same
+ * occurrence reached in two ways is counted once.  The list is split into the
+ * runs that are already in order, which are then merged, so a list built in
+ * order costs one pass. */
+Match *
+canonical_matches(Match *list)
+{
+    Match **runs = NULL;
+    size_t n_runs = 0;
+    size_t capacity = 0;
+    Match *current = list;
+    while (current != NULL)
+    {
+        if (n_runs == capacity)
+        {
+            capacity = (capacity == 0) ? 16 : 2 * capacity;
+            runs = (Match **) reallocmem(runs, capacity * sizeof(Match *));
+        }
+        runs[n_runs++] = current;
+        Match *next = next_match(current);
+        while (next != NULL)
+        {
+            int order = compare_match_order(current, next);
+            if (order > 0)
+            {
+                break;
+            }
+            else if (order == 0)
+            {
+                current->next = next_match(next);
+                next->next = NULL;
+                free_matches(next);
+            }
+            else
+            {
+                current = next;
+            }
+            next = next_match(current);
+        }
+        current->next = NULL;
+        current = next;
+    }
+    while (n_runs > 1)
+    {
+        if (query_cancelled() == true)
+        {
+            /* A stopped query keeps only the matches merged so far. */
+            for (size_t i = 1; i < n_runs; i++)
+            {
+                free_matches(runs[i]);
+            }
+            n_runs = 1;
+            break;
+        }
+        for (size_t i = 0; i < n_runs / 2; i++)
+        {
+            runs[i] = merge_canonical_matches(runs[2*i], runs[2*i+1]);
+        }
+        if (n_runs % 2 == 1)
+        {
+            runs[n_runs/2] = runs[n_runs-1];
+        }
+        n_runs = (n_runs + 1) / 2;
+    }
+    list = (n_runs == 0) ? NULL : runs[0];
+    freemem(runs);
+    return list;
+}
+
+/* Whether the cursor comes first in the heap.  Reversed lists are read from
+ * their last match back, so the heap keeps the latest match at its root. */
+static bool
+union_cursor_precedes(UnionCursor *first, UnionCursor *second, bool reversed)
+{
+    int order = compare_match_order(first->next, second->next);
+    if (order != 0)
+    {
+        return ((reversed == true) ? (order > 0) : (order < 0));
+    }
+    return (first->list < second->list);
+}
+
+static void
+sift_down_union(UnionCursor *heap, size_t n, size_t i, bool reversed)
+{
+    while (true)
+    {
+        size_t first = i;
+        size_t left = 2 * i + 1;
+        size_t right = 2 * i + 2;
+        if ((left < n) && (union_cursor_precedes(&(heap[left]), &(heap[first]), reversed) == true))
+        {
+            first = left;
+        }
+        if ((right < n) && (union_cursor_precedes(&(heap[right]), &(heap[first]), reversed) == true))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            break;
+        }
+        UnionCursor tmp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = tmp;
+        i = first;
+    }
+}
+
+/* Copies the matches of every list into one list, merged in order and with
+ * each occurrence kept once.  The lists are left alone.  They should be
+ * canonical, or in the reverse of that order if reversed, as the lists of a
+ * trie are, since each word is inserted at the head of its list.  Either way
+ * the union comes out in canonical order, so a list out of order only costs
+ * its caller a longer canonical_matches. */
+Match *
+union_matches(Match **lists, size_t n_lists, bool reversed)
+{
+    UnionCursor *heap = (UnionCursor *) allocmem((n_lists == 0) ? 1 : n_lists, sizeof(UnionCursor));
+    size_t n_heap = 0;
+    for (size_t i = 0; i < n_lists; i++)
+    {
+        if (lists[i] != NULL)
+        {
+            heap[n_heap].next = lists[i];
+            heap[n_heap].list = i;
+            n_heap++;
+        }
+    }
+    for (size_t i = n_heap / 2; i > 0; i--)
+    {
+        sift_down_union(heap, n_heap, i - 1, reversed);
+    }
+
+    Match *match = NULL;
+    Match *last = NULL;
+    Match *taken = NULL;
+    unsigned long n_unspilled = 0;
+    while (n_heap > 0)
+    {
+        Match *next = heap[0].next;
+        if ((taken == NULL) || (compare_match_order(next, taken) != 0))
+        {
+            if (reversed == true)
+            {
+                append_match(next, &match);
+            }
+            else
+            {
+                Match *current = NULL;
+                append_match(next, &current);
+                if (last == NULL)
+                {
+                    match = current;
+                }
+                else
+                {
+                    last->next = current;
+                }
+                last = current;
+            }
+            spill_if_over_budget(&match, &n_unspilled);
+            if (match == NULL)
+            {
+                last = NULL;
+            }
+        }
+        taken = next;
+        heap[0].next = next_match(next);
+        if (heap[0].next == NULL)
+        {
+            heap[0] = heap[--n_heap];
+        }
+        sift_down_union(heap, n_heap, 0, reversed);
+    }
+    freemem(heap);
+    return match;
+}
+
 void
 free_matches(Match *list)
 {
@@ -181,8 +631,7 @@ free_matches(Match *list)
     while (iterator_has_next_match(iterator) == true)
     {
         Match *current = iterator_next_match(&iterator);
-        free(current->words);
-        free(current);
+        release_match(current);
     }
 }
 
@@ -210,24 +659,173 @@ iterator_has_next_match(MatchIterator iterator)
 void
 init_trie(TrieNode **trie)
 {
-    TrieNode *current = (TrieNode *) allocmem(1, sizeof(TrieNode));
-    current->key = '\0';
-    current->edges = NULL;
-    current->match = NULL;
-    *trie = current;
+    TrieRoot *root = (TrieRoot *) allocmem(1, sizeof(TrieRoot));
+    root->node.key = '\0';
+    root->node.edges = NULL;
+    root->node.variants = NULL;
+    root->grams.entries = NULL;
+    root->grams.lengths = NULL;
+    root->grams.n_entries = 0;
+    root->grams.capacity = 0;
+    root->grams.n_slots = 1024;
+    root->grams.slots = (GramList *) allocmem(root->grams.n_slots, sizeof(GramList));
+    for (size_t i = 0; i < root->grams.n_slots; i++)
+    {
+        root->grams.slots[i].gram = 0;
+    }
+    root->grams.n_grams = 0;
+    root->grams.longest = 0;
+    root->fields = NULL;
+    root->n_fields = 0;
+    *trie = &(root->node);
 }
 
-void
-insert_trie(TrieNode *trie, Word *word, size_t i)
+static char
+fold_key(char c)
+{
+    return (char) tolower((unsigned char) c);
+}
+
+static uint32_t
+pack_gram(const char *s)
+{
+    uint32_t gram = 0;
+    for (size_t k = 0; k < gram_length; k++)
+    {
+        gram = (gram << 8) | (unsigned char) s[k];
+    }
+    return gram;
+}
+
+static GramList *
+find_gram_list(GramIndex *grams, uint32_t gram)
+{
+    size_t i = (size_t) ((gram * UINT32_C(2654435761)) % grams->n_slots);
+    while ((grams->slots[i].gram != 0) && (grams->slots[i].gram != gram))
+    {
+        i = (i + 1) % grams->n_slots;
+    }
+    return &(grams->slots[i]);
+}
+
+static void
+grow_gram_index(GramIndex *grams)
+{
+    GramList *slots = grams->slots;
+    size_t n_slots = grams->n_slots;
+    grams->n_slots *= 2;
+    grams->slots = (GramList *) allocmem(grams->n_slots, sizeof(GramList));
+    for (size_t i = 0; i < grams->n_slots; i++)
+    {
+        grams->slots[i].gram = 0;
+    }
+    for (size_t i = 0; i < n_slots; i++)
+    {
+        if (slots[i].gram != 0)
+        {
+            *find_gram_list(grams, slots[i].gram) = slots[i];
+        }
+    }
+    freemem(slots);
+}
+
+/* The word padded with the markers and case-folded.  The caller frees it. */
+static char *
+padded_gram_word(const char *reduced, size_t len)
+{
+    char *padded = (char *) allocmem(len + 3, sizeof(char));
+    padded[0] = gram_start_marker;
+    for (size_t k = 0; k < len; k++)
+    {
+        padded[k+1] = (reduced[k] == wildcard_character) ? wildcard_character : fold_key(reduced[k]);
+    }
+    padded[len+1] = gram_end_marker;
+    padded[len+2] = '\0';
+    return padded;
+}
+
+static void
+add_gram_entry(GramIndex *grams, TrieNode *node, const char *reduced)
+{
+    if (grams->n_entries == grams->capacity)
+    {
+        grams->capacity = (grams->capacity == 0) ? 1024 : 2 * grams->capacity;
+        grams->entries = (TrieNode **) reallocmem(grams->entries, grams->capacity * sizeof(TrieNode *));
+        grams->lengths = (size_t *) reallocmem(grams->lengths, grams->capacity * sizeof(size_t));
+    }
+    uint32_t id = (uint32_t) grams->n_entries;
+    size_t len = strlen(reduced);
+    grams->entries[id] = node;
+    grams->lengths[id] = len;
+    grams->n_entries++;
+    if (len > grams->longest)
+    {
+        grams->longest = len;
+    }
+
+    char *padded = padded_gram_word(reduced, len);
+    for (size_t k = 0; k + gram_length <= len + 2; k++)
+    {
+        if (2 * (grams->n_grams + 1) > grams->n_slots)
+        {
+            grow_gram_index(grams);
+        }
+        uint32_t gram = pack_gram(&(padded[k]));
+        GramList *list = find_gram_list(grams, gram);
+        if (list->gram == 0)
+        {
+            list->gram = gram;
+            list->entries = NULL;
+            list->n_entries = 0;
+            list->capacity = 0;
+            grams->n_grams++;
+        }
+        if ((list->n_entries > 0) && (list->entries[list->n_entries-1] == id))
+        {
+            continue;
+        }
+        if (list->n_entries == list->capacity)
+        {
+            list->capacity = (list->capacity == 0) ? 4 : 2 * list->capacity;
+            list->entries = (uint32_t *) reallocmem(list->entries, list->capacity * sizeof(uint32_t));
+        }
+        list->entries[list->n_entries++] = id;
+    }
+    freemem(padded);
+}
+
+/* Returns the terminal node when the word starts a new dictionary entry. */
+static TrieNode *
+insert_trie_node(TrieNode *trie, Word *word, size_t i)
 {
     char *reduced = reduced_word(word);
-    char key = reduced[i];
+    char key = fold_key(reduced[i]);
 
-    /* If we are using the entire word, stop and add the match to the list. */
-    if (i == strlen(reduced))
+    /* If we are using the entire word, stop and add the match to the list of
+     * its variant. */
+    if (reduced[i] == '\0')
     {
-        insert_match(&(trie->match), 1);
-        set_match(trie->match, 0, word);
+        bool new_entry = (trie->variants == NULL);
+        /* Variants are kept with lowercase before uppercase at each letter,
+         * the order in which the cases of a term used to be tried. */
+        TrieVariant **link = &(trie->variants);
+        while ((*link != NULL) && (strcmp((*link)->reduced, reduced) > 0))
+        {
+            link = &((*link)->next);
+        }
+        TrieVariant *variant = *link;
+        if ((variant == NULL) || (strcmp(variant->reduced, reduced) != 0))
+        {
+            variant = (TrieVariant *) allocmem(1, sizeof(TrieVariant));
+            variant->reduced = (char *) allocmem(i + 1, sizeof(char));
+            memcpy(variant->reduced, reduced, i + 1);
+            variant->match = NULL;
+            variant->next = *link;
+            *link = variant;
+        }
+        insert_match(&(variant->match), 1);
+        set_match(variant->match, 0, word);
+        return (new_entry == true) ? trie : NULL;
     }
     else
     {
@@ -237,36 +835,126 @@ insert_trie(TrieNode *trie, Word *word, size_t i)
         {
             if (edge->node->key == key)
             {
-                insert_trie(edge->node, word, i+1);
-                break;
+                return insert_trie_node(edge->node, word, i+1);
             }
             else
             {
                 edge = edge->next;
             }
         }
-        if (edge == NULL)
+        /* The key is not in the current list of edges.  Add it. */
+        TrieEdge *current = (TrieEdge *) allocmem(1, sizeof(TrieEdge));
+        current->next = trie->edges;
+        current->node = (TrieNode *) allocmem(1, sizeof(TrieNode));
+        current->node->key = key;
+        current->node->edges = NULL;
+        current->node->variants = NULL;
+        trie->edges = current;
+        return insert_trie_node(current->node, word, i+1);
+    }
+}
+
+/* The trie must be the root.  A word outside of the full text field goes
+ * into the trie of its field, and a new entry is added to the gram index of
+ * the trie that it goes into. */
+void
+insert_trie(TrieNode *trie, Word *word, size_t i)
+{
+    TrieRoot *root = (TrieRoot *) trie;
+    unsigned long field = field_word(word);
+    if (field > full_text_field)
+    {
+        if (field >= root->n_fields)
+        {
+            root->fields = (TrieRoot **) reallocmem(root->fields, (field + 1) * sizeof(TrieRoot *));
+            for (size_t k = root->n_fields; k <= field; k++)
+            {
+                root->fields[k] = NULL;
+            }
+            root->n_fields = field + 1;
+        }
+        if (root->fields[field] == NULL)
+        {
+            TrieNode *field_trie = NULL;
+            init_trie(&field_trie);
+            root->fields[field] = (TrieRoot *) field_trie;
+        }
+        root = root->fields[field];
+    }
+    TrieNode *entry = insert_trie_node(&(root->node), word, i);
+    if (entry != NULL)
+    {
+        add_gram_entry(&(root->grams), entry, reduced_word(word));
+    }
+}
+
+static size_t
+hash_term_list(Match *list, size_t n_slots)
+{
+    return (size_t) (((uintptr_t) list >> 4) * 2654435761u) % n_slots;
+}
+
+/* Adds the list of a dictionary term to those of the expansion, unless the
+ * term was reached before. */
+static void
+add_term_list(TermLists *terms, Match *list)
+{
+    if (2 * (terms->n_lists + 1) > terms->n_slots)
+    {
+        size_t n_slots = (terms->n_slots == 0) ? 32 : 2 * terms->n_slots;
+        Match **slots = (Match **) allocmem(n_slots, sizeof(Match *));
+        for (size_t k = 0; k < n_slots; k++)
+        {
+            slots[k] = NULL;
+        }
+        for (size_t k = 0; k < terms->n_lists; k++)
+        {
+            size_t j = hash_term_list(terms->lists[k], n_slots);
+            while (slots[j] != NULL)
+            {
+                j = (j + 1) % n_slots;
+            }
+            slots[j] = terms->lists[k];
+        }
+        freemem(terms->slots);
+        terms->slots = slots;
+        terms->n_slots = n_slots;
+    }
+    size_t j = hash_term_list(list, terms->n_slots);
+    while (terms->slots[j] != NULL)
+    {
+        if (terms->slots[j] == list)
         {
-            /* The key is not in the current list of edges.  Add it. */
-            TrieEdge *current = (TrieEdge *) allocmem(1, sizeof(TrieEdge));
-            current->next = trie->edges;
-            current->node = (TrieNode *) allocmem(1, sizeof(TrieNode));
-            current->node->key = key;
-            current->node->edges = NULL;
-            current->node->match = NULL;
-            insert_trie(current->node, word, i+1);
-            trie->edges = current;
+            return;
         }
+        j = (j + 1) % terms->n_slots;
+    }
+    terms->slots[j] = list;
+
+    count_statistic(CT_TERMS_EXPANDED, 1);
+    count_expanded_terms(1);
+    if (terms->n_lists == terms->capacity)
+    {
+        terms->capacity = (terms->capacity == 0) ? 16 : 2 * terms->capacity;
+        terms->lists = (Match **) reallocmem(terms->lists, terms->capacity * sizeof(Match *));
     }
+    terms->lists[terms->n_lists++] = list;
+}
+
+static void
+free_term_lists(TermLists *terms)
+{
+    freemem(terms->lists);
+    freemem(terms->slots);
 }
 
 bool
 has_word_trie(TrieNode *trie, char *reduced)
 {
-    Match *match = NULL;
-    backtrack_trie(trie, reduced, 0, &match);
+    TermLists terms = {NULL, 0, 0, NULL, 0};
+    backtrack_trie(trie, reduced, 0, &terms, CM_SENSITIVE);
     bool result = false;
-    if (match == NULL)
+    if (terms.n_lists == 0)
     {
         result = false;
     }
@@ -274,41 +962,216 @@ has_word_trie(TrieNode *trie, char *reduced)
     {
         result = true;
     }
-    free_matches(match);
+    free_term_lists(&terms);
     return result;
 }
 
+/* Whether a variant has the case that the term asks for.  Only the letters
+ * of the term are checked, since the trie has already matched the rest, and
+ * a wildcard matches a letter in any case. */
+static bool
+case_matches_variant(const char *variant, const char *reduced, CaseMode case_mode)
+{
+    if (case_mode == CM_INSENSITIVE)
+    {
+        return true;
+    }
+    for (size_t k = 0; reduced[k] != '\0'; k++)
+    {
+        char c = reduced[k];
+        if ((c == wildcard_character) || (isalpha((unsigned char) c) == 0))
+        {
+            continue;
+        }
+        char expected = c;
+        if ((case_mode == CM_LOWERCASE) || ((case_mode == CM_TITLE_CASE) && (k > 0)))
+        {
+            expected = (char) tolower((unsigned char) c);
+        }
+        else if ((case_mode == CM_UPPERCASE) || ((case_mode == CM_TITLE_CASE) && (k == 0)))
+        {
+            expected = (char) toupper((unsigned char) c);
+        }
+        if (variant[k] != expected)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Intersects two lists of entries in increasing order, in place. */
+static size_t
+intersect_gram_entries(uint32_t *candidates, size_t n_candidates, GramList *list)
+{
+    size_t n = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < n_candidates; i++)
+    {
+        while ((j < list->n_entries) && (list->entries[j] < candidates[i]))
+        {
+            j++;
+        }
+        if (j == list->n_entries)
+        {
+            break;
+        }
+        if (list->entries[j] == candidates[i])
+        {
+            candidates[n++] = candidates[i];
+        }
+    }
+    return n;
+}
+
+/* Finds the entries of a term through the gram index.  Returns false, without
+ * searching, when the term has no gram free of wildcards. */
+static bool
+gram_search(TrieNode *trie, char *reduced, TermLists *terms, CaseMode case_mode)
+{
+    GramIndex *grams = &(((TrieRoot *) trie)->grams);
+    size_t len = strlen(reduced);
+    char *padded = padded_gram_word(reduced, len);
+    GramList *shortest = NULL;
+    GramList **lists = NULL;
+    size_t n_lists = 0;
+    bool empty = false;
+    for (size_t k = 0; (k + gram_length <= len + 2) && (empty == false); k++)
+    {
+        if (memchr(&(padded[k]), wildcard_character, gram_length) != NULL)
+        {
+            continue;
+        }
+        GramList *list = find_gram_list(grams, pack_gram(&(padded[k])));
+        if (list->gram == 0)
+        {
+            empty = true;
+        }
+        else
+        {
+            lists = (GramList **) reallocmem(lists, (n_lists + 1) * sizeof(GramList *));
+            lists[n_lists++] = list;
+            if ((shortest == NULL) || (list->n_entries < shortest->n_entries))
+            {
+                shortest = list;
+            }
+        }
+    }
+    freemem(padded);
+    if ((n_lists == 0) && (empty == false))
+    {
+        return false;
+    }
+    else if (empty == true)
+    {
+        freemem(lists);
+        return true;
+    }
+
+    uint32_t *candidates = (uint32_t *) allocmem(shortest->n_entries, sizeof(uint32_t));
+    memcpy(candidates, shortest->entries, shortest->n_entries * sizeof(uint32_t));
+    size_t n_candidates = shortest->n_entries;
+    for (size_t k = 0; (k < n_lists) && (n_candidates > 0); k++)
+    {
+        if (lists[k] != shortest)
+        {
+            n_candidates = intersect_gram_entries(candidates, n_candidates, lists[k]);
+        }
+    }
+    count_statistic(CT_GRAM_CANDIDATES, n_candidates);
+
+    for (size_t k = 0; (k < n_candidates) && (query_stopped() == false); k++)
+    {
+        if (grams->lengths[candidates[k]] != len)
+        {
+            continue;
+        }
+        TrieNode *node = grams->entries[candidates[k]];
+        const char *word = node->variants->reduced;
+        bool matches = true;
+        for (size_t m = 0; (m < len) && (matches == true); m++)
+        {
+            matches = ((reduced[m] == wildcard_character) || (fold_key(reduced[m]) == fold_key(word[m])));
+        }
+        TrieVariant *variant = (matches == true) ? node->variants : NULL;
+        while (variant != NULL)
+        {
+            if (case_matches_variant(variant->reduced, reduced, case_mode) == true)
+            {
+                add_term_list(terms, variant->match);
+            }
+            variant = variant->next;
+        }
+    }
+    freemem(candidates);
+    freemem(lists);
+    return true;
+}
+
 void
-backtrack_trie(TrieNode *trie, char *reduced, size_t i, Match **match)
+backtrack_trie(TrieNode *trie, char *reduced, size_t i, TermLists *terms, CaseMode case_mode)
 {
     char key = reduced[i];
-    if (i == strlen(reduced))
+    count_statistic(CT_TRIE_NODES, 1);
+    if (query_stopped() == true)
     {
-        concatenate_matches(trie->match, match);
+        return;
+    }
+    if (key == '\0')
+    {
+        TrieVariant *variant = trie->variants;
+        while (variant != NULL)
+        {
+            if (case_matches_variant(variant->reduced, reduced, case_mode) == true)
+            {
+                add_term_list(terms, variant->match);
+            }
+            variant = variant->next;
+        }
     }
     else
     {
+        char folded = fold_key(key);
         TrieEdge *edge = trie->edges;
         while (edge != NULL)
         {
-            if ((key == wildcard_character) || (edge->node->key == key))
+            if ((key == wildcard_character) || (edge->node->key == folded))
             {
-                backtrack_trie(edge->node, reduced, i+1, match);
+                backtrack_trie(edge->node, reduced, i+1, terms, case_mode);
             }
             edge = edge->next;
         }
     }
 }
 
+/* Truncation and edits build each spelling of the term, and the case mode is
+ * applied when the spelling is looked up, so each spelling takes one descent
+ * of the trie whatever the case mode. */
 void
-expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode case_mode, unsigned int edit_dist)
+expand_word(TrieNode *trie, char *original, size_t i, TermLists *terms, CaseMode case_mode, unsigned int edit_dist)
 {
+    if (query_cancelled() == true)
+    {
+        return;
+    }
     char c = original[i];
+    count_statistic(CT_EXPAND_CALLS, 1);
     if (i == strlen(original))
     {
+        /* A wildcard near the start would spread the descent over most of
+         * the trie, so the gram index answers those terms instead. */
         char *reduced = reduce_word(original, WO_QUERY);
-        backtrack_trie(trie, reduced, 0, match);
-        free(reduced);
+        size_t prefix = 0;
+        while ((reduced[prefix] != '\0') && (reduced[prefix] != wildcard_character))
+        {
+            prefix++;
+        }
+        if ((prefix >= gram_length) || (reduced[prefix] == '\0') ||
+            (gram_search(trie, reduced, terms, case_mode) == false))
+        {
+            backtrack_trie(trie, reduced, 0, terms, case_mode);
+        }
+        freemem(reduced);
     }
     else
     {
@@ -337,7 +1200,7 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                 tmp[m-i-1] = '\0';
                 char *endptr;
                 n = (size_t) strtol(tmp, &endptr, 10);
-                free(tmp);
+                freemem(tmp);
             }
             for (size_t j = 0; j <= n; j++)
             {
@@ -356,33 +1219,13 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                     modified[i+j+k] = original[k+m];
                 }
                 modified[len-1] = '\0';
-                expand_word(trie, modified, i, match, case_mode, edit_dist);
-                free(modified);
+                expand_word(trie, modified, i, terms, case_mode, edit_dist);
+                freemem(modified);
             }
         }
         else
         {
-            if (!isalpha(c) || (case_mode == CM_SENSITIVE))
-            {
-                expand_word(trie, original, i+1, match, case_mode, edit_dist);
-            }
-            else
-            {
-                size_t len = strlen(original) + 1;
-                char *modified = (char *) allocmem(len, sizeof(char));
-                snprintf(modified, len, "%s", original);
-                if ((case_mode == CM_INSENSITIVE) || (case_mode == CM_LOWERCASE) || ((case_mode == CM_TITLE_CASE) && (i > 0)))
-                {
-                    modified[i] = tolower(c);
-                    expand_word(trie, modified, i+1, match, case_mode, edit_dist);
-                }
-                if ((case_mode == CM_INSENSITIVE) || (case_mode == CM_UPPERCASE) || ((case_mode == CM_TITLE_CASE) && (i == 0)))
-                {
-                    modified[i] = toupper(c);
-                    expand_word(trie, modified, i+1, match, case_mode, edit_dist);
-                }
-                free(modified);
-            }
+            expand_word(trie, original, i+1, terms, case_mode, edit_dist);
             if (edit_dist > 0)
             {
                 size_t len;
@@ -400,8 +1243,8 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                     modified[j] = original[j-1];
                 }
                 modified[len-1] = '\0';
-                expand_word(trie, modified, i+2, match, case_mode, edit_dist-1);
-                free(modified);
+                expand_word(trie, modified, i+2, terms, case_mode, edit_dist-1);
+                freemem(modified);
                 /* Final insertion */
                 if (i + 1 == strlen(original))
                 {
@@ -413,8 +1256,8 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                     }
                     modified[len-2] = wildcard_character;
                     modified[len-1] = '\0';
-                    expand_word(trie, modified, i+2, match, case_mode, edit_dist-1);
-                    free(modified);
+                    expand_word(trie, modified, i+2, terms, case_mode, edit_dist-1);
+                    freemem(modified);
                 }
                 /* Deletion */
                 if (strlen(original) > 1)
@@ -430,16 +1273,16 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                         modified[j] = original[j+1];
                     }
                     modified[len-1] = '\0';
-                    expand_word(trie, modified, i, match, case_mode, edit_dist-1);
-                    free(modified);
+                    expand_word(trie, modified, i, terms, case_mode, edit_dist-1);
+                    freemem(modified);
                 }
                 /* Substitution */
                 len = strlen(original) + 1;
                 modified = (char *) allocmem(len, sizeof(char));
                 snprintf(modified, len, "%s", original);
                 modified[i] = wildcard_character;
-                expand_word(trie, modified, i+1, match, case_mode, edit_dist-1);
-                free(modified);
+                expand_word(trie, modified, i+1, terms, case_mode, edit_dist-1);
+                freemem(modified);
                 /* Transposition */
                 if (i + 1 < strlen(original))
                 {
@@ -448,35 +1291,44 @@ expand_word(TrieNode *trie, char *original, size_t i, Match **match, CaseMode ca
                     snprintf(modified, len, "%s", original);
                     modified[i]   = original[i+1];
                     modified[i+1] = original[i];
-                    expand_word(trie, modified, i+1, match, case_mode, edit_dist-1);
-                    free(modified);
+                    expand_word(trie, modified, i+1, terms, case_mode, edit_dist-1);
+                    freemem(modified);
                 }
             }
         }
     }
 }
 
+/* The trie must be the root. */
 size_t
 height_trie(TrieNode *trie)
 {
-    if (trie == NULL)
-    {
-        return 0;
-    }
-    else
+    return ((TrieRoot *) trie)->grams.longest + 1;
+}
+
+static void
+free_trie_node(TrieNode *trie)
+{
+    if (trie != NULL)
     {
-        size_t max_edge_height = 0;
         TrieEdge *edge = trie->edges;
         while (edge != NULL)
         {
-            size_t edge_height = height_trie(edge->node);
-            if (edge_height > max_edge_height)
-            {
-                max_edge_height = edge_height;
-            }
-            edge = edge->next;
+            TrieEdge *next = edge->next;
+            free_trie_node(edge->node);
+            freemem(edge);
+            edge = next;
+        }
+        TrieVariant *variant = trie->variants;
+        while (variant != NULL)
+        {
+            TrieVariant *next = variant->next;
+            free_matches(variant->match);
+            freemem(variant->reduced);
+            freemem(variant);
+            variant = next;
         }
-        return max_edge_height + 1;
+        freemem(trie);
     }
 }
 
@@ -485,16 +1337,27 @@ free_trie(TrieNode *trie)
 {
     if (trie != NULL)
     {
-        TrieEdge *edge = trie->edges;
-        while (edge != NULL)
+        TrieRoot *root = (TrieRoot *) trie;
+        for (size_t k = 0; k < root->n_fields; k++)
         {
-            TrieEdge *next = edge->next;
-            free_trie(edge->node);
-            free(edge);
-            edge = next;
+            if (root->fields[k] != NULL)
+            {
+                free_trie(&(root->fields[k]->node));
+            }
+        }
+        freemem(root->fields);
+        GramIndex *grams = &(root->grams);
+        for (size_t i = 0; i < grams->n_slots; i++)
+        {
+            if (grams->slots[i].gram != 0)
+            {
+                freemem(grams->slots[i].entries);
+            }
         }
-        free_matches(trie->match);
-        free(trie);
+        freemem(grams->slots);
+        freemem(grams->entries);
+        freemem(grams->lengths);
+        free_trie_node(trie);
     }
 }
 
@@ -557,6 +1420,19 @@ filename_document(DocumentNode *document)
     return filename_word(document->document);
 }
 
+unsigned long
+length_of_document_list(DocumentNode *list)
+{
+    unsigned long n = 0;
+    DocumentIterator iterator = init_document_iterator(list);
+    while (iterator_has_next_document(iterator) == true)
+    {
+        iterator_next_document(&iterator);
+        n++;
+    }
+    return n;
+}
+
 void
 free_document_list(DocumentNode *list)
 {
@@ -564,7 +1440,7 @@ free_document_list(DocumentNode *list)
     while (iterator_has_next_document(iterator) == true)
     {
         DocumentNode *current = iterator_next_document(&iterator);
-        free(current);
+        freemem(current);
     }
 }
 
@@ -590,21 +1466,68 @@ iterator_has_next_document(DocumentIterator iterator)
 }
 
 Match *
-wildcard_search(TrieNode *trie, char *original, CaseMode case_mode, unsigned int edit_dist)
+wildcard_search(TrieNode *trie, char *original, CaseMode case_mode, unsigned int edit_dist, unsigned long field)
 {
-    Match *match = NULL;
-    expand_word(trie, original, 0, &match, case_mode, edit_dist);
-    return match;
+    TermLists terms = {NULL, 0, 0, NULL, 0};
+    TrieRoot *root = (TrieRoot *) trie;
+    begin_expansion();
+    if ((field == end_field) || (field == full_text_field))
+    {
+        expand_word(trie, original, 0, &terms, case_mode, edit_dist);
+    }
+    for (size_t k = full_text_field + 1; k < root->n_fields; k++)
+    {
+        if ((root->fields[k] != NULL) && ((field == end_field) || (field == k)))
+        {
+            expand_word(&(root->fields[k]->node), original, 0, &terms, case_mode, edit_dist);
+        }
+    }
+    Match *match = union_matches(terms.lists, terms.n_lists, true);
+    free_term_lists(&terms);
+    return canonical_matches(collect_spilled_matches(match));
 }
 
+/* Adds the pair of an outer and an inner match to the list, and stops the
+ * query once the list has more matches than an operator may produce. */
+static void
+add_proximity_match(Match **list, Match *outer_match, Match *inner_match, unsigned long *n_unspilled,
+                    unsigned long *n_added)
+{
+    insert_joined_match(list, outer_match, inner_match);
+    spill_if_over_budget(list, n_unspilled);
+    (*n_added)++;
+    if ((match_limit() > 0) && (*n_added > match_limit()))
+    {
+        exceed_query_limit(QL_MATCHES);
+    }
+}
+
+/* Each outer match has a window of positions in its document, stepped to
+ * from the ends of the match, and the inner matches in the window pair with
+ * it.  Stepping by elements is a lookup in the element numbers of the
+ * document.
+ *
+ * Both lists are canonical, and the window only moves forward as the outer
+ * match does, so the inner matches are joined in one pass: a cursor passes
+ * the inner matches that start before the window, and those of them that
+ * still reach into it are kept aside for the inclusive mode, where they
+ * overlap the window.  The cost is the length of both lists plus the number
+ * of inner matches that start in each window, however long the elements. */
 Match *
 proximity_search(Match *first_match, Match *second_match, LanguageElement element, int start, int end, ProximityMode proximity_mode)
 {
     Match *match = NULL;
+    unsigned long n_unspilled = 0;
+    unsigned long n_added = 0;
+    Match *cursor = second_match;
+    Match **reaching = NULL;
+    size_t n_reaching = 0;
+    size_t capacity = 0;
     MatchIterator outer_iterator = init_match_iterator(first_match);
-    while (iterator_has_next_match(outer_iterator) == true)
+    while ((iterator_has_next_match(outer_iterator) == true) && (query_cancelled() == false))
     {
         Match *outer_match = iterator_next_match(&outer_iterator);
+        unsigned long outer_id = document_id_word(document_match(outer_match));
         Word *outer_start_word = advance_word(start_word_match(outer_match), element, start);
         Word   *outer_end_word = advance_word(  end_word_match(outer_match), element,   end);
         unsigned long outer_start = position_word(outer_start_word);
@@ -622,32 +1545,211 @@ proximity_search(Match *first_match, Match *second_match, LanguageElement elemen
             outer_end--;
         }
 
-        MatchIterator inner_iterator = init_match_iterator(second_match);
-        while (iterator_has_next_match(inner_iterator) == true)
+        while (cursor != NULL)
         {
-            Match *inner_match = iterator_next_match(&inner_iterator);
-            if (document_match(outer_match) == document_match(inner_match))
+            unsigned long inner_id = document_id_word(document_match(cursor));
+            if ((inner_id > outer_id) ||
+                ((inner_id == outer_id) && (start_position_match(cursor) >= outer_start)))
+            {
+                break;
+            }
+            if ((inner_id == outer_id) && (proximity_mode == PM_INCLUSIVE))
             {
-                unsigned long inner_start = position_word(start_word_match(inner_match));
-                unsigned long   inner_end = position_word(  end_word_match(inner_match));
-                if (((inner_start >= outer_start) && (inner_end <= outer_end)   && (proximity_mode == PM_EXCLUSIVE)) ||
-                    ((inner_start <= outer_end)   && (inner_end >= outer_start) && (proximity_mode == PM_INCLUSIVE)))
+                if (n_reaching == capacity)
                 {
-                    /* We have a match.  Let's add it. */
-                    size_t n_outer = number_of_words_in_match(outer_match);
-                    size_t n_inner = number_of_words_in_match(inner_match);
-                    insert_match(&match, n_outer + n_inner);
-                    for (size_t i = 0; i < n_outer; i++)
-                    {
-                        set_match(match, i, word_match(outer_match, i));
-                    }
-                    for (size_t i = 0; i < n_inner; i++)
-                    {
-                        set_match(match, n_outer + i, word_match(inner_match, i));
-                    }
+                    capacity = (capacity == 0) ? 16 : 2 * capacity;
+                    reaching = (Match **) reallocmem(reaching, capacity * sizeof(Match *));
                 }
+                reaching[n_reaching++] = cursor;
             }
+            cursor = next_match(cursor);
+        }
+
+        /* Those kept aside start before the window, so they overlap it if
+         * they end in it or after it.  Those that do not never will, since
+         * the window only moves forward. */
+        size_t n_kept = 0;
+        for (size_t i = 0; i < n_reaching; i++)
+        {
+            Match *inner_match = reaching[i];
+            count_statistic(CT_PROXIMITY_PAIRS, 1);
+            if ((document_id_word(document_match(inner_match)) == outer_id) &&
+                (end_position_match(inner_match) >= outer_start))
+            {
+                reaching[n_kept++] = inner_match;
+                add_proximity_match(&match, outer_match, inner_match, &n_unspilled, &n_added);
+            }
+        }
+        n_reaching = n_kept;
+
+        Match *inner_match = cursor;
+        while ((inner_match != NULL) && (document_id_word(document_match(inner_match)) == outer_id) &&
+               (start_position_match(inner_match) <= outer_end))
+        {
+            count_statistic(CT_PROXIMITY_PAIRS, 1);
+            if ((proximity_mode == PM_INCLUSIVE) || (end_position_match(inner_match) <= outer_end))
+            {
+                add_proximity_match(&match, outer_match, inner_match, &n_unspilled, &n_added);
+            }
+            inner_match = next_match(inner_match);
         }
     }
+    freemem(reaching);
     return match;
 }
+
+static size_t
+hash_term(char *original, CaseMode case_mode, unsigned int edit_dist, unsigned long field)
+{
+    /* FNV-1a */
+    size_t hash = 2166136261u;
+    for (size_t i = 0; original[i] != '\0'; i++)
+    {
+        hash = (hash ^ (unsigned char) original[i]) * 16777619u;
+    }
+    hash = (hash ^ (size_t) case_mode) * 16777619u;
+    hash = (hash ^ (size_t) edit_dist) * 16777619u;
+    hash = (hash ^ (size_t) field) * 16777619u;
+    return hash;
+}
+
+TermCache *
+init_term_cache(void)
+{
+    TermCache *cache = (TermCache *) allocmem(1, sizeof(TermCache));
+    cache->n_buckets = 256;
+    cache->n_entries = 0;
+    cache->buckets = (TermCacheEntry **) allocmem(cache->n_buckets, sizeof(TermCacheEntry *));
+    for (size_t i = 0; i < cache->n_buckets; i++)
+    {
+        cache->buckets[i] = NULL;
+    }
+    pthread_mutex_init(&(cache->mutex), NULL);
+    return cache;
+}
+
+static TermCacheEntry *
+find_term_cache(TermCache *cache, TrieNode *trie, char *original, CaseMode case_mode, unsigned int edit_dist,
+                unsigned long field)
+{
+    size_t i = hash_term(original, case_mode, edit_dist, field) % cache->n_buckets;
+    TermCacheEntry *entry = cache->buckets[i];
+    while (entry != NULL)
+    {
+        if ((entry->trie == trie) && (entry->case_mode == case_mode) && (entry->edit_dist == edit_dist) &&
+            (entry->field == field) && (strcmp(entry->original, original) == 0))
+        {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static void
+grow_term_cache(TermCache *cache)
+{
+    size_t n_buckets = 2 * cache->n_buckets;
+    TermCacheEntry **buckets = (TermCacheEntry **) allocmem(n_buckets, sizeof(TermCacheEntry *));
+    for (size_t i = 0; i < n_buckets; i++)
+    {
+        buckets[i] = NULL;
+    }
+    for (size_t i = 0; i < cache->n_buckets; i++)
+    {
+        TermCacheEntry *entry = cache->buckets[i];
+        while (entry != NULL)
+        {
+            TermCacheEntry *next = entry->next;
+            size_t j = hash_term(entry->original, entry->case_mode, entry->edit_dist, entry->field) % n_buckets;
+            entry->next = buckets[j];
+            buckets[j] = entry;
+            entry = next;
+        }
+    }
+    freemem(cache->buckets);
+    cache->buckets = buckets;
+    cache->n_buckets = n_buckets;
+}
+
+/* The expansion itself happens outside of the lock so that threads expanding
+ * different terms do not wait on each other.  If two threads expand the same
+ * term at once, the first one to finish is kept. */
+Match *
+cached_wildcard_search(TermCache *cache, TrieNode *trie, char *original, CaseMode case_mode, unsigned int edit_dist,
+                       unsigned long field)
+{
+    if (cache == NULL)
+    {
+        return wildcard_search(trie, original, case_mode, edit_dist, field);
+    }
+
+    pthread_mutex_lock(&(cache->mutex));
+    TermCacheEntry *entry = find_term_cache(cache, trie, original, case_mode, edit_dist, field);
+    if (entry != NULL)
+    {
+        Match *match = copy_matches(entry->match);
+        pthread_mutex_unlock(&(cache->mutex));
+        return match;
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+
+    Match *expanded = wildcard_search(trie, original, case_mode, edit_dist, field);
+    if (query_stopped() == true)
+    {
+        /* The expansion may be incomplete, so it is not kept. */
+        return expanded;
+    }
+
+    pthread_mutex_lock(&(cache->mutex));
+    entry = find_term_cache(cache, trie, original, case_mode, edit_dist, field);
+    if (entry == NULL)
+    {
+        if (cache->n_entries >= cache->n_buckets)
+        {
+            grow_term_cache(cache);
+        }
+        size_t i = hash_term(original, case_mode, edit_dist, field) % cache->n_buckets;
+        entry = (TermCacheEntry *) allocmem(1, sizeof(TermCacheEntry));
+        entry->trie = trie;
+        entry->original = (char *) allocmem((strlen(original)+1), sizeof(char));
+        snprintf(entry->original, strlen(original)+1, "%s", original);
+        entry->case_mode = case_mode;
+        entry->edit_dist = edit_dist;
+        entry->field = field;
+        entry->match = expanded;
+        entry->next = cache->buckets[i];
+        cache->buckets[i] = entry;
+        cache->n_entries++;
+    }
+    else
+    {
+        free_matches(expanded);
+    }
+    Match *match = copy_matches(entry->match);
+    pthread_mutex_unlock(&(cache->mutex));
+    return match;
+}
+
+void
+free_term_cache(TermCache *cache)
+{
+    if (cache != NULL)
+    {
+        for (size_t i = 0; i < cache->n_buckets; i++)
+        {
+            TermCacheEntry *entry = cache->buckets[i];
+            while (entry != NULL)
+            {
+                TermCacheEntry *next = entry->next;
+                freemem(entry->original);
+                free_matches(entry->match);
+                freemem(entry);
+                entry = next;
+            }
+        }
+        pthread_mutex_destroy(&(cache->mutex));
+        freemem(cache->buckets);
+        freemem(cache);
+    }
+}
@@ -3,8 +3,10 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "words.h"
 
@@ -39,6 +41,7 @@ Word *document_document(DocumentNode *);
 DocumentNode *next_document(DocumentNode *);
 bool has_document(DocumentNode *, Word *);
 char *filename_document(DocumentNode *);
+unsigned long length_of_document_list(DocumentNode *);
 void free_document_list(DocumentNode *);
 
 DocumentIterator init_document_iterator(DocumentNode *);
@@ -47,11 +50,23 @@ bool iterator_has_next_document(DocumentIterator);
 
 /* A match is a continuous set of words matching a set of constraints.  Each
  * match is part of a linked list where subsequent matches are merely appended
- * onto the list. */
+ * onto the list.  The first and last words of the match are kept with it, so
+ * its span is known without reading its words.
+ *
+ * A match built from two others, as by a proximity operator, does not copy
+ * their words but refers to the two matches as its children, so the words of
+ * nested matches are shared.  A match is freed once its list and every match
+ * built from it have let go of it.  The words are put into one array in the
+ * order of the text only when they are read, which is usually for output. */
 typedef struct Match
 {
     size_t n; /* Number of searched words */
-    Word **words; /* Dynamically-allocated array of searched words */
+    Word *start;
+    Word *end;
+    Word **words; /* NULL for one word, which is start, or until a join is read */
+    unsigned int references;
+    bool ordered; /* Whether words is in the order of the text */
+    struct Match *children[2]; /* Of a join, or the first alone for a copy */
     struct Match *next;
     Word *document;
 } Match;
@@ -61,7 +76,16 @@ typedef struct MatchIterator
     Match *next;
 } MatchIterator;
 
+/* A union of many lists keeps the next match of each list in a heap, so each
+ * match taken costs a comparison per level of the heap and is copied once. */
+typedef struct UnionCursor
+{
+    Match *next;
+    size_t list; /* Earlier lists win ties */
+} UnionCursor;
+
 void insert_match(Match **, size_t);
+void insert_joined_match(Match **, Match *, Match *);
 void set_match(Match *, size_t, Word *);
 void append_match(Match *, Match **);
 size_t number_of_words_in_match(Match *);
@@ -76,6 +100,11 @@ unsigned int start_position_match(Match *);
 unsigned int end_position_match(Match *);
 unsigned int width_match(Match *);
 void concatenate_matches(Match *, Match **);
+Match *copy_matches(Match *);
+int compare_match_order(Match *, Match *);
+Match *sort_matches(Match *);
+Match *canonical_matches(Match *);
+Match *union_matches(Match **, size_t, bool);
 void free_matches(Match *);
 
 MatchIterator init_match_iterator(Match *);
@@ -85,11 +114,21 @@ bool iterator_has_next_match(MatchIterator);
 struct TrieNode;
 struct TrieEdge;
 
+/* The dictionary is keyed on the case-folded form of each word.  Each entry
+ * keeps the occurrences of every variant of the word as it was written, so a
+ * search in any case mode descends the trie once and then picks variants. */
+typedef struct TrieVariant
+{
+    char *reduced;
+    Match *match;
+    struct TrieVariant *next;
+} TrieVariant;
+
 typedef struct TrieNode
 {
-    char key;
+    char key; /* Case-folded */
     struct TrieEdge *edges;
-    Match *match;
+    TrieVariant *variants;
 } TrieNode;
 
 typedef struct TrieEdge
@@ -98,15 +137,108 @@ typedef struct TrieEdge
     struct TrieEdge *next;
 } TrieEdge;
 
+/* A term that starts with a wildcard would visit every branch of the trie, so
+ * each dictionary entry is also listed under every gram of gram_length
+ * characters of its case-folded word, with markers at both ends.  Such a term
+ * is answered by intersecting the lists of the grams in its literal parts and
+ * checking the entries that remain. */
+static const size_t gram_length = 3;
+static const char gram_start_marker = '\x01';
+static const char gram_end_marker = '\x02';
+
+typedef struct GramList
+{
+    uint32_t gram; /* Zero for an empty slot */
+    uint32_t *entries; /* In increasing order */
+    uint32_t n_entries;
+    uint32_t capacity;
+} GramList;
+
+typedef struct GramIndex
+{
+    TrieNode **entries; /* Terminal node of each entry */
+    size_t *lengths;
+    size_t n_entries;
+    size_t capacity;
+    GramList *slots; /* Hash table by gram */
+    size_t n_slots;
+    size_t n_grams;
+    size_t longest; /* Length of the longest word */
+} GramIndex;
+
+/* The root of a trie carries the gram index of the whole dictionary.  Its
+ * node comes first, so a pointer to the root is also a pointer to its node.
+ * The words of the full text field are in the trie itself, and the words of
+ * each other field are in a trie of their own under the root, so that a
+ * search within a field only reads the postings of that field. */
+typedef struct TrieRoot
+{
+    TrieNode node;
+    GramIndex grams;
+    struct TrieRoot **fields; /* Indexed by field number */
+    size_t n_fields;
+} TrieRoot;
+
+/* The lists of the dictionary terms that a term expands to, which are united
+ * once the expansion is done.  The lists belong to the trie.  Truncation and
+ * edits can reach the same term by several paths, so the lists are also kept
+ * in a hash set and each term is added and counted once. */
+typedef struct TermLists
+{
+    Match **lists;
+    size_t n_lists;
+    size_t capacity;
+    Match **slots; /* NULL for an empty slot */
+    size_t n_slots;
+} TermLists;
+
 void init_trie(TrieNode **);
 void insert_trie(TrieNode *, Word *, size_t);
 bool has_word_trie(TrieNode *, char *);
-void backtrack_trie(TrieNode *, char *, size_t, Match **);
-void expand_word(TrieNode *, char *, size_t, Match **, CaseMode, unsigned int);
+void backtrack_trie(TrieNode *, char *, size_t, TermLists *, CaseMode);
+void expand_word(TrieNode *, char *, size_t, TermLists *, CaseMode, unsigned int);
 size_t height_trie(TrieNode *); /* Length of longest word + 1 */
 void free_trie(TrieNode *);
 
-Match *wildcard_search(TrieNode *, char *, CaseMode, unsigned int);
+/* A search in end_field searches every field. */
+Match *wildcard_search(TrieNode *, char *, CaseMode, unsigned int, unsigned long);
+
+/* Each segment of the corpus has its own dictionary.  No match spans two
+ * documents, so a query is evaluated against each segment separately and the
+ * results are merged. */
+typedef struct Segment
+{
+    TrieNode *trie;
+    Document **documents;
+    size_t n_documents;
+} Segment;
+
+/* A term cache holds the expansions of wildcard terms so that many queries run
+ * against the same tries only expand each term once in each.  It is shared between
+ * threads, so every access goes through the mutex. */
+typedef struct TermCacheEntry
+{
+    TrieNode *trie;
+    char *original;
+    CaseMode case_mode;
+    unsigned int edit_dist;
+    unsigned long field;
+    Match *match;
+    struct TermCacheEntry *next;
+} TermCacheEntry;
+
+typedef struct TermCache
+{
+    size_t n_buckets;
+    size_t n_entries;
+    TermCacheEntry **buckets;
+    pthread_mutex_t mutex;
+} TermCache;
+
+TermCache *init_term_cache(void);
+Match *cached_wildcard_search(TermCache *, TrieNode *, char *, CaseMode, unsigned int, unsigned long);
+void free_term_cache(TermCache *);
+
 Match *proximity_search(Match *, Match *, LanguageElement, int, int, ProximityMode);
 
 #endif /* SEARCH_H */
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "interpreter.h"
+#include "misc.h"
+#include "output.h"
+#include "search.h"
+#include "shard.h"
+#include "statistics.h"
+
+/* A query is sent as its length and then its text.  A worker replies with the
+ * number of units of output, the length of the output, the offset of the end
+ * of each unit, and then the output itself. */
+static bool
+write_all(int fd, const void *data, size_t size)
+{
+    const char *current = (const char *) data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, current, size);
+        if ((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            return false;
+        }
+        current += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+static bool
+read_all(int fd, void *data, size_t size)
+{
+    char *current = (char *) data;
+    while (size > 0)
+    {
+        ssize_t n = read(fd, current, size);
+        if ((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else if (n <= 0)
+        {
+            return false;
+        }
+        current += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+static void
+shard_error(size_t i)
+{
+    fprintf(stderr, "%s: Shard %zu stopped unexpectedly\n", program_name, i + 1);
+    exit(EXIT_FAILURE);
+}
+
+static void
+run_shard(int fd, size_t n_names, char *names[], SearchOptions search_options, OutputOptions options)
+{
+    Segment segment;
+    segment.n_documents = read_data(n_names, names, &(segment.trie), &(segment.documents));
+    TermCache *cache = init_term_cache();
+    uint64_t len = 0;
+    while (read_all(fd, &len, sizeof(len)) == true)
+    {
+        char *query = (char *) allocmem((size_t) len + 1, sizeof(char));
+        if (read_all(fd, query, (size_t) len) == false)
+        {
+            freemem(query);
+            break;
+        }
+        query[len] = '\0';
+
+        char *output = NULL;
+        size_t size = 0;
+        FILE *stream = open_memstream(&output, &size);
+        if (stream == NULL)
+        {
+            fprintf(stderr, "%s: error allocating memory\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        OutputUnits units;
+        record_output_units(&units);
+        interpret_query(stream, query, &segment, 1, cache, search_options, options);
+        record_output_units(NULL);
+        fclose(stream);
+
+        uint64_t header[2] = {(uint64_t) units.n_units, (uint64_t) size};
+        bool sent = write_all(fd, header, sizeof(header));
+        for (size_t i = 0; (i < units.n_units) && (sent == true); i++)
+        {
+            uint64_t end = (uint64_t) units.ends[i];
+            sent = write_all(fd, &end, sizeof(end));
+        }
+        if (sent == true)
+        {
+            sent = write_all(fd, output, size);
+        }
+        free(output);
+        freemem(units.ends);
+        freemem(query);
+        if (sent == false)
+        {
+            break;
+        }
+    }
+    free_term_cache(cache);
+    free_data(segment.n_documents, segment.trie, segment.documents);
+    close(fd);
+    exit(EXIT_SUCCESS);
+}
+
+/* Each shard gets a run of consecutive files of about the same total size, so
+ * that the output keeps the order of the files.  Returns the index of the
+ * first file of each shard, followed by n_names. */
+static size_t *
+partition_files(size_t n_shards, size_t n_names, char *names[])
+{
+    uint64_t *prefix = (uint64_t *) allocmem(n_names + 1, sizeof(uint64_t));
+    prefix[0] = 0;
+    for (size_t i = 0; i < n_names; i++)
+    {
+        struct stat status;
+        if (stat(names[i], &status) != 0)
+        {
+            fprintf(stderr, "%s: File '%s' does not exist\n", program_name, names[i]);
+            exit(EXIT_FAILURE);
+        }
+        prefix[i+1] = prefix[i] + (uint64_t) status.st_size;
+    }
+    size_t *starts = (size_t *) allocmem(n_shards + 1, sizeof(size_t));
+    starts[0] = 0;
+    for (size_t k = 1; k < n_shards; k++)
+    {
+        size_t j = starts[k-1] + 1;
+        while ((j < n_names - (n_shards - k)) && (prefix[j] * n_shards < k * prefix[n_names]))
+        {
+            j++;
+        }
+        starts[k] = j;
+    }
+    starts[n_shards] = n_names;
+    freemem(prefix);
+    return starts;
+}
+
+/* Forks one worker per shard.  There are never more shards than files. */
+size_t
+start_shards(size_t n_shards, size_t n_names, char *names[], SearchOptions search_options, OutputOptions options,
+             Shard **shards)
+{
+    if (n_shards > n_names)
+    {
+        n_shards = n_names;
+    }
+    size_t *starts = partition_files(n_shards, n_names, names);
+    *shards = (Shard *) allocmem(n_shards, sizeof(Shard));
+    signal(SIGPIPE, SIG_IGN);
+    fflush(NULL);
+    for (size_t k = 0; k < n_shards; k++)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            fprintf(stderr, "%s: Cannot create socket for shard %zu\n", program_name, k + 1);
+            exit(EXIT_FAILURE);
+        }
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            fprintf(stderr, "%s: Cannot start worker for shard %zu\n", program_name, k + 1);
+            exit(EXIT_FAILURE);
+        }
+        else if (pid == 0)
+        {
+            for (size_t i = 0; i < k; i++)
+            {
+                close((*shards)[i].fd);
+            }
+            close(fds[0]);
+            run_shard(fds[1], starts[k+1] - starts[k], &(names[starts[k]]), search_options, options);
+        }
+        close(fds[1]);
+        (*shards)[k].pid = pid;
+        (*shards)[k].fd = fds[0];
+    }
+    freemem(starts);
+    return n_shards;
+}
+
+/* Every shard works on the query at once.  The replies are read in shard
+ * order, and the maximum applies to the units of output of all of them. */
+void
+interpret_query_shards(FILE *stream, char *query, Shard *shards, size_t n_shards, SearchOptions search_options,
+                       OutputOptions options)
+{
+    count_statistic(CT_QUERIES, 1);
+    if (check_query(query, search_options) == false)
+    {
+        return;
+    }
+    uint64_t len = (uint64_t) strlen(query);
+    for (size_t k = 0; k < n_shards; k++)
+    {
+        if ((write_all(shards[k].fd, &len, sizeof(len)) == false) ||
+            (write_all(shards[k].fd, query, (size_t) len) == false))
+        {
+            shard_error(k);
+        }
+    }
+
+    unsigned int n_printed = 0;
+    for (size_t k = 0; k < n_shards; k++)
+    {
+        uint64_t header[2];
+        if (read_all(shards[k].fd, header, sizeof(header)) == false)
+        {
+            shard_error(k);
+        }
+        size_t n_units = (size_t) header[0];
+        size_t size = (size_t) header[1];
+        uint64_t *ends = (uint64_t *) allocmem((n_units == 0) ? 1 : n_units, sizeof(uint64_t));
+        char *output = (char *) allocmem((size == 0) ? 1 : size, sizeof(char));
+        if ((read_all(shards[k].fd, ends, n_units * sizeof(uint64_t)) == false) ||
+            (read_all(shards[k].fd, output, size) == false))
+        {
+            shard_error(k);
+        }
+
+        double phase_start = start_phase();
+        size_t start = 0;
+        for (size_t i = 0; (i < n_units) && (n_printed < maximum_output_options(options)); i++)
+        {
+            fwrite(output + start, sizeof(char), (size_t) ends[i] - start, stream);
+            start = (size_t) ends[i];
+            n_printed++;
+        }
+        if (n_printed < maximum_output_options(options))
+        {
+            fwrite(output + start, sizeof(char), size - start, stream);
+        }
+        end_phase(PH_PRINT, phase_start);
+        freemem(ends);
+        freemem(output);
+    }
+}
+
+/* The same output as interpret_queries, but with one query at a time, each
+ * spread over the shards. */
+void
+interpret_queries_shards(FILE *stream, size_t n_queries, char **queries, Shard *shards, size_t n_shards,
+                         SearchOptions search_options, OutputOptions options)
+{
+    for (size_t i = 0; i < n_queries; i++)
+    {
+        char *output = NULL;
+        size_t size = 0;
+        FILE *query_stream = open_memstream(&output, &size);
+        if (query_stream == NULL)
+        {
+            fprintf(stderr, "%s: error allocating memory\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        interpret_query_shards(query_stream, queries[i], shards, n_shards, search_options, options);
+        fclose(query_stream);
+        fprintf(stream, "query:%zu:%s\n", i + 1, queries[i]);
+        fwrite(output, sizeof(char), size, stream);
+        if ((size > 0) && (output[size-1] != '\n'))
+        {
+            fprintf(stream, "\n");
+        }
+        free(output);
+    }
+}
+
+void
+stop_shards(Shard *shards, size_t n_shards)
+{
+    for (size_t k = 0; k < n_shards; k++)
+    {
+        close(shards[k].fd);
+    }
+    for (size_t k = 0; k < n_shards; k++)
+    {
+        int status = 0;
+        while ((waitpid(shards[k].pid, &status, 0) < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+    }
+    freemem(shards);
+}
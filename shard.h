@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "interpreter.h"
+#include "output.h"
+
+/* In coordinator mode the files are split into shards, and each shard is read
+ * and searched by its own worker process.  The coordinator checks each query,
+ * sends it to every worker over a socket, and prints the results of the
+ * shards in order.  Documents never span shards, so the only thing to combine
+ * is the maximum number of results. */
+typedef struct Shard
+{
+    pid_t pid;
+    int fd;
+} Shard;
+
+size_t start_shards(size_t, size_t, char **, SearchOptions, OutputOptions, Shard **);
+void interpret_query_shards(FILE *, char *, Shard *, size_t, SearchOptions, OutputOptions);
+void interpret_queries_shards(FILE *, size_t, char **, Shard *, size_t, SearchOptions, OutputOptions);
+void stop_shards(Shard *, size_t);
+
+#endif /* SHARD_H */
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "search.h"
+#include "spill.h"
+#include "statistics.h"
+#include "words.h"
+
+/* Output of the operator currently running on this thread that has already
+ * been spilled.  The caller of the operator collects it afterwards. */
+static THREAD_LOCAL MatchSpill *pending_spill = NULL;
+
+/* A cursor over either a run on disk or a sorted list in memory. */
+typedef struct SpillCursor
+{
+    FILE *file;
+    Match *list;
+    Match *current;
+    unsigned long document_id;
+    unsigned long start;
+    unsigned long end;
+} SpillCursor;
+
+static void
+spill_error(const char *message)
+{
+    fprintf(stderr, "%s: Cannot spill intermediate results to disk: %s\n", program_name, message);
+    exit(EXIT_FAILURE);
+}
+
+/* Temporary files go in TMPDIR (or /tmp) and are unlinked at once, so they
+ * disappear when they are closed or when the program exits. */
+static FILE *
+open_spill_file(void)
+{
+    const char *directory = getenv("TMPDIR");
+    if ((directory == NULL) || (directory[0] == '\0'))
+    {
+        directory = "/tmp";
+    }
+    size_t len = strlen(directory) + 20;
+    char *template = (char *) allocmem(len, sizeof(char));
+    snprintf(template, len, "%s/wosp-spill-XXXXXX", directory);
+    int fd = mkstemp(template);
+    if (fd < 0)
+    {
+        freemem(template);
+        spill_error("could not create a temporary file");
+    }
+    unlink(template);
+    freemem(template);
+    FILE *file = fdopen(fd, "w+b");
+    if (file == NULL)
+    {
+        close(fd);
+        spill_error("could not open a temporary file");
+    }
+    return file;
+}
+
+static void
+write_spill(const void *data, size_t size, FILE *file)
+{
+    if (fwrite(data, size, 1, file) != 1)
+    {
+        spill_error("write failed (is the disk full?)");
+    }
+}
+
+/* Each record is the document number, the number of words, and the position
+ * of each word. */
+static void
+write_match(Match *match, FILE *file)
+{
+    unsigned long document_id = document_id_word(document_match(match));
+    size_t n = number_of_words_in_match(match);
+    write_spill(&document_id, sizeof(document_id), file);
+    write_spill(&n, sizeof(n), file);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned long position = position_word(word_match(match, i));
+        write_spill(&position, sizeof(position), file);
+    }
+}
+
+static Match *
+read_match(FILE *file)
+{
+    unsigned long document_id = 0;
+    size_t n = 0;
+    if (fread(&document_id, sizeof(document_id), 1, file) != 1)
+    {
+        if (ferror(file) != 0)
+        {
+            spill_error("read failed");
+        }
+        return NULL;
+    }
+    if ((fread(&n, sizeof(n), 1, file) != 1) || (n == 0))
+    {
+        spill_error("truncated run");
+    }
+    Document *document = find_document(document_id);
+    if (document == NULL)
+    {
+        spill_error("run refers to an unknown document");
+    }
+    Match *match = NULL;
+    insert_match(&match, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned long position = 0;
+        if (fread(&position, sizeof(position), 1, file) != 1)
+        {
+            spill_error("truncated run");
+        }
+        set_match(match, i, word_document(document, position));
+    }
+    return match;
+}
+
+static void
+advance_cursor(SpillCursor *cursor)
+{
+    if (cursor->file != NULL)
+    {
+        if (cursor->current != NULL)
+        {
+            cursor->current->next = NULL;
+        }
+        cursor->current = read_match(cursor->file);
+    }
+    else
+    {
+        cursor->current = cursor->list;
+        if (cursor->list != NULL)
+        {
+            cursor->list = cursor->list->next;
+            cursor->current->next = NULL;
+        }
+    }
+    if (cursor->current != NULL)
+    {
+        cursor->document_id = document_id_word(document_match(cursor->current));
+        cursor->start = start_position_match(cursor->current);
+        cursor->end = end_position_match(cursor->current);
+    }
+}
+
+static bool
+cursor_precedes(SpillCursor *first, SpillCursor *second)
+{
+    if (first->document_id != second->document_id)
+    {
+        return (first->document_id < second->document_id);
+    }
+    else if (first->start != second->start)
+    {
+        return (first->start < second->start);
+    }
+    else
+    {
+        return (first->end < second->end);
+    }
+}
+
+/* Merges every run, and the sorted list if given, either into a new run on
+ * disk or into a list in memory.  The runs are closed afterwards. */
+static Match *
+merge_runs(MatchSpill *spill, Match *sorted, FILE *output)
+{
+    size_t n_cursors = spill->n_runs + 1;
+    SpillCursor *cursors = (SpillCursor *) allocmem(n_cursors, sizeof(SpillCursor));
+    for (size_t i = 0; i < n_cursors; i++)
+    {
+        cursors[i].file = (i < spill->n_runs) ? spill->runs[i] : NULL;
+        cursors[i].list = (i < spill->n_runs) ? NULL : sorted;
+        cursors[i].current = NULL;
+        if (cursors[i].file != NULL)
+        {
+            rewind(cursors[i].file);
+        }
+        advance_cursor(&(cursors[i]));
+    }
+
+    Match *match = NULL;
+    Match *last = NULL;
+    while (true)
+    {
+        SpillCursor *next = NULL;
+        for (size_t i = 0; i < n_cursors; i++)
+        {
+            if ((cursors[i].current != NULL) && ((next == NULL) || cursor_precedes(&(cursors[i]), next)))
+            {
+                next = &(cursors[i]);
+            }
+        }
+        if (next == NULL)
+        {
+            break;
+        }
+        Match *current = next->current;
+        next->current = NULL;
+        if (output != NULL)
+        {
+            write_match(current, output);
+            free_matches(current);
+        }
+        else if (last == NULL)
+        {
+            match = current;
+            last = current;
+        }
+        else
+        {
+            last->next = current;
+            last = current;
+        }
+        advance_cursor(next);
+    }
+
+    for (size_t i = 0; i < spill->n_runs; i++)
+    {
+        fclose(spill->runs[i]);
+    }
+    spill->n_runs = 0;
+    freemem(cursors);
+    return match;
+}
+
+MatchSpill *
+init_match_spill(void)
+{
+    MatchSpill *spill = (MatchSpill *) allocmem(1, sizeof(MatchSpill));
+    spill->runs = (FILE **) allocmem(spill_runs_maximum, sizeof(FILE *));
+    spill->n_runs = 0;
+    spill->n_matches = 0;
+    return spill;
+}
+
+/* Writes the list as one sorted run and frees it. */
+void
+spill_matches(MatchSpill *spill, Match **list)
+{
+    if (*list == NULL)
+    {
+        return;
+    }
+    if (spill->n_runs == spill_runs_maximum)
+    {
+        FILE *compacted = open_spill_file();
+        merge_runs(spill, NULL, compacted);
+        if (fflush(compacted) != 0)
+        {
+            spill_error("write failed (is the disk full?)");
+        }
+        spill->runs[0] = compacted;
+        spill->n_runs = 1;
+    }
+    Match *sorted = sort_matches(*list);
+    FILE *run = open_spill_file();
+    unsigned long n = 0;
+    MatchIterator iterator = init_match_iterator(sorted);
+    while (iterator_has_next_match(iterator) == true)
+    {
+        write_match(iterator_next_match(&iterator), run);
+        n++;
+    }
+    if (fflush(run) != 0)
+    {
+        spill_error("write failed (is the disk full?)");
+    }
+    free_matches(sorted);
+    *list = NULL;
+    reserve_memory();
+    spill->runs[spill->n_runs] = run;
+    spill->n_runs++;
+    spill->n_matches += n;
+    count_statistic(CT_MATCHES_SPILLED, n);
+}
+
+/* Reads every spilled match back, merged with the remaining list, and frees
+ * the spill. */
+Match *
+merge_match_spill(MatchSpill *spill, Match *list)
+{
+    Match *match = merge_runs(spill, sort_matches(list), NULL);
+    freemem(spill->runs);
+    freemem(spill);
+    return match;
+}
+
+/* Operators call this after adding each match to their output.  The count of
+ * unspilled matches keeps a tight budget from producing a run per match. */
+void
+spill_if_over_budget(Match **list, unsigned long *n_unspilled)
+{
+    (*n_unspilled)++;
+    if ((*n_unspilled >= spill_run_minimum) && (memory_over_budget() == true))
+    {
+        if (pending_spill == NULL)
+        {
+            pending_spill = init_match_spill();
+        }
+        spill_matches(pending_spill, list);
+        *n_unspilled = 0;
+    }
+}
+
+Match *
+collect_spilled_matches(Match *list)
+{
+    if (pending_spill == NULL)
+    {
+        return list;
+    }
+    else
+    {
+        MatchSpill *spill = pending_spill;
+        pending_spill = NULL;
+        return merge_match_spill(spill, list);
+    }
+}
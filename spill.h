@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "search.h"
+
+/* Matches that do not fit in the memory budget are written to temporary files
+ * as runs sorted by document, start position, and end position.  Reading them
+ * back merges the runs into one sorted list. */
+static const unsigned long spill_run_minimum = 4096; /* Matches per run */
+static const size_t spill_runs_maximum = 64; /* Open runs before compacting */
+
+typedef struct MatchSpill
+{
+    FILE **runs;
+    size_t n_runs;
+    unsigned long n_matches;
+} MatchSpill;
+
+MatchSpill *init_match_spill(void);
+void spill_matches(MatchSpill *, Match **);
+Match *merge_match_spill(MatchSpill *, Match *);
+
+void spill_if_over_budget(Match **, unsigned long *);
+Match *collect_spilled_matches(Match *);
+
+#endif /* SPILL_H */
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "misc.h"
+#include "statistics.h"
+
+bool statistics_enabled = false;
+THREAD_LOCAL unsigned long counters[N_COUNTERS];
+THREAD_LOCAL double phase_seconds[N_PHASES];
+
+static unsigned long total_counters[N_COUNTERS];
+static double total_phase_seconds[N_PHASES];
+static pthread_mutex_t statistics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *counter_names[] = {"allocations", "allocated_bytes", "trie_nodes_visited", "terms_expanded",
+                                      "expand_word_calls", "gram_candidates", "word_iterator_steps",
+                                      "proximity_comparisons", "matches_spilled", "documents_skipped",
+                                      "result_cache_hits", "result_cache_misses", "queries",
+                                      "queries_stopped"};
+static const char *phase_names[] = {"read", "index", "parse", "eval", "print"};
+
+/* This must be called before any other threads start. */
+void
+enable_statistics(void)
+{
+    statistics_enabled = true;
+}
+
+/* The value of a counter in the current thread. */
+unsigned long
+statistic(Counter counter)
+{
+    return counters[counter];
+}
+
+double
+start_phase(void)
+{
+    return (statistics_enabled == true) ? wall_time() : 0.0;
+}
+
+void
+end_phase(Phase phase, double start)
+{
+    if (statistics_enabled == true)
+    {
+        phase_seconds[phase] += wall_time() - start;
+    }
+}
+
+void
+merge_statistics(void)
+{
+    pthread_mutex_lock(&statistics_mutex);
+    for (size_t i = 0; i < N_COUNTERS; i++)
+    {
+        total_counters[i] += counters[i];
+        counters[i] = 0;
+    }
+    for (size_t i = 0; i < N_PHASES; i++)
+    {
+        total_phase_seconds[i] += phase_seconds[i];
+        phase_seconds[i] = 0.0;
+    }
+    pthread_mutex_unlock(&statistics_mutex);
+}
+
+/* Phase times from several threads are summed, so with batch queries the
+ * parse, eval, and print times can exceed the wall time of the program. */
+void
+print_statistics(FILE *stream, StatisticsFormat format)
+{
+    merge_statistics();
+    if (format == SF_JSON)
+    {
+        fprintf(stream, "{\"counters\":{");
+        for (size_t i = 0; i < N_COUNTERS; i++)
+        {
+            fprintf(stream, "%s\"%s\":%lu", (i > 0) ? "," : "", counter_names[i], total_counters[i]);
+        }
+        fprintf(stream, "},\"phases\":{");
+        for (size_t i = 0; i < N_PHASES; i++)
+        {
+            fprintf(stream, "%s\"%s\":%.6f", (i > 0) ? "," : "", phase_names[i], total_phase_seconds[i]);
+        }
+        fprintf(stream, "}}\n");
+    }
+    else
+    {
+        for (size_t i = 0; i < N_PHASES; i++)
+        {
+            fprintf(stream, "%s: %-22s %12.6f s\n", program_name, phase_names[i], total_phase_seconds[i]);
+        }
+        for (size_t i = 0; i < N_COUNTERS; i++)
+        {
+            fprintf(stream, "%s: %-22s %12lu\n", program_name, counter_names[i], total_counters[i]);
+        }
+    }
+}
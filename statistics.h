@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "misc.h"
+
+typedef enum Counter
+{
+    CT_ALLOCATIONS,
+    CT_ALLOCATED_BYTES,
+    CT_TRIE_NODES,
+    CT_TERMS_EXPANDED,
+    CT_EXPAND_CALLS,
+    CT_GRAM_CANDIDATES,
+    CT_WORD_STEPS,
+    CT_PROXIMITY_PAIRS,
+    CT_MATCHES_SPILLED,
+    CT_DOCUMENTS_SKIPPED,
+    CT_RESULT_CACHE_HITS,
+    CT_RESULT_CACHE_MISSES,
+    CT_QUERIES,
+    CT_QUERIES_STOPPED,
+    N_COUNTERS
+} Counter;
+
+typedef enum Phase
+{
+    PH_READ,
+    PH_INDEX,
+    PH_PARSE,
+    PH_EVAL,
+    PH_PRINT,
+    N_PHASES
+} Phase;
+
+typedef enum StatisticsFormat
+{
+    SF_TEXT,
+    SF_JSON
+} StatisticsFormat;
+
+/* Counters are kept per thread so that incrementing them never needs a lock.
+ * Each thread adds its counters to the totals with merge_statistics before it
+ * exits.  When statistics are disabled, counting costs one branch. */
+extern bool statistics_enabled;
+extern THREAD_LOCAL unsigned long counters[N_COUNTERS];
+extern THREAD_LOCAL double phase_seconds[N_PHASES];
+
+static inline void
+count_statistic(Counter counter, unsigned long n)
+{
+    if (statistics_enabled == true)
+    {
+        counters[counter] += n;
+    }
+}
+
+void enable_statistics(void);
+unsigned long statistic(Counter);
+double start_phase(void);
+void end_phase(Phase, double);
+void merge_statistics(void);
+void print_statistics(FILE *, StatisticsFormat);
+
+#endif /* STATISTICS_H */
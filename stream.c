@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cancel.h"
+#include "input.h"
+#include "interpreter.h"
+#include "misc.h"
+#include "output.h"
+#include "search.h"
+#include "statistics.h"
+#include "stream.h"
+#include "words.h"
+
+/* The most paragraph boundaries that a match of the tree can cross.  Every
+ * paragraph boundary is also a boundary of each smaller element, so a
+ * distance of n elements of any kind crosses at most n of them.  Boolean
+ * operators only combine matches within a window. */
+static size_t
+reach_syntax_tree(SyntaxTree *tree)
+{
+    if (tree == NULL)
+    {
+        return 0;
+    }
+    size_t left = reach_syntax_tree(left_syntax_tree(tree));
+    size_t right = reach_syntax_tree(right_syntax_tree(tree));
+    if (proximity_operator_token_type(type_syntax_tree(tree)) == true)
+    {
+        int n = number_syntax_tree(tree);
+        return left + right + (size_t) ((n < 0) ? -n : n) + 1;
+    }
+    return (left > right) ? left : right;
+}
+
+static void
+init_stream_window(StreamWindow *window, size_t n_middle, size_t margin)
+{
+    window->document = init_document("stdin", 0);
+    window->first = NULL;
+    window->last = NULL;
+    window->starts = NULL;
+    window->n_starts = 0;
+    window->capacity = 0;
+    window->n_behind = 0;
+    window->n_middle = n_middle;
+    window->margin = margin;
+}
+
+static void
+start_paragraph(StreamWindow *window, Word *word)
+{
+    if (window->n_starts == window->capacity)
+    {
+        window->capacity = (window->capacity == 0) ? 64 : 2 * window->capacity;
+        window->starts = (Word **) reallocmem(window->starts, window->capacity * sizeof(Word *));
+    }
+    window->starts[window->n_starts++] = word;
+}
+
+/* A window is full once the paragraphs of its margin after the middle are
+ * complete. */
+static bool
+full_stream_window(StreamWindow *window)
+{
+    return (window->n_starts > window->n_behind + window->n_middle + window->margin);
+}
+
+/* Searches the window and prints the results whose words are in the middle,
+ * from the first paragraph after those kept from before to the word last,
+ * or to the end of the window when last is NULL.  Returns false if the query
+ * could not be evaluated.  A window whose evaluation was stopped still prints
+ * the matches found in it, and sets partial, unless it went over a limit.
+ * The memory limit applies to each window. */
+static bool
+search_stream_window(FILE *stream, StreamWindow *window, Word *last, SyntaxTree *tree, SearchOptions search_options,
+                     OutputOptions options, ExcerptState *state, bool *partial)
+{
+    double phase_start = start_phase();
+    renumber_document(window->document, window->first);
+    TrieNode *trie = NULL;
+    init_trie(&trie);
+    add_words_to_trie(trie, window->first);
+    end_phase(PH_INDEX, phase_start);
+
+    phase_start = start_phase();
+    bool error_flag = false;
+    restart_query_allocation();
+    Match *matches = eval_syntax_tree(tree, trie, NULL, case_mode_search_options(search_options),
+                                      edit_dist_search_options(search_options), end_field,
+                                      proximity_mode_search_options(search_options), NULL, &error_flag);
+    end_phase(PH_EVAL, phase_start);
+    bool over_limit = (exceeded_query_limit() != QL_NONE);
+    if (over_limit == true)
+    {
+        *partial = true;
+    }
+    else if (query_stopped() == true)
+    {
+        *partial = end_cancellation();
+    }
+
+    if ((error_flag == false) && (over_limit == false))
+    {
+        phase_start = start_phase();
+        Word *first = window->starts[window->n_behind];
+        if (type_output_options(options) == OT_EXCERPTS)
+        {
+            print_excerpts_window(stream, matches, first, last, state, options);
+        }
+        else
+        {
+            unsigned int start = (unsigned int) position_word(first);
+            unsigned int end = (unsigned int) position_word((last == NULL) ? list_last_word(first) : last);
+            Match *middle = NULL;
+            while (matches != NULL)
+            {
+                Match *current = matches;
+                matches = next_match(current);
+                unsigned int position = start_position_match(current);
+                if ((position >= start) && (position <= end))
+                {
+                    current->next = middle;
+                    middle = current;
+                }
+                else
+                {
+                    current->next = NULL;
+                    free_matches(current);
+                }
+            }
+            matches = sort_matches(middle);
+            if (type_output_options(options) == OT_MATCHES)
+            {
+                OutputOptions remaining = options;
+                remaining.maximum -= (state->n_output < options.maximum) ? state->n_output : options.maximum;
+                print_matches(stream, matches, remaining);
+            }
+            state->n_output += length_of_match_list(matches);
+        }
+        fflush(stream);
+        end_phase(PH_PRINT, phase_start);
+    }
+    free_matches(matches);
+    free_trie(trie);
+    return (error_flag == false);
+}
+
+/* Frees the paragraphs before the margin of the next middle. */
+static void
+slide_stream_window(StreamWindow *window)
+{
+    size_t end = window->n_behind + window->n_middle;
+    size_t keep = (end > window->margin) ? end - window->margin : 0;
+    if (keep > 0)
+    {
+        window->first = window->starts[keep];
+        free_words_before(window->first);
+        memmove(window->starts, &(window->starts[keep]), (window->n_starts - keep) * sizeof(Word *));
+        window->n_starts -= keep;
+    }
+    window->n_behind = end - keep;
+}
+
+static void
+free_stream_window(StreamWindow *window)
+{
+    if (window->first != NULL)
+    {
+        renumber_document(window->document, window->first);
+    }
+    free_document(window->document);
+    freemem(window->starts);
+}
+
+void
+interpret_query_stream(FILE *stream, FILE *input, char *query, size_t n_window, SearchOptions search_options,
+                       OutputOptions options)
+{
+    count_statistic(CT_QUERIES, 1);
+    double phase_start = start_phase();
+    Token *tokens = lex_query(query, default_operator_type_search_options(search_options));
+    if (count_errors_tokens(tokens, true) > 0)
+    {
+        end_phase(PH_PARSE, phase_start);
+        fprintf(stderr, "%s: One of more syntax errors found after tokenization\n", program_name);
+        free_tokens(tokens);
+        return;
+    }
+    Token *current = tokens;
+    SyntaxTree *tree = parse_query(&current);
+    end_phase(PH_PARSE, phase_start);
+    if (element_output_options(options) == LE_PAGE)
+    {
+        fprintf(stderr, "%s: Pages cannot be printed from a stream\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    if (explain_search_options(search_options) == true)
+    {
+        init_profile_syntax_tree(tree);
+    }
+
+    int context = (before_output_options(options) > after_output_options(options)) ? before_output_options(options)
+                                                                                     : after_output_options(options);
+    StreamWindow window;
+    init_stream_window(&window, n_window, reach_syntax_tree(tree) + (size_t) ((context < 0) ? 0 : context) + 1);
+    ExcerptState state = init_excerpt_state();
+    SourceReader reader = init_source_reader(input, true);
+    bool evaluated = true;
+    bool partial = false;
+    begin_cancellation(cancel_search_options(search_options), timeout_search_options(search_options),
+                       limits_search_options(search_options));
+    phase_start = start_phase();
+    while ((evaluated == true) && (partial == false) && (query_cancelled() == false) &&
+           (read_source_word(&reader, &(window.last), window.document) == true))
+    {
+        if (window.first == NULL)
+        {
+            window.first = window.last;
+            start_paragraph(&window, window.last);
+        }
+        else if (paragraph_ending_word(prev_word(window.last)) == true)
+        {
+            start_paragraph(&window, window.last);
+            if (full_stream_window(&window) == true)
+            {
+                end_phase(PH_READ, phase_start);
+                Word *last = prev_word(window.starts[window.n_behind + window.n_middle]);
+                evaluated = search_stream_window(stream, &window, last, tree, search_options, options, &state,
+                                                 &partial);
+                slide_stream_window(&window);
+                phase_start = start_phase();
+            }
+        }
+    }
+    end_phase(PH_READ, phase_start);
+    if ((evaluated == true) && (partial == false) && (query_stopped() == false) && (window.first != NULL))
+    {
+        evaluated = search_stream_window(stream, &window, NULL, tree, search_options, options, &state, &partial);
+    }
+    bool over_limit = (exceeded_query_limit() != QL_NONE);
+    if (over_limit == true)
+    {
+        report_query_limit(query);
+    }
+    if (end_cancellation() == true)
+    {
+        partial = true;
+    }
+
+    if (evaluated == false)
+    {
+        print_syntax_tree(stderr, tree, true);
+        fprintf(stderr, "%s: One or more syntax errors found during evaluation\n", program_name);
+    }
+    else if (type_output_options(options) == OT_DOCUMENTS)
+    {
+        if ((state.n_output > 0) && (maximum_output_options(options) > 0))
+        {
+            fprintf(stream, "%s", filename_word(window.first));
+            if (count_matches_output_options(options) == true)
+            {
+                fprintf(stream, ":%u", state.n_output);
+            }
+            fprintf(stream, "\n");
+        }
+    }
+    else if ((type_output_options(options) == OT_EXCERPTS) && (count_matches_output_options(options) == true) &&
+             ((state.n_excerpts > 0) || (state.printing == true)))
+    {
+        fprintf(stream, "%s:%u\n", filename_word(window.first), state.n_excerpts);
+    }
+    if ((partial == true) && (evaluated == true) && (over_limit == false))
+    {
+        fprintf(stderr, "%s: Query '%s' was stopped before it finished, so its results are partial\n", program_name,
+                query);
+    }
+    if (explain_search_options(search_options) == true)
+    {
+        fprintf(stderr, "%s: explain: %s\n", program_name, query);
+        print_profile_syntax_tree(stderr, tree, 1);
+    }
+    free_source_reader(&reader);
+    free_stream_window(&window);
+    free_syntax_tree(tree);
+    free_tokens(tokens);
+}
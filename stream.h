@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+
+#include "interpreter.h"
+#include "output.h"
+#include "words.h"
+
+/* A stream is searched in windows of paragraphs.  Each window is searched
+ * with a margin of paragraphs on either side that is wide enough for any
+ * match and its context, and only the results in the middle of the window are
+ * printed.  The words before the margin are then freed, so memory use depends
+ * on the size of the window and not on the length of the stream. */
+static const size_t default_stream_window = 64;
+
+typedef struct StreamWindow
+{
+    Document *document;
+    Word *first;
+    Word *last;
+    Word **starts; /* First word of each paragraph in the window */
+    size_t n_starts;
+    size_t capacity;
+    size_t n_behind; /* Paragraphs kept from before the middle */
+    size_t n_middle;
+    size_t margin;
+} StreamWindow;
+
+void interpret_query_stream(FILE *, FILE *, char *, size_t, SearchOptions, OutputOptions);
+
+#endif /* STREAM_H */
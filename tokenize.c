@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "tokenize.h"
+
+#if !defined(__SSE2__)
+/* In the C locale, the whitespace characters are '\t' to '\r' and ' ', and
+ * the punctuation characters are the printable ASCII characters that are not
+ * letters, digits, or spaces. */
+static bool
+is_space_byte(unsigned char c)
+{
+    return ((c == ' ') || ((c >= '\t') && (c <= '\r')));
+}
+
+static bool
+is_mark_byte(unsigned char c)
+{
+    return ((c == '\0') || ((c >= 33) && (c <= 47)) || ((c >= 58) && (c <= 64)) || ((c >= 91) && (c <= 96)) ||
+            ((c >= 123) && (c <= 126)));
+}
+
+static void
+classify_scalar(const unsigned char *block, size_t length, uint64_t *spaces, uint64_t *marks)
+{
+    for (size_t i = 0; i < length; i += 64)
+    {
+        uint64_t space_bits = 0, mark_bits = 0;
+        for (size_t j = 0; j < 64; j++)
+        {
+            space_bits |= (uint64_t) is_space_byte(block[i+j]) << j;
+            mark_bits  |= (uint64_t)  is_mark_byte(block[i+j]) << j;
+        }
+        spaces[i/64] = space_bits;
+        marks[i/64] = mark_bits;
+    }
+}
+#endif
+
+#if defined(__SSE2__)
+/* Unsigned comparison lo <= c <= hi, from a wrapping subtraction. */
+static __m128i
+in_range_sse2(__m128i v, char lo, char hi)
+{
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8((char) (hi - lo))), t);
+}
+
+static void
+classify_sse2(const unsigned char *block, size_t length, uint64_t *spaces, uint64_t *marks)
+{
+    for (size_t i = 0; i < length; i += 64)
+    {
+        uint64_t space_bits = 0, mark_bits = 0;
+        for (size_t j = 0; j < 64; j += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *) &(block[i+j]));
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+            __m128i mark = _mm_or_si128(_mm_or_si128(in_range_sse2(v, 33, 47), in_range_sse2(v, 58, 64)),
+                                        _mm_or_si128(in_range_sse2(v, 91, 96), in_range_sse2(v, 123, 126)));
+            mark = _mm_or_si128(mark, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+            space_bits |= (uint64_t) (uint16_t) _mm_movemask_epi8(space) << j;
+            mark_bits  |= (uint64_t) (uint16_t) _mm_movemask_epi8(mark) << j;
+        }
+        spaces[i/64] = space_bits;
+        marks[i/64] = mark_bits;
+    }
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static __m256i
+in_range_avx2(__m256i v, char lo, char hi)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8((char) (hi - lo))), t);
+}
+
+__attribute__((target("avx2"))) static void
+classify_avx2(const unsigned char *block, size_t length, uint64_t *spaces, uint64_t *marks)
+{
+    for (size_t i = 0; i < length; i += 64)
+    {
+        uint64_t space_bits = 0, mark_bits = 0;
+        for (size_t j = 0; j < 64; j += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *) &(block[i+j]));
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+            __m256i mark = _mm256_or_si256(_mm256_or_si256(in_range_avx2(v, 33, 47), in_range_avx2(v, 58, 64)),
+                                           _mm256_or_si256(in_range_avx2(v, 91, 96), in_range_avx2(v, 123, 126)));
+            mark = _mm256_or_si256(mark, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+            space_bits |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << j;
+            mark_bits  |= (uint64_t) (uint32_t) _mm256_movemask_epi8(mark) << j;
+        }
+        spaces[i/64] = space_bits;
+        marks[i/64] = mark_bits;
+    }
+}
+#endif
+
+ClassifyFunction
+select_classify_function(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return classify_avx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return classify_sse2;
+#else
+    return classify_scalar;
+#endif
+}
+
+/* Returns the index of the first set bit from i, or n if there is none
+ * before n. */
+size_t
+next_set_bit(const uint64_t *bits, size_t i, size_t n)
+{
+    while (i < n)
+    {
+        uint64_t word = bits[i/64] >> (i % 64);
+        if (word != 0)
+        {
+            i += (size_t) __builtin_ctzll(word);
+            return (i < n) ? i : n;
+        }
+        i = (i / 64 + 1) * 64;
+    }
+    return n;
+}
+
+size_t
+next_clear_bit(const uint64_t *bits, size_t i, size_t n)
+{
+    while (i < n)
+    {
+        uint64_t word = ~bits[i/64] >> (i % 64);
+        if (word != 0)
+        {
+            i += (size_t) __builtin_ctzll(word);
+            return (i < n) ? i : n;
+        }
+        i = (i / 64 + 1) * 64;
+    }
+    return n;
+}
+
+/* Whether any bit from i up to n is set. */
+bool
+any_bit_set(const uint64_t *bits, size_t i, size_t n)
+{
+    return (next_set_bit(bits, i, n) < n);
+}
+
+/* The number of bits set from i up to n. */
+size_t
+count_set_bits(const uint64_t *bits, size_t i, size_t n)
+{
+    size_t count = 0;
+    while (i < n)
+    {
+        size_t j = ((i / 64 + 1) * 64 < n) ? (i / 64 + 1) * 64 : n;
+        uint64_t word = bits[i/64] >> (i % 64);
+        if (j - i < 64)
+        {
+            word &= ((uint64_t) 1 << (j - i)) - 1;
+        }
+        count += (size_t) __builtin_popcountll(word);
+        i = j;
+    }
+    return count;
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Source text is read in blocks, and each block is classified 64 bytes at a
+ * time into two bitmaps with one bit per byte: whitespace, which separates
+ * words, and punctuation or NUL, which a reduced word leaves out.  The blocks
+ * are classified with AVX2 or SSE2 when the processor has them. */
+static const size_t source_block_length = 65536;
+
+typedef void (*ClassifyFunction)(const unsigned char *, size_t, uint64_t *, uint64_t *);
+
+ClassifyFunction select_classify_function(void);
+size_t next_set_bit(const uint64_t *, size_t, size_t);
+size_t next_clear_bit(const uint64_t *, size_t, size_t);
+bool any_bit_set(const uint64_t *, size_t, size_t);
+size_t count_set_bits(const uint64_t *, size_t, size_t);
+
+#endif /* TOKENIZE_H */
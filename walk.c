@@ -0,0 +1,357 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/* Copyright (C) 2025 Andrew Trettel */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "walk.h"
+
+FileFilter
+init_file_filter(void)
+{
+    FileFilter filter;
+    filter.includes = NULL;
+    filter.n_includes = 0;
+    filter.excludes = NULL;
+    filter.n_excludes = 0;
+    return filter;
+}
+
+void
+add_file_filter(FileFilter *filter, char *pattern, bool exclude)
+{
+    if (exclude == true)
+    {
+        filter->excludes = (char **) reallocmem(filter->excludes, (filter->n_excludes + 1) * sizeof(char *));
+        filter->excludes[filter->n_excludes++] = pattern;
+    }
+    else
+    {
+        filter->includes = (char **) reallocmem(filter->includes, (filter->n_includes + 1) * sizeof(char *));
+        filter->includes[filter->n_includes++] = pattern;
+    }
+}
+
+void
+free_file_filter(FileFilter filter)
+{
+    freemem(filter.includes);
+    freemem(filter.excludes);
+}
+
+static const char *
+base_name(const char *name)
+{
+    const char *slash = strrchr(name, '/');
+    return (slash == NULL) ? name : slash + 1;
+}
+
+/* Include patterns only apply to files, so that every directory is entered
+ * unless it is excluded. */
+static bool
+passes_file_filter(FileFilter filter, const char *name, bool directory)
+{
+    const char *base = base_name(name);
+    for (size_t i = 0; i < filter.n_excludes; i++)
+    {
+        if (fnmatch(filter.excludes[i], base, 0) == 0)
+        {
+            return false;
+        }
+    }
+    if ((directory == true) || (filter.n_includes == 0))
+    {
+        return true;
+    }
+    for (size_t i = 0; i < filter.n_includes; i++)
+    {
+        if (fnmatch(filter.includes[i], base, 0) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Files that cannot be opened are not binary here, so that reading them
+ * later reports the error. */
+static bool
+is_binary_file(int fd)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+    char block[sniff_length];
+    ssize_t n;
+    do
+    {
+        n = read(fd, block, sniff_length);
+    }
+    while ((n < 0) && (errno == EINTR));
+    close(fd);
+    return ((n > 0) && (memchr(block, '\0', (size_t) n) != NULL));
+}
+
+void
+init_file_list(FileList *files)
+{
+    files->names = NULL;
+    files->n_names = 0;
+    files->capacity = 0;
+}
+
+static char *
+copy_name(const char *name)
+{
+    char *copy = (char *) allocmem(strlen(name) + 1, sizeof(char));
+    snprintf(copy, strlen(name) + 1, "%s", name);
+    return copy;
+}
+
+static char *
+join_name(const char *directory, const char *name)
+{
+    size_t len = strlen(directory) + strlen(name) + 2;
+    char *path = (char *) allocmem(len, sizeof(char));
+    bool slash = ((directory[0] != '\0') && (directory[strlen(directory)-1] == '/'));
+    snprintf(path, len, (slash == true) ? "%s%s" : "%s/%s", directory, name);
+    return path;
+}
+
+static void
+append_name(char ***names, size_t *n_names, size_t *capacity, char *name)
+{
+    if (*n_names == *capacity)
+    {
+        *capacity = (*capacity == 0) ? 64 : 2 * (*capacity);
+        *names = (char **) reallocmem(*names, *capacity * sizeof(char *));
+    }
+    (*names)[(*n_names)++] = name;
+}
+
+void
+add_file(FileList *files, const char *name)
+{
+    append_name(&(files->names), &(files->n_names), &(files->capacity), copy_name(name));
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*((char * const *) a), *((char * const *) b));
+}
+
+/* Each entry is checked relative to the open directory, so the kernel does
+ * not resolve the full path again for every file.  Symbolic links are not
+ * followed. */
+static void
+read_directory(Walk *walk, char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    DIR *directory = (fd < 0) ? NULL : fdopendir(fd);
+    if (directory == NULL)
+    {
+        fprintf(stderr, "%s: Cannot read directory '%s'\n", program_name, path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    char **files = NULL;
+    size_t n_files = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+        {
+            continue;
+        }
+        struct stat status;
+        if (fstatat(fd, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(status.st_mode) && (passes_file_filter(walk->filter, entry->d_name, true) == true))
+        {
+            char *subdirectory = join_name(path, entry->d_name);
+            pthread_mutex_lock(&(walk->mutex));
+            append_name(&(walk->pending), &(walk->n_pending), &(walk->capacity), subdirectory);
+            pthread_cond_signal(&(walk->work));
+            pthread_mutex_unlock(&(walk->mutex));
+        }
+        else if (S_ISREG(status.st_mode) && (passes_file_filter(walk->filter, entry->d_name, false) == true) &&
+                 (is_binary_file(openat(fd, entry->d_name, O_RDONLY)) == false))
+        {
+            append_name(&files, &n_files, &capacity, join_name(path, entry->d_name));
+        }
+    }
+    closedir(directory);
+
+    pthread_mutex_lock(&(walk->mutex));
+    for (size_t i = 0; i < n_files; i++)
+    {
+        append_name(&(walk->files->names), &(walk->files->n_names), &(walk->files->capacity), files[i]);
+    }
+    pthread_mutex_unlock(&(walk->mutex));
+    freemem(files);
+}
+
+static void *
+run_walk(void *data)
+{
+    Walk *walk = (Walk *) data;
+    pthread_mutex_lock(&(walk->mutex));
+    while (true)
+    {
+        while ((walk->n_pending == 0) && (walk->n_busy > 0))
+        {
+            pthread_cond_wait(&(walk->work), &(walk->mutex));
+        }
+        if (walk->n_pending == 0)
+        {
+            break;
+        }
+        char *path = walk->pending[--(walk->n_pending)];
+        walk->n_busy++;
+        pthread_mutex_unlock(&(walk->mutex));
+
+        read_directory(walk, path);
+        freemem(path);
+
+        pthread_mutex_lock(&(walk->mutex));
+        walk->n_busy--;
+        if ((walk->n_pending == 0) && (walk->n_busy == 0))
+        {
+            pthread_cond_broadcast(&(walk->work));
+        }
+    }
+    pthread_mutex_unlock(&(walk->mutex));
+    return NULL;
+}
+
+/* Threads take directories from a shared stack and push the subdirectories
+ * that they find.  The files found are added in sorted order. */
+void
+walk_directories(FileList *files, size_t n_directories, char *directories[], FileFilter filter,
+                 unsigned int n_threads)
+{
+    Walk walk;
+    walk.pending = NULL;
+    walk.n_pending = 0;
+    walk.capacity = 0;
+    walk.n_busy = 0;
+    walk.filter = filter;
+    walk.files = files;
+    pthread_mutex_init(&(walk.mutex), NULL);
+    pthread_cond_init(&(walk.work), NULL);
+
+    for (size_t i = 0; i < n_directories; i++)
+    {
+        struct stat status;
+        if ((stat(directories[i], &status) != 0) || (S_ISDIR(status.st_mode) == false))
+        {
+            fprintf(stderr, "%s: Directory '%s' does not exist\n", program_name, directories[i]);
+            exit(EXIT_FAILURE);
+        }
+        append_name(&(walk.pending), &(walk.n_pending), &(walk.capacity), copy_name(directories[i]));
+    }
+
+    size_t first = files->n_names;
+    pthread_t *threads = (pthread_t *) allocmem(n_threads, sizeof(pthread_t));
+    for (unsigned int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&(threads[i]), NULL, run_walk, &walk) != 0)
+        {
+            fprintf(stderr, "%s: error creating thread\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (unsigned int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    freemem(threads);
+    qsort(&(files->names[first]), files->n_names - first, sizeof(char *), compare_names);
+
+    pthread_mutex_destroy(&(walk.mutex));
+    pthread_cond_destroy(&(walk.work));
+    freemem(walk.pending);
+}
+
+/* The names are separated by NUL bytes if there are any, and by newlines
+ * otherwise. */
+void
+read_file_list(FileList *files, char *filename, FileFilter filter)
+{
+    bool from_stdin = (strcmp(filename, "-") == 0);
+    FILE *f = (from_stdin == true) ? stdin : fopen(filename, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s: File '%s' does not exist\n", program_name, filename);
+        exit(EXIT_FAILURE);
+    }
+    size_t len = 0;
+    size_t capacity = 4096;
+    char *list = (char *) allocmem(capacity, sizeof(char));
+    size_t n;
+    while ((n = fread(list + len, sizeof(char), capacity - len - 1, f)) > 0)
+    {
+        len += n;
+        if (len + 1 == capacity)
+        {
+            capacity *= 2;
+            list = (char *) reallocmem(list, capacity);
+        }
+    }
+    if (from_stdin == false)
+    {
+        fclose(f);
+    }
+    list[len] = '\0';
+
+    char separator = (memchr(list, '\0', len) != NULL) ? '\0' : '\n';
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++)
+    {
+        if ((i < len) && (list[i] != separator))
+        {
+            continue;
+        }
+        list[i] = '\0';
+        char *name = &(list[start]);
+        start = i + 1;
+        if ((name[0] == '\0') || (passes_file_filter(filter, name, false) == false))
+        {
+            continue;
+        }
+        if (is_binary_file(open(name, O_RDONLY)) == false)
+        {
+            add_file(files, name);
+        }
+    }
+    freemem(list);
+}
+
+void
+free_file_list(FileList *files)
+{
+    for (size_t i = 0; i < files->n_names; i++)
+    {
+        freemem(files->names[i]);
+    }
+    freemem(files->names);
+    init_file_list(files);
+}
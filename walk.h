@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (C) 2025 Andrew Trettel */
+#ifndef WALK_H
+#define WALK_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* A file is taken to be binary, and skipped, when its first block contains a
+ * NUL byte. */
+static const size_t sniff_length = 4096;
+
+/* Glob patterns matched against the last component of each name.  Excluded
+ * directories are not entered. */
+typedef struct FileFilter
+{
+    char **includes;
+    size_t n_includes;
+    char **excludes;
+    size_t n_excludes;
+} FileFilter;
+
+typedef struct FileList
+{
+    char **names;
+    size_t n_names;
+    size_t capacity;
+} FileList;
+
+/* Directories still to be read.  A walk is finished when no directories are
+ * pending and no thread is reading one. */
+typedef struct Walk
+{
+    char **pending;
+    size_t n_pending;
+    size_t capacity;
+    unsigned int n_busy;
+    FileFilter filter;
+    FileList *files;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+} Walk;
+
+FileFilter init_file_filter(void);
+void add_file_filter(FileFilter *, char *, bool);
+void free_file_filter(FileFilter);
+void init_file_list(FileList *);
+void add_file(FileList *, const char *);
+void walk_directories(FileList *, size_t, char **, FileFilter, unsigned int);
+void read_file_list(FileList *, char *, FileFilter);
+void free_file_list(FileList *);
+
+#endif /* WALK_H */
@@ -8,8 +8,21 @@
 #include <string.h>
 
 #include "misc.h"
+#include "statistics.h"
 #include "words.h"
 
+/* Documents are registered before any queries are evaluated, so the table
+ * needs no lock for lookups. */
+static Document **document_table = NULL;
+static unsigned long n_document_table = 0;
+
+/* The names of fields, indexed by field number.  The body of a document is
+ * the full text field, and other fields are numbered from there in the order
+ * that their names are first read.  Like documents, fields are registered
+ * before any queries are evaluated. */
+static char **field_names = NULL;
+static unsigned long n_field_names = 0;
+
 bool
 is_truncation_character(char c)
 {
@@ -52,8 +65,9 @@ is_clause_punctuation(char c)
 char *
 reduce_word(char *original, WordOrigin origin)
 {
+    size_t original_len = strlen(original);
     size_t len = 0, j = 0;
-    for (size_t i = 0; i < strlen(original); i++)
+    for (size_t i = 0; i < original_len; i++)
     {
         if ((ispunct(original[i]) == false) || ((original[i] == wildcard_character) && (origin == WO_QUERY)))
         {
@@ -62,7 +76,7 @@ reduce_word(char *original, WordOrigin origin)
     }
     len++;
     char *reduced = (char *) allocmem(len, sizeof(char));
-    for (size_t i = 0; i < strlen(original); i++)
+    for (size_t i = 0; i < original_len; i++)
     {
         if ((ispunct(original[i]) == false) || ((original[i] == wildcard_character) && (origin == WO_QUERY)))
         {
@@ -74,19 +88,126 @@ reduce_word(char *original, WordOrigin origin)
     return reduced;
 }
 
+static bool
+is_capital_or_digit(char c)
+{
+    return ((isupper((unsigned char) c) != 0) || (isdigit((unsigned char) c) != 0));
+}
+
+/* The punctuation at the end of a word, perhaps followed by a quotation mark,
+ * and the capital or digit at its start, perhaps after one, are what mark the
+ * ends of clauses and sentences.  They are found once when the word is read. */
+unsigned char
+flags_word_data(const char *data, size_t len)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+    unsigned char flags = 0;
+    char last = data[len-1];
+    char quoted = ((len > 1) && ((last == '"') || (last == '\''))) ? data[len-2] : '\0';
+    if ((is_clause_punctuation(last) == true) || (is_clause_punctuation(quoted) == true))
+    {
+        flags |= WF_CLAUSE_PUNCTUATION;
+    }
+    if ((is_ending_punctuation(last) == true) || (is_ending_punctuation(quoted) == true))
+    {
+        flags |= WF_ENDING_PUNCTUATION;
+    }
+    if ((is_capital_or_digit(data[0]) == true) ||
+        ((len > 1) && (is_capital_or_digit(data[1]) == true) && ((data[0] == '"') || (data[0] == '\''))))
+    {
+        flags |= WF_CAPITALIZED;
+    }
+    return flags;
+}
+
+/* Names are case-folded.  Returns the number of the field, or missing_field
+ * if there is none by that name and add is false. */
+unsigned long
+find_field(const char *name, size_t len, bool add)
+{
+    char *folded = (char *) allocmem(len + 1, sizeof(char));
+    for (size_t i = 0; i < len; i++)
+    {
+        folded[i] = (char) tolower((unsigned char) name[i]);
+    }
+    folded[len] = '\0';
+    unsigned long field = missing_field;
+    if (strcmp(folded, body_field_name) == 0)
+    {
+        field = full_text_field;
+    }
+    for (unsigned long i = full_text_field + 1; (i < n_field_names) && (field == missing_field); i++)
+    {
+        if (strcmp(field_names[i], folded) == 0)
+        {
+            field = i;
+        }
+    }
+    if ((field == missing_field) && (add == true))
+    {
+        if (n_field_names == 0)
+        {
+            n_field_names = full_text_field + 1;
+            field_names = (char **) allocmem(n_field_names, sizeof(char *));
+            field_names[end_field] = NULL;
+            field_names[full_text_field] = NULL;
+        }
+        field_names = (char **) reallocmem(field_names, (n_field_names + 1) * sizeof(char *));
+        field = n_field_names;
+        field_names[field] = folded;
+        n_field_names++;
+    }
+    else
+    {
+        freemem(folded);
+    }
+    return field;
+}
+
+const char *
+name_field(unsigned long field)
+{
+    if (field == full_text_field)
+    {
+        return body_field_name;
+    }
+    else if ((field > full_text_field) && (field < n_field_names))
+    {
+        return field_names[field];
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
 void
-append_word(Word **list, char *data, char *filename, unsigned long line,
-            unsigned long column, unsigned long position, unsigned long page)
+append_word(Word **list, char *data, Document *document, unsigned long line,
+            unsigned long column, unsigned long position, unsigned long page, unsigned long field)
+{
+    append_reduced_word(list, data, reduce_word(data, WO_SOURCE), flags_word_data(data, strlen(data)), document,
+                        line, column, position, page, field);
+}
+
+/* For a word whose reduced form and flags the tokenizer has already found. */
+void
+append_reduced_word(Word **list, char *data, char *reduced, unsigned char flags, Document *document,
+                    unsigned long line, unsigned long column, unsigned long position, unsigned long page,
+                    unsigned long field)
 {
     Word *current = (Word *) allocmem(1, sizeof(Word));
     current->original = data;
-    current->reduced = reduce_word(data, WO_SOURCE);
-    current->filename = filename;
+    current->reduced = reduced;
+    current->flags = flags;
+    current->document = document;
     current->line = line;
     current->column = column;
     current->position = position;
     current->page = page;
-    current->field = full_text_field;
+    current->field = field;
     current->next = NULL;
     current->prev = *list;
     if ((*list) != NULL)
@@ -111,7 +232,25 @@ reduced_word(Word *word)
 char *
 filename_word(Word *word)
 {
-    return word->filename;
+    return word->document->filename;
+}
+
+unsigned long
+record_word(Word *word)
+{
+    return word->document->record;
+}
+
+Document *
+parent_document_word(Word *word)
+{
+    return word->document;
+}
+
+unsigned long
+document_id_word(Word *word)
+{
+    return word->document->id;
 }
 
 unsigned long
@@ -166,6 +305,47 @@ field_has_next_word(Word *word)
     }
 }
 
+/* The endings of elements, given the next word in the same field or NULL. */
+static bool
+ends_sentence(Word *word, Word *next)
+{
+    bool curr_cond = ((word->flags & WF_ENDING_PUNCTUATION) != 0);
+    if (next == NULL)
+    {
+        return curr_cond;
+    }
+    else
+    {
+        return ((curr_cond == true) && ((next->flags & WF_CAPITALIZED) != 0));
+    }
+}
+
+static bool
+ends_clause(Word *word, Word *next)
+{
+    return ((ends_sentence(word, next) == true) || ((word->flags & WF_CLAUSE_PUNCTUATION) != 0));
+}
+
+static bool
+ends_paragraph(Word *word, Word *next)
+{
+    bool sentence_cond = ends_sentence(word, next);
+    if (next == NULL)
+    {
+        return sentence_cond;
+    }
+    else
+    {
+        return ((sentence_cond == true) && (line_word(word) != line_word(next)));
+    }
+}
+
+static Word *
+field_next_word(Word *word)
+{
+    return (field_has_next_word(word) == true) ? next_word(word) : NULL;
+}
+
 bool
 clause_ending_word(Word *word)
 {
@@ -175,35 +355,7 @@ clause_ending_word(Word *word)
     }
     else
     {
-        if (sentence_ending_word(word) == true)
-        {
-            return true;
-        }
-        else
-        {
-            char *data = original_word(word);
-            size_t len = strlen(data);
-            bool curr_cond = false;
-            if (len == 1)
-            {
-                curr_cond = is_clause_punctuation(data[len-1]);
-            }
-            else
-            {
-                curr_cond = (is_clause_punctuation(data[len-1]) ||
-                    (
-                        is_clause_punctuation(data[len-2])
-                        &&
-                        (
-                            (data[len-1] == '"')
-                            ||
-                            (data[len-1] == '\'')
-                        )
-                    )
-                );
-            }
-            return curr_cond;
-        }
+        return ends_clause(word, field_next_word(word));
     }
 }
 
@@ -216,66 +368,7 @@ sentence_ending_word(Word *word)
     }
     else
     {
-        char *data = original_word(word);
-        size_t len = strlen(data);
-        bool curr_cond = false;
-        if (len == 1)
-        {
-            curr_cond = is_ending_punctuation(data[len-1]);
-        }
-        else
-        {
-            curr_cond = (is_ending_punctuation(data[len-1]) ||
-                (
-                    is_ending_punctuation(data[len-2])
-                    &&
-                    (
-                        (data[len-1] == '"')
-                        ||
-                        (data[len-1] == '\'')
-                    )
-                )
-            );
-        }
-        if (field_has_next_word(word) == false)
-        {
-            return curr_cond;
-        }
-        else
-        {
-            char *next_data = original_word(next_word(word));
-            size_t next_len = strlen(next_data);
-            bool next_cond = false;
-            if (next_len == 1)
-            {
-                next_cond = (isupper(next_data[0]) || isdigit(next_data[0]));
-            }
-            else
-            {
-                next_cond = (
-                    (isupper(next_data[0]) || isdigit(next_data[0]))
-                    ||
-                    (
-                        (isupper(next_data[1]) || isdigit(next_data[1]))
-                        &&
-                        (
-                            (next_data[0] == '"')
-                            ||
-                            (next_data[0] == '\'')
-                        )
-                    )
-                );
-            }
-
-            if ((curr_cond == true) && (next_cond == true))
-            {
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
+        return ends_sentence(word, field_next_word(word));
     }
 }
 
@@ -288,22 +381,7 @@ paragraph_ending_word(Word *word)
     }
     else
     {
-        bool sentence_cond = sentence_ending_word(word);
-        if (field_has_next_word(word) == false)
-        {
-            return sentence_cond;
-        }
-        else
-        {
-            if ((sentence_cond == true) && (line_word(word) != line_word(next_word(word))))
-            {
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
+        return ends_paragraph(word, field_next_word(word));
     }
 }
 
@@ -431,63 +509,142 @@ prev_word(Word *word)
     }
 }
 
+/* Whether the element tables of the document of a word are current for it.
+ * They are for every word of a document once it is indexed, but not for the
+ * words of a window of a stream that were read after it was last
+ * renumbered. */
+static bool
+element_table_word(Word *word)
+{
+    if ((word == NULL) || (word->document == NULL) || (word->document->elements[LE_LINE].ordinals == NULL))
+    {
+        return false;
+    }
+    Document *document = word->document;
+    return ((word->position <= document->n_words) && (document->words[word->position-1] == word));
+}
+
+/* The first word of the next element, or the last word of the field when
+ * there is none, looked up instead of stepped to word by word. */
+static Word *
+next_element_table(Word *word, LanguageElement element)
+{
+    Document *document = word->document;
+    ElementTable *table = &(document->elements[element]);
+    unsigned long i = (unsigned long) table->ordinals[word->position-1] + 1;
+    if (i == table->n_elements)
+    {
+        return document->words[document->n_words-1];
+    }
+    Word *next = document->words[table->starts[i]-1];
+    return (field_word(next) == field_word(word)) ? next : prev_word(next);
+}
+
+static Word *
+prev_element_table(Word *word, LanguageElement element)
+{
+    Document *document = word->document;
+    ElementTable *table = &(document->elements[element]);
+    return document->words[table->starts[table->ordinals[word->position-1]]-1];
+}
+
 Word *
 next_clause(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return next_element_table(word, LE_CLAUSE);
+    }
     return next_boolean_element(word, clause_ending_word);
 }
 
 Word *
 prev_clause(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return prev_element_table(word, LE_CLAUSE);
+    }
     return prev_boolean_element(word, clause_ending_word);
 }
 
 Word *
 next_line(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return next_element_table(word, LE_LINE);
+    }
     return next_numbered_element(word, line_word);
 }
 
 Word *
 prev_line(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return prev_element_table(word, LE_LINE);
+    }
     return prev_numbered_element(word, line_word);
 }
 
 Word *
 next_sentence(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return next_element_table(word, LE_SENTENCE);
+    }
     return next_boolean_element(word, sentence_ending_word);
 }
 
 Word *
 prev_sentence(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return prev_element_table(word, LE_SENTENCE);
+    }
     return prev_boolean_element(word, sentence_ending_word);
 }
 
 Word *
 next_paragraph(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return next_element_table(word, LE_PARAGRAPH);
+    }
     return next_boolean_element(word, paragraph_ending_word);
 }
 
 Word *
 prev_paragraph(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return prev_element_table(word, LE_PARAGRAPH);
+    }
     return prev_boolean_element(word, paragraph_ending_word);
 }
 
 Word *
 next_page(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return next_element_table(word, LE_PAGE);
+    }
     return next_numbered_element(word, page_word);
 }
 
 Word *
 prev_page(Word *word)
 {
+    if (element_table_word(word) == true)
+    {
+        return prev_element_table(word, LE_PAGE);
+    }
     return prev_numbered_element(word, page_word);
 }
 
@@ -537,7 +694,7 @@ field_last_word(Word *word)
 Word *
 document_word(Word *word)
 {
-    return list_first_word(word);
+    return first_word_document(parent_document_word(word));
 }
 
 /* This is a wrapper function to handle the ends of the input word list safely.
@@ -575,6 +732,193 @@ advance_word(Word *word, LanguageElement element, int n)
     return current;
 }
 
+Document *
+init_document(char *filename, unsigned long id)
+{
+    Document *document = (Document *) allocmem(1, sizeof(Document));
+    document->id = id;
+    document->filename = (char *) allocmem((strlen(filename)+1), sizeof(char));
+    snprintf(document->filename, strlen(filename)+1, "%s", filename);
+    document->record = 0;
+    document->first = NULL;
+    document->words = NULL;
+    document->n_words = 0;
+    for (int k = LE_WORD; k <= LE_PAGE; k++)
+    {
+        document->elements[k].ordinals = NULL;
+        document->elements[k].starts = NULL;
+        document->elements[k].n_elements = 0;
+    }
+    if (id >= n_document_table)
+    {
+        document_table = (Document **) reallocmem(document_table, (id + 1) * sizeof(Document *));
+        for (unsigned long i = n_document_table; i <= id; i++)
+        {
+            document_table[i] = NULL;
+        }
+        n_document_table = id + 1;
+    }
+    assert(document_table[id] == NULL);
+    document_table[id] = document;
+    return document;
+}
+
+static void
+free_elements_document(Document *document)
+{
+    for (int k = LE_CLAUSE; k <= LE_PAGE; k++)
+    {
+        freemem(document->elements[k].ordinals);
+        freemem(document->elements[k].starts);
+        document->elements[k].ordinals = NULL;
+        document->elements[k].starts = NULL;
+        document->elements[k].n_elements = 0;
+    }
+}
+
+/* Numbers the elements of every kind in one pass over the words.  An element
+ * starts after a word that ends one, given the word after it in the same
+ * field, or where the field changes. */
+static void
+index_elements_document(Document *document)
+{
+    free_elements_document(document);
+    unsigned long n = document->n_words;
+    if (n == 0)
+    {
+        return;
+    }
+    for (int k = LE_CLAUSE; k <= LE_PAGE; k++)
+    {
+        document->elements[k].ordinals = (uint32_t *) allocmem(n, sizeof(uint32_t));
+        document->elements[k].starts = (uint32_t *) allocmem(n, sizeof(uint32_t));
+        document->elements[k].ordinals[0] = 0;
+        document->elements[k].starts[0] = 1;
+        document->elements[k].n_elements = 1;
+    }
+    for (unsigned long j = 1; j < n; j++)
+    {
+        Word *prev = document->words[j-1];
+        Word *current = document->words[j];
+        bool new_field = (field_word(prev) != field_word(current));
+        bool starts[LE_PAGE+1];
+        starts[LE_CLAUSE] = (new_field == true) || (ends_clause(prev, current) == true);
+        starts[LE_LINE] = (new_field == true) || (line_word(prev) != line_word(current));
+        starts[LE_SENTENCE] = (new_field == true) || (ends_sentence(prev, current) == true);
+        starts[LE_PARAGRAPH] = (new_field == true) || (ends_paragraph(prev, current) == true);
+        starts[LE_PAGE] = (new_field == true) || (page_word(prev) != page_word(current));
+        for (int k = LE_CLAUSE; k <= LE_PAGE; k++)
+        {
+            ElementTable *table = &(document->elements[k]);
+            if (starts[k] == true)
+            {
+                table->starts[table->n_elements++] = (uint32_t) (j + 1);
+            }
+            table->ordinals[j] = (uint32_t) (table->n_elements - 1);
+        }
+    }
+    for (int k = LE_CLAUSE; k <= LE_PAGE; k++)
+    {
+        ElementTable *table = &(document->elements[k]);
+        table->starts = (uint32_t *) reallocmem(table->starts, table->n_elements * sizeof(uint32_t));
+    }
+}
+
+/* Positions start at 1 and increase by one for each word in the list. */
+void
+index_document(Document *document, Word *list)
+{
+    document->first = list_first_word(list);
+    document->n_words = 0;
+    WordIterator iterator = init_word_iterator(document->first, next_word, false);
+    while (iterator_has_next_word(iterator) == true)
+    {
+        iterator_next_word(&iterator);
+        document->n_words++;
+    }
+    document->words = (Word **) allocmem((document->n_words == 0) ? 1 : document->n_words, sizeof(Word *));
+    iterator = init_word_iterator(document->first, next_word, false);
+    while (iterator_has_next_word(iterator) == true)
+    {
+        Word *current = iterator_next_word(&iterator);
+        assert(position_word(current) <= document->n_words);
+        document->words[position_word(current)-1] = current;
+    }
+    index_elements_document(document);
+}
+
+/* A window of a stream is numbered from 1 each time that it moves, so that
+ * the arrays indexed by position stay as small as the window. */
+void
+renumber_document(Document *document, Word *list)
+{
+    unsigned long position = 1;
+    WordIterator iterator = init_word_iterator(list, next_word, false);
+    while (iterator_has_next_word(iterator) == true)
+    {
+        Word *current = iterator_next_word(&iterator);
+        current->position = position++;
+    }
+    freemem(document->words);
+    index_document(document, list);
+}
+
+unsigned long
+id_document(Document *document)
+{
+    return document->id;
+}
+
+Word *
+first_word_document(Document *document)
+{
+    return document->first;
+}
+
+Word *
+word_document(Document *document, unsigned long position)
+{
+    assert(position >= 1);
+    assert(position <= document->n_words);
+    return document->words[position-1];
+}
+
+unsigned long
+number_of_words_document(Document *document)
+{
+    return document->n_words;
+}
+
+Document *
+find_document(unsigned long id)
+{
+    if (id >= n_document_table)
+    {
+        return NULL;
+    }
+    else
+    {
+        return document_table[id];
+    }
+}
+
+void
+free_document(Document *document)
+{
+    if (document != NULL)
+    {
+        if (document->id < n_document_table)
+        {
+            document_table[document->id] = NULL;
+        }
+        free_words(document->first);
+        freemem(document->words);
+        free_elements_document(document);
+        freemem(document->filename);
+        freemem(document);
+    }
+}
+
 void
 print_words(Word *list)
 {
@@ -598,9 +942,22 @@ free_words(Word *list)
     while (iterator_has_next_word(iterator) == true)
     {
         Word *current = iterator_next_word(&iterator);
-        free(current->original);
-        free(current->reduced);
-        free(current);
+        freemem(current->original);
+        freemem(current->reduced);
+        freemem(current);
+    }
+}
+
+/* Frees the words of the list that come before the word. */
+void
+free_words_before(Word *word)
+{
+    Word *prev = prev_word(word);
+    if (prev != NULL)
+    {
+        prev->next = NULL;
+        word->prev = NULL;
+        free_words(list_first_word(prev));
     }
 }
 
@@ -616,6 +973,7 @@ Word *
 iterator_next_word(WordIterator *iterator)
 {
     Word *next = iterator->next;
+    count_statistic(CT_WORD_STEPS, 1);
     iterator->prev_field = field_word(next);
     iterator->next = iterator->direction_word(next);
     return next;
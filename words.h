@@ -3,21 +3,36 @@
 #ifndef WORDS_H
 #define WORDS_H
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 static const char wildcard_character = '?';
 static const unsigned long end_field = 0;
 static const unsigned long full_text_field = 1;
+static const unsigned long missing_field = ULONG_MAX; /* A name that no field has */
+static const char body_field_name[] = "body";
 
 bool is_truncation_character(char);
 bool is_clause_punctuation(char);
 bool is_ending_punctuation(char);
 
+struct Document;
+
+typedef enum WordFlag
+{
+    WF_CLAUSE_PUNCTUATION = 1,
+    WF_ENDING_PUNCTUATION = 2,
+    WF_CAPITALIZED = 4
+} WordFlag;
+
 typedef struct Word
 {
     char *original;
     char *reduced; /* The lowercase word without any punctuation */
-    char *filename;
+    unsigned char flags; /* WordFlag bits */
+    struct Document *document;
     unsigned long line; /* Line and column for locating word in input */
     unsigned long column;
     unsigned long position; /* Position for order in doubly-linked list */
@@ -37,6 +52,43 @@ typedef enum LanguageElement
     LE_PAGE
 } LanguageElement;
 
+/* The elements of one kind in a document are numbered in order from 0.  An
+ * element ends where the next_ and prev_ functions of its kind say it does,
+ * and also wherever the field changes, so that no element spans two runs of
+ * fields.  Positions are kept in 32 bits, since a document that large would
+ * not fit in memory anyway. */
+typedef struct ElementTable
+{
+    uint32_t *ordinals; /* The element of each word, indexed by position - 1 */
+    uint32_t *starts; /* The position of the first word of each element */
+    unsigned long n_elements;
+} ElementTable;
+
+/* Each input file is a document, or each of its records is.  Documents are
+ * numbered in the order that they are read, or by their slot in a persistent
+ * index, and the table of documents maps a document number and a word
+ * position back to the word itself. */
+typedef struct Document
+{
+    unsigned long id;
+    char *filename;
+    unsigned long record; /* Within the file from 1, or 0 for a whole file */
+    Word *first;
+    Word **words; /* Indexed by position - 1 */
+    unsigned long n_words;
+    ElementTable elements[LE_PAGE+1]; /* Indexed by LanguageElement, except for words */
+} Document;
+
+Document *init_document(char *, unsigned long);
+void index_document(Document *, Word *);
+void renumber_document(Document *, Word *);
+unsigned long id_document(Document *);
+Word *first_word_document(Document *);
+Word *word_document(Document *, unsigned long);
+unsigned long number_of_words_document(Document *);
+Document *find_document(unsigned long);
+void free_document(Document *);
+
 typedef enum WordOrigin
 {
     WO_SOURCE,
@@ -52,10 +104,20 @@ typedef struct WordIterator
 } WordIterator;
 
 char *reduce_word(char *, WordOrigin);
-void append_word(Word **, char *, char *, unsigned long, unsigned long, unsigned long, unsigned long);
+unsigned char flags_word_data(const char *, size_t);
+unsigned long find_field(const char *, size_t, bool);
+const char *name_field(unsigned long);
+
+void append_word(Word **, char *, Document *, unsigned long, unsigned long, unsigned long, unsigned long,
+                 unsigned long);
+void append_reduced_word(Word **, char *, char *, unsigned char, Document *, unsigned long, unsigned long, unsigned long,
+                         unsigned long, unsigned long);
 char *original_word(Word *);
 char *reduced_word(Word *);
 char *filename_word(Word *);
+unsigned long record_word(Word *);
+Document *parent_document_word(Word *);
+unsigned long document_id_word(Word *);
 unsigned long line_word(Word *);
 unsigned long column_word(Word *);
 unsigned long position_word(Word *);
@@ -89,6 +151,7 @@ Word *document_word(Word *);
 Word *advance_word(Word *, LanguageElement, int);
 void print_words(Word *);
 void free_words(Word *);
+void free_words_before(Word *);
 
 WordIterator init_word_iterator(Word *, Word *direction_word(Word *), bool);
 Word *iterator_next_word(WordIterator *);
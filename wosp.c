@@ -1,34 +1,501 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 /* Copyright (C) 2025 Andrew Trettel */
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "batch.h"
+#include "cache.h"
+#include "index.h"
 #include "input.h"
 #include "interpreter.h"
+#include "misc.h"
 #include "output.h"
 #include "search.h"
+#include "shard.h"
+#include "statistics.h"
+#include "stream.h"
+#include "walk.h"
 #include "words.h"
 
+static void
+print_usage(FILE *stream)
+{
+    fprintf(stream, "Usage: %s [OPTION]... QUERY [FILE]...\n", program_name);
+    fprintf(stream, "   or: %s [OPTION]... --batch QUERIES [FILE]...\n", program_name);
+    fprintf(stream, "   or: %s --index INDEX --update [FILE]...\n", program_name);
+    fprintf(stream, "\n");
+    fprintf(stream, "  -b, --batch QUERIES      read one query per line from QUERIES ('-' for stdin)\n");
+    fprintf(stream, "  -i, --index INDEX        keep the words of each file in INDEX and reread only\n");
+    fprintf(stream, "                           files that changed\n");
+    fprintf(stream, "  -u, --update             update the index with FILEs and exit\n");
+    fprintf(stream, "  -r, --recursive DIR      search every text file under DIR\n");
+    fprintf(stream, "      --files-from FILE    search the files named in FILE ('-' for stdin)\n");
+    fprintf(stream, "      --include GLOB       search only files whose names match GLOB\n");
+    fprintf(stream, "      --exclude GLOB       skip files and directories whose names match GLOB\n");
+    fprintf(stream, "      --fields             read 'Name: value' lines at the start of each file as\n");
+    fprintf(stream, "                           fields\n");
+    fprintf(stream, "      --records SEP        split each file into records separated by SEP: blank,\n");
+    fprintf(stream, "                           formfeed, nul, or line:WORD\n");
+    fprintf(stream, "      --page-marker WORD   start a new page at each line that starts with WORD as\n");
+    fprintf(stream, "                           well as at each form feed\n");
+    fprintf(stream, "      --page-numbers       print the page number of each match\n");
+    fprintf(stream, "  -j, --jobs N             evaluate up to N batch queries or walk N directories at\n");
+    fprintf(stream, "                           once\n");
+    fprintf(stream, "  -s, --shards N           split FILEs among N worker processes\n");
+    fprintf(stream, "      --top K              print only the K best-scoring documents, best first\n");
+    fprintf(stream, "  -m, --memory-limit SIZE  spill intermediate results to disk above SIZE bytes\n");
+    fprintf(stream, "      --cache DIR          reuse the results of earlier queries kept in DIR\n");
+    fprintf(stream, "      --cache-size SIZE    keep at most SIZE bytes of results in the cache\n");
+    fprintf(stream, "      --by-document        evaluate queries one document at a time\n");
+    fprintf(stream, "      --timeout SECONDS    stop each query after SECONDS and print the results\n");
+    fprintf(stream, "                           found so far\n");
+    fprintf(stream, "      --max-terms N        reject queries with a term that expands to more than N\n");
+    fprintf(stream, "                           dictionary terms\n");
+    fprintf(stream, "      --max-matches N      reject queries with an operator that produces more than\n");
+    fprintf(stream, "                           N matches\n");
+    fprintf(stream, "      --max-query-memory SIZE\n");
+    fprintf(stream, "                           reject queries that allocate more than SIZE bytes\n");
+    fprintf(stream, "      --stream[=N]         search stdin N paragraphs at a time in bounded memory\n");
+    fprintf(stream, "      --explain            report the cost of each part of the query on stderr\n");
+    fprintf(stream, "      --stats[=FORMAT]     report counters and phase times on stderr as text or json\n");
+    fprintf(stream, "  -h, --help               print this help and exit\n");
+}
+
+static bool
+is_option(char *arg, const char *short_name, const char *long_name)
+{
+    return ((strcmp(arg, short_name) == 0) || (strcmp(arg, long_name) == 0));
+}
+
+static char *
+option_argument(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+    {
+        fprintf(stderr, "%s: Option '%s' requires an argument\n", program_name, argv[*i]);
+        exit(EXIT_FAILURE);
+    }
+    (*i)++;
+    return argv[*i];
+}
+
+static unsigned int
+positive_option_argument(int argc, char *argv[], int *i)
+{
+    char *option = argv[*i];
+    char *arg = option_argument(argc, argv, i);
+    char *endptr;
+    long n = strtol(arg, &endptr, 10);
+    if ((*endptr != '\0') || (n < 1))
+    {
+        fprintf(stderr, "%s: Option '%s' requires a positive number\n", program_name, option);
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned int) n;
+}
+
+/* Workers cannot share stdin, so sharding needs named files. */
+static size_t
+sharded_names(size_t n_names)
+{
+    if (n_names == 0)
+    {
+        fprintf(stderr, "%s: Option '--shards' requires at least one FILE\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    return n_names;
+}
+
+/* Files read directly form one segment.  With an index, the files are added
+ * to it or refreshed, every live document in it is searched segment by
+ * segment, and small segments are merged in the background meanwhile. */
+static size_t
+read_corpus(char *index_filename, size_t n_names, char *names[], Index **index, Segment **segments)
+{
+    if (index_filename == NULL)
+    {
+        *index = NULL;
+        *segments = (Segment *) allocmem(1, sizeof(Segment));
+        (*segments)[0].n_documents = read_data(n_names, names, &((*segments)[0].trie), &((*segments)[0].documents));
+        return 1;
+    }
+    *index = open_index(index_filename);
+    update_index(*index, n_names, names);
+    size_t n_segments = load_index(*index, segments);
+    start_merge_index(*index);
+    return n_segments;
+}
+
+static void
+free_corpus(Index *index, size_t n_segments, Segment *segments)
+{
+    for (size_t i = 0; i < n_segments; i++)
+    {
+        free_data(segments[i].n_documents, segments[i].trie, segments[i].documents);
+    }
+    freemem(segments);
+    if (index != NULL)
+    {
+        close_index(index);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
-    TrieNode *trie = NULL;
-    char **filenames = NULL;
-    Word **words = NULL;
+    Index *index = NULL;
+    Segment *segments = NULL;
 
-    /* Search options */
-    CaseMode case_mode = CM_INSENSITIVE;
-    unsigned int edit_dist = 0;
-    ProximityMode proximity_mode = PM_INCLUSIVE;
+    reserve_memory();
 
-    /* Output options */
+    SearchOptions search_options = init_search_options();
     OutputOptions output_options = init_output_options();
 
     /* Additional options */
-    TokenType default_operator_type = TK_OR_OP;
+    char *batch_filename = NULL;
+    char *index_filename = NULL;
+    bool update_only = false;
+    unsigned int n_threads = default_number_of_threads();
+    unsigned int n_shards = 0;
+    char **directories = NULL;
+    size_t n_directories = 0;
+    char *list_filename = NULL;
+    FileFilter filter = init_file_filter();
+    char *cache_directory = NULL;
+    size_t cache_size = default_result_cache_size;
+    size_t stream_window = 0;
+    bool records = false;
+    bool print_stats = false;
+    StatisticsFormat stats_format = SF_TEXT;
+
+    int i = 1;
+    while ((i < argc) && (argv[i][0] == '-') && (argv[i][1] != '\0'))
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        else if (is_option(argv[i], "-b", "--batch"))
+        {
+            batch_filename = option_argument(argc, argv, &i);
+        }
+        else if (is_option(argv[i], "-i", "--index"))
+        {
+            index_filename = option_argument(argc, argv, &i);
+        }
+        else if (is_option(argv[i], "-u", "--update"))
+        {
+            update_only = true;
+        }
+        else if (is_option(argv[i], "-r", "--recursive"))
+        {
+            directories = (char **) reallocmem(directories, (n_directories + 1) * sizeof(char *));
+            directories[n_directories++] = option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--files-from") == 0)
+        {
+            list_filename = option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--include") == 0)
+        {
+            add_file_filter(&filter, option_argument(argc, argv, &i), false);
+        }
+        else if (strcmp(argv[i], "--exclude") == 0)
+        {
+            add_file_filter(&filter, option_argument(argc, argv, &i), true);
+        }
+        else if (is_option(argv[i], "-j", "--jobs"))
+        {
+            n_threads = positive_option_argument(argc, argv, &i);
+        }
+        else if (is_option(argv[i], "-s", "--shards"))
+        {
+            n_shards = positive_option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--top") == 0)
+        {
+            output_options.top = positive_option_argument(argc, argv, &i);
+        }
+        else if (is_option(argv[i], "-m", "--memory-limit"))
+        {
+            char *option = argv[i];
+            size_t budget = 0;
+            if (parse_memory_size(option_argument(argc, argv, &i), &budget) == false)
+            {
+                fprintf(stderr, "%s: Option '%s' requires a size such as 512M or 2G\n", program_name, option);
+                exit(EXIT_FAILURE);
+            }
+            set_memory_budget(budget);
+        }
+        else if (strcmp(argv[i], "--cache") == 0)
+        {
+            cache_directory = option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0)
+        {
+            if (parse_memory_size(option_argument(argc, argv, &i), &cache_size) == false)
+            {
+                fprintf(stderr, "%s: Option '--cache-size' requires a size such as 512M or 2G\n", program_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            stream_window = default_stream_window;
+        }
+        else if (strncmp(argv[i], "--stream=", strlen("--stream=")) == 0)
+        {
+            char *endptr;
+            long n = strtol(argv[i] + strlen("--stream="), &endptr, 10);
+            if ((*endptr != '\0') || (n < 1))
+            {
+                fprintf(stderr, "%s: Option '--stream' requires a positive number\n", program_name);
+                exit(EXIT_FAILURE);
+            }
+            stream_window = (size_t) n;
+        }
+        else if (strcmp(argv[i], "--fields") == 0)
+        {
+            set_header_fields(true);
+        }
+        else if (strcmp(argv[i], "--records") == 0)
+        {
+            records = true;
+            if (set_record_separator(option_argument(argc, argv, &i)) == false)
+            {
+                fprintf(stderr, "%s: Option '--records' requires blank, formfeed, nul, or line:WORD\n",
+                        program_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--page-marker") == 0)
+        {
+            if (set_page_marker(option_argument(argc, argv, &i)) == false)
+            {
+                fprintf(stderr, "%s: Option '--page-marker' requires a single word\n", program_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--page-numbers") == 0)
+        {
+            output_options.page_number = true;
+        }
+        else if (strcmp(argv[i], "--by-document") == 0)
+        {
+            search_options.by_document = true;
+        }
+        else if (strcmp(argv[i], "--timeout") == 0)
+        {
+            char *endptr;
+            double seconds = strtod(option_argument(argc, argv, &i), &endptr);
+            if ((*endptr != '\0') || ((seconds > 0.0) == false))
+            {
+                fprintf(stderr, "%s: Option '--timeout' requires a positive number of seconds\n", program_name);
+                exit(EXIT_FAILURE);
+            }
+            search_options.timeout = seconds;
+        }
+        else if (strcmp(argv[i], "--max-terms") == 0)
+        {
+            search_options.limits.max_terms = positive_option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--max-matches") == 0)
+        {
+            search_options.limits.max_matches = positive_option_argument(argc, argv, &i);
+        }
+        else if (strcmp(argv[i], "--max-query-memory") == 0)
+        {
+            if ((parse_memory_size(option_argument(argc, argv, &i), &(search_options.limits.max_bytes)) == false) ||
+                (search_options.limits.max_bytes == 0))
+            {
+                fprintf(stderr, "%s: Option '--max-query-memory' requires a size such as 512M or 2G\n",
+                        program_name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--explain") == 0)
+        {
+            search_options.explain = true;
+        }
+        else if ((strcmp(argv[i], "--stats") == 0) || (strcmp(argv[i], "--stats=text") == 0))
+        {
+            print_stats = true;
+            stats_format = SF_TEXT;
+        }
+        else if (strcmp(argv[i], "--stats=json") == 0)
+        {
+            print_stats = true;
+            stats_format = SF_JSON;
+        }
+        else if (is_option(argv[i], "-h", "--help"))
+        {
+            print_usage(stdout);
+            return EXIT_SUCCESS;
+        }
+        else
+        {
+            fprintf(stderr, "%s: Unknown option '%s'\n", program_name, argv[i]);
+            print_usage(stderr);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+    if ((print_stats == true) || (explain_search_options(search_options) == true))
+    {
+        enable_statistics();
+    }
+
+    if ((top_output_options(output_options) > 0) && ((n_shards > 0) || (stream_window > 0)))
+    {
+        fprintf(stderr, "%s: Option '--top' cannot be used with '--shards' or '--stream'\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    if ((n_shards > 0) && ((index_filename != NULL) || (update_only == true)))
+    {
+        fprintf(stderr, "%s: Option '--shards' cannot be used with '--index'\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    if ((records == true) && ((index_filename != NULL) || (update_only == true) || (stream_window > 0)))
+    {
+        fprintf(stderr, "%s: Option '--records' cannot be used with '--index' or '--stream'\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    if ((stream_window > 0) && ((update_only == true) || (batch_filename != NULL) || (index_filename != NULL) ||
+                                (n_shards > 0) || (n_directories > 0) || (list_filename != NULL) ||
+                                (i + 1 < argc)))
+    {
+        fprintf(stderr, "%s: Option '--stream' requires a single query with input from stdin\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+    if ((list_filename != NULL) && (strcmp(list_filename, "-") == 0) && (batch_filename != NULL) &&
+        (strcmp(batch_filename, "-") == 0))
+    {
+        fprintf(stderr, "%s: Queries and file names cannot both be read from stdin\n", program_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((cache_directory != NULL) && (update_only == false))
+    {
+        open_result_cache(cache_directory, cache_size);
+    }
+
+    /* Names given on the command line come first, in the order given,
+     * followed by those from the file list and then those found in
+     * directories. */
+    int first_name = ((update_only == true) || (batch_filename != NULL)) ? i : i + 1;
+    size_t n_names = (first_name < argc) ? (size_t) (argc - first_name) : 0;
+    char **names = &(argv[(first_name < argc) ? first_name : argc]);
+    FileList files;
+    init_file_list(&files);
+    if ((n_directories > 0) || (list_filename != NULL))
+    {
+        for (size_t j = 0; j < n_names; j++)
+        {
+            add_file(&files, names[j]);
+        }
+        if (list_filename != NULL)
+        {
+            read_file_list(&files, list_filename, filter);
+        }
+        walk_directories(&files, n_directories, directories, filter, n_threads);
+        if (files.n_names == 0)
+        {
+            fprintf(stderr, "%s: No input files found\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        n_names = files.n_names;
+        names = files.names;
+    }
+
+    if (update_only == true)
+    {
+        if (index_filename == NULL)
+        {
+            fprintf(stderr, "%s: Option '--update' requires '--index'\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        index = open_index(index_filename);
+        update_index(index, n_names, names);
+        merge_index(index);
+        print_index_summary(stderr, index);
+        close_index(index);
+    }
+    else if (batch_filename == NULL)
+    {
+        if (i >= argc)
+        {
+            fprintf(stderr, "%s: No query given\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        char *query = argv[i];
+        if (stream_window > 0)
+        {
+            interpret_query_stream(stdout, stdin, query, stream_window, search_options, output_options);
+        }
+        else if (n_shards > 0)
+        {
+            Shard *shards = NULL;
+            size_t n_started = start_shards(n_shards, sharded_names(n_names), names, search_options, output_options,
+                                            &shards);
+            interpret_query_shards(stdout, query, shards, n_started, search_options, output_options);
+            stop_shards(shards, n_started);
+        }
+        else
+        {
+            size_t n_segments = read_corpus(index_filename, n_names, names, &index, &segments);
+            interpret_query(stdout, query, segments, n_segments, NULL, search_options, output_options);
+            free_corpus(index, n_segments, segments);
+        }
+    }
+    else
+    {
+        bool queries_from_stdin = (strcmp(batch_filename, "-") == 0);
+        if ((queries_from_stdin == true) && (n_names == 0) && (index_filename == NULL))
+        {
+            fprintf(stderr, "%s: Queries and input cannot both be read from stdin\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        FILE *f = (queries_from_stdin == true) ? stdin : fopen(batch_filename, "r");
+        if (f == NULL)
+        {
+            fprintf(stderr, "%s: File '%s' does not exist\n", program_name, batch_filename);
+            exit(EXIT_FAILURE);
+        }
+        char **queries = NULL;
+        size_t n_queries = read_queries(f, &queries);
+        if (queries_from_stdin == false)
+        {
+            fclose(f);
+        }
+        if (n_shards > 0)
+        {
+            Shard *shards = NULL;
+            size_t n_started = start_shards(n_shards, sharded_names(n_names), names, search_options, output_options,
+                                            &shards);
+            interpret_queries_shards(stdout, n_queries, queries, shards, n_started, search_options, output_options);
+            stop_shards(shards, n_started);
+        }
+        else
+        {
+            size_t n_segments = read_corpus(index_filename, n_names, names, &index, &segments);
+            interpret_queries(stdout, n_queries, queries, segments, n_segments, search_options, output_options,
+                              n_threads);
+            free_corpus(index, n_segments, segments);
+        }
+        free_queries(n_queries, queries);
+    }
+    close_result_cache();
+    free_file_list(&files);
+    freemem(directories);
+    free_file_filter(filter);
 
-    size_t n_files = read_data(argc, argv, &trie, &filenames, &words);
-    interpret_query(argv[1], trie, case_mode, edit_dist, proximity_mode, default_operator_type, output_options);
-    free_data(n_files, trie, filenames, words);
+    if (print_stats == true)
+    {
+        print_statistics(stderr, stats_format);
+    }
 
     return EXIT_SUCCESS;
 }